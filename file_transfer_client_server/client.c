@@ -2,13 +2,15 @@
     Description: The client reads commands from an input file and sends 
                 packets containing the commands, corresponding to the 
                 client's ID, to the server for execution.
-	Usage: ./client id input_file
+	Usage: ./client [-w window] id input_file [socket_path]
+            -w  max requests in flight (default 32; 1 waits for each reply)
 */
 
 #include "common.h"
 #include <ctype.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,42 +18,73 @@
 #include <unistd.h>
 
 #define MAXTOKEN 32			// Max tokens in command
+#define MAXLINE 1024		// Max characters in a command line
+#define MAXWINDOW 1024		// Max requests in flight
+#define DEFAULT_WINDOW 32	// Requests in flight without -w
+
+// Requests sent and not yet answered. Replies carry the seq of their
+// request, so they are matched to it in whatever order they arrive.
+// Requests, with their batch bodies, are held in out until the client
+// has to wait for a reply, then written together. File contents go
+// between the socket and local files with sendfile and splice, so they
+// never pass through the client's memory.
+struct Window {
+    int fd;
+    int size;                       // max requests in flight; 1 is stop-and-wait
+    int in_flight;
+    unsigned int next_seq;
+    struct Packet sent[MAXWINDOW];  // seq 0 marks a free slot; num is a batch's objects
+    char *file[MAXWINDOW];          // local file an FGET saves to
+    char *out;
+    size_t out_len, out_cap;
+    int pipe_fds[2];                // for splice
+};
+
+int send_request(struct Window *w, struct Packet *p, const char *body, const char *file);
+int send_upload(struct Window *w, struct Packet *p, const char *path);
+int flush_requests(struct Window *w);
+int recv_download(struct Window *w, const char *path, off_t size);
+int wait_reply(struct Window *w);
+int drain_window(struct Window *w);
 
 
 /*
     Client main function reads commands from the input file and sends 
-    them to the server in packets.
+    them to the server in packets, keeping up to a window of requests
+    in flight. A delay or quit waits for every reply first, so it still
+    comes between the commands before and after it.
 */
 int main (int argc, char *argv[]) {
     int id;
     char *input_file;
+    int window = DEFAULT_WINDOW;
 
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s id input_file\n", argv[0]);
+    int arg = 1;
+    if (argc > 2 && strcmp(argv[1], "-w") == 0) {
+        window = atoi(argv[2]);
+        arg = 3;
+    }
+    if (argc - arg != 2 && argc - arg != 3) {
+        fprintf(stderr, "Usage: %s [-w window] id input_file [socket_path]\n", argv[0]);
         return 1;
     }
-
-    id = atoi(argv[1]);
-    input_file = argv[2];
-    if (id < 1 || id > NCLIENT) {
-        printf("Please use an id within the range [1,%d]\n", NCLIENT);
+    if (window < 1 || window > MAXWINDOW) {
+        fprintf(stderr, "The window must be from 1 to %d requests\n", MAXWINDOW);
         return 1;
     }
 
-    // Initialize variables
-    char fifo_x_server[12], fifo_server_x[12];
-	sprintf(fifo_x_server, "fifo-%c-0", argv[1][0]);
-	sprintf(fifo_server_x, "fifo-0-%c", argv[1][0]);
-
-    // Open input file and fifos
-    int write_fifo = open(fifo_x_server, O_WRONLY);
-    if (write_fifo < 0) {
-        fprintf(stderr, "Error opening write FIFO %s\n", fifo_x_server);
+    id = atoi(argv[arg]);
+    input_file = argv[arg + 1];
+    if (id < 1) {
+        printf("Please use an id of at least 1\n");
         return 1;
     }
-    int read_fifo = open(fifo_server_x, O_RDONLY | O_NONBLOCK);
-    if (read_fifo < 0) {
-        fprintf(stderr, "Error opening read FIFO %s\n", fifo_server_x);
+    const char *socket_path = argc - arg == 3 ? argv[arg + 2] : SOCKET_PATH;
+
+    // Open input file and connect to the server; requests and replies share the socket
+    int sock = connect_server(socket_path);
+    if (sock < 0) {
+        fprintf(stderr, "Error connecting to server socket %s\n", socket_path);
         return 1;
     }
     FILE *fp = fopen(input_file, "r");
@@ -59,12 +92,20 @@ int main (int argc, char *argv[]) {
         fprintf(stderr, "Error opening input file %s\n", input_file);
         return 1;
     }
+    // A server that quits mid-batch is reported, not fatal
+    signal(SIGPIPE, SIG_IGN);
+    struct Window *w = calloc(1, sizeof(*w));
+    w->fd = sock;
+    w->size = window;
+    w->next_seq = 1;
+    pipe(w->pipe_fds);
+    fcntl(w->pipe_fds[0], F_SETPIPE_SZ, CHUNK_SIZE);
 
-    printf("Running client (id= %d, input_file= %s)\n\n", id, input_file);
+    printf("Running client (id= %d, input_file= %s, window= %d)\n\n", id, input_file, window);
     
     // Read input
-    char buffer[MAXWORD];
-    while(fgets(buffer, MAXWORD, fp) != NULL) {
+    char buffer[MAXLINE];
+    while(fgets(buffer, MAXLINE, fp) != NULL) {
         // Remove trailing newline
         if (buffer[strlen(buffer)-1] == '\n') buffer[strlen(buffer)-1] = '\0';
         
@@ -87,42 +128,88 @@ int main (int argc, char *argv[]) {
         }
 
         // Process command if it matches the client id
-        if (atoi(tokens[0]) == id) {
+        if (count >= 2 && atoi(tokens[0]) == id) {
             if (strcmp(tokens[1], "quit") == 0) {
-                // Notify server that this client is done
-                struct Packet p_close = {id, "QUIT", "", 0.0};
-                write(write_fifo, &p_close, sizeof(p_close));
-                printf("Client %d has finished.\n", id);
+                // Notify server that this client is done, once its requests are
+                if (drain_window(w) == 0) {
+                    struct Packet p_close = {id, "QUIT", "", 0.0};
+                    send_packet(sock, &p_close);
+                    printf("Client %d has finished.\n", id);
+                }
 
-                // Quit without closing read_fifo to avoid blocking server
-                close(write_fifo);
+                close(sock);
                 fclose(fp);
+                free(w);
                 return 0;
             }
 
             struct Packet p = {id, "", "", 0.0};
-            strcpy(p.type, tokens[1]);
+            // Batches carry a short type; MDELETE doesn't fit
+            strncpy(p.type, strcmp(tokens[1], "mdelete") == 0 ? "mdel" : tokens[1], sizeof(p.type) - 1);
             // Convert type to uppercase
             for (long unsigned int i = 0; i < sizeof(p.type); i++) {
                 p.type[i] = toupper(p.type[i]);
             }
 
-            if (!strcmp(tokens[1], "put") || !strcmp(tokens[1], "get") || !strcmp(tokens[1], "delete")) {
+            // Object names must fit in a packet
+            int named = !strcmp(tokens[1], "put") || !strcmp(tokens[1], "get") || !strcmp(tokens[1], "delete")
+                || !strcmp(tokens[1], "fput") || !strcmp(tokens[1], "fget");
+            if (named && count >= 3 && strlen(tokens[2]) > MAXWORD) {
+                fprintf(stderr, "Object name longer than %d characters: %s\n", MAXWORD, tokens[2]);
+                continue;
+            }
+
+            if ((!strcmp(tokens[1], "put") || !strcmp(tokens[1], "get") || !strcmp(tokens[1], "delete")) && count >= 3) {
                 strcpy(p.message, tokens[2]);
-                write(write_fifo, &p, sizeof(p));
-                printf("Transmitted (src= client:%d) %s: %s\n", id, p.type, p.message);
-                if (recv_packet(read_fifo) != 0) {
+                if (send_request(w, &p, NULL, NULL) != 0) {
                     break;
                 }
+                printf("Transmitted (src= client:%d) %s: %s (seq= %u)\n", id, p.type, p.message, p.seq);
+            }
+            else if ((!strcmp(tokens[1], "fput") || !strcmp(tokens[1], "fget")) && count == 4) {
+                // Object name, then the local file it comes from or goes to
+                strcpy(p.message, tokens[2]);
+                int err = !strcmp(tokens[1], "fput") ? send_upload(w, &p, tokens[3]) : send_request(w, &p, NULL, tokens[3]);
+                if (err != 0) {
+                    break;
+                }
+                printf("Transmitted (src= client:%d) %s: %s %s %s (seq= %u)\n", id, p.type, p.message,
+                    !strcmp(tokens[1], "fput") ? "from" : "to", tokens[3], p.seq);
             }
             else if (strcmp(tokens[1], "gtime") == 0) {
-                write(write_fifo, &p, sizeof(p));
-                printf("Transmitted (src= client:%d) %s\n", id, p.type);
-                if (recv_packet(read_fifo) != 0) {
+                if (send_request(w, &p, NULL, NULL) != 0) {
                     break;
                 }
+                printf("Transmitted (src= client:%d) %s (seq= %u)\n", id, p.type, p.seq);
             }
-            else if (strcmp(tokens[1], "delay") == 0) {
+            else if (!strcmp(tokens[1], "mput") || !strcmp(tokens[1], "mget") || !strcmp(tokens[1], "mdelete")) {
+                // Every name on the line in one request
+                char body[MAXTOKEN * (MAXWORD + 1)];
+                size_t len = 0;
+                for (int i = 2; i < count; i++) {
+                    if (strlen(tokens[i]) <= MAXWORD) {
+                        len = batch_add(body, len, tokens[i]);
+                        p.num++;
+                    }
+                    else {
+                        fprintf(stderr, "Object name longer than %d characters: %s\n", MAXWORD, tokens[i]);
+                    }
+                }
+                if (p.num == 0) {
+                    // The server takes an empty batch for a malformed one
+                    fprintf(stderr, "No object names to send in %s\n", p.type);
+                    continue;
+                }
+                p.body = len;
+                if (send_request(w, &p, body, NULL) != 0) {
+                    break;
+                }
+                printf("Transmitted (src= client:%d) %s: %.0f objects (seq= %u)\n", id, p.type, p.num, p.seq);
+            }
+            else if (strcmp(tokens[1], "delay") == 0 && count >= 3) {
+                if (drain_window(w) != 0) {
+                    break;
+                }
                 printf("Entering delay period of %s msec\n", tokens[2]);
                 usleep(atof(tokens[2]) * 1000);
                 printf("Exiting delay period\n\n");    
@@ -132,9 +219,190 @@ int main (int argc, char *argv[]) {
             }
         }
     }
-    close(write_fifo);
-    close(read_fifo);
+    drain_window(w);
+    close(sock);
     fclose(fp);
+    free(w->out);
+    free(w);
     printf("Quit\n");
     return 0;
+}
+
+/*
+    Numbers a request and holds it to be sent, first waiting for a reply
+    if the window is full. An FGET's file is where its content will go.
+    Returns 1 once the server is gone.
+*/
+int send_request(struct Window *w, struct Packet *p, const char *body, const char *file) {
+    if (w->in_flight == w->size && wait_reply(w) != 0) {
+        return 1;
+    }
+    p->seq = w->next_seq++;
+    if (w->next_seq == 0) {
+        w->next_seq = 1;
+    }
+    int slot = 0;
+    while (w->sent[slot].seq != 0) {
+        slot++;
+    }
+    w->sent[slot] = *p;
+    w->file[slot] = file != NULL ? strdup(file) : NULL;
+    size_t len = sizeof(*p) + p->body;
+    if (w->out_len + len > w->out_cap) {
+        w->out_cap = (w->out_len + len) * 2;
+        w->out = realloc(w->out, w->out_cap);
+    }
+    // The server takes a batch's num as nothing; sent keeps the object count
+    struct Packet wire = *p;
+    if (is_batch(p->type)) {
+        wire.num = 0.0;
+    }
+    memcpy(w->out + w->out_len, &wire, sizeof(wire));
+    memcpy(w->out + w->out_len + sizeof(wire), body, p->body);
+    w->out_len += len;
+    w->in_flight++;
+    return 0;
+}
+
+/*
+    Sends an FPUT of the local file at path: the packet, with the file's
+    size in num, then its content. Returns 1 once the server is gone; a
+    file that can't be read is reported and skipped.
+*/
+int send_upload(struct Window *w, struct Packet *p, const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error opening %s\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+    p->num = st.st_size;
+    // The content has to follow its packet at once
+    int err = send_request(w, p, NULL, NULL) != 0 || flush_requests(w) != 0;
+    if (!err && send_file(w->fd, fd, st.st_size) != 0) {
+        fprintf(stderr, "Error sending %s\n", path);
+        err = 1;
+    }
+    close(fd);
+    return err;
+}
+
+// Write the held requests; returns 1 once the server is gone
+int flush_requests(struct Window *w) {
+    if (w->out_len > 0) {
+        if (write_full(w->fd, w->out, w->out_len) != 0) {
+            fprintf(stderr, "Error writing to server\n");
+            return 1;
+        }
+        w->out_len = 0;
+    }
+    return 0;
+}
+
+/*
+    Saves size bytes of an FGET's content from the socket to the file at
+    path. If the file can't be made the content is read and dropped, to
+    keep the connection in step. Returns 1 once the server is gone.
+*/
+int recv_download(struct Window *w, const char *path, off_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening %s\n", path);
+        char scratch[4096];
+        while (size > 0) {
+            size_t n = size < (off_t) sizeof(scratch) ? (size_t) size : sizeof(scratch);
+            if (read_full(w->fd, scratch, n) != 0) {
+                return 1;
+            }
+            size -= n;
+        }
+        return 0;
+    }
+    int err = recv_file(w->fd, fd, size, w->pipe_fds);
+    close(fd);
+    return err;
+}
+
+/*
+    Sends the held requests and waits for the next reply, which answers
+    any request in flight. Returns 1 once the server is gone or quit.
+*/
+int wait_reply(struct Window *w) {
+    if (flush_requests(w) != 0) {
+        return 1;
+    }
+
+    struct Packet pr;
+    unsigned char done[MAXBATCH / 8];
+    if (recv_packet(w->fd, &pr) != 0) {
+        return 1;
+    }
+    if (pr.body > sizeof(done) || read_full(w->fd, done, pr.body) != 0) {
+        printf("Server closed the connection\n\n");
+        return 1;
+    }
+    if (strcmp(pr.type, "CQUIT") == 0) {
+        printf("Received (src= server) %s\n\n", pr.type);
+        return 1;
+    }
+    int slot = 0;
+    while (slot < w->size && w->sent[slot].seq != pr.seq) {
+        slot++;
+    }
+    if (pr.seq == 0 || slot == w->size) {
+        fprintf(stderr, "Reply to unknown request %u\n", pr.seq);
+        return 0;
+    }
+    w->sent[slot].seq = 0;
+    w->in_flight--;
+    int objects = w->sent[slot].num;
+    char *file = w->file[slot];
+    w->file[slot] = NULL;
+
+    if (strcmp(pr.type, "ERROR") == 0) {
+        printf("Received (src= server)  %s: %s (seq= %u)\n\n", pr.type, pr.message, pr.seq);
+    }
+    else if (strcmp(pr.type, "TIME") == 0) {
+        printf("Received (src= server) %s: %.2f s (seq= %u)\n\n", pr.type, pr.num, pr.seq);
+    }
+    else if (strcmp(pr.type, "FILE") == 0) {
+        int err = recv_download(w, file, (off_t) pr.num);
+        if (err == 0) {
+            printf("Received (src= server) %s: %.0f bytes to %s (seq= %u)\n\n", pr.type, pr.num, file, pr.seq);
+        }
+        free(file);
+        if (err != 0) {
+            printf("Server closed the connection\n\n");
+            return 1;
+        }
+        return 0;
+    }
+    else if (strcmp(pr.type, "STATUS") == 0) {
+        // One mark per object, in the order they were sent
+        char marks[MAXTOKEN + 1];
+        int i;
+        for (i = 0; i < objects && i < MAXTOKEN && (size_t) i / 8 < pr.body; i++) {
+            marks[i] = done[i / 8] & (1 << (i % 8)) ? '1' : '0';
+        }
+        marks[i] = '\0';
+        printf("Received (src= server) %s: %.0f of %d done [%s] (seq= %u)\n\n", pr.type, pr.num, objects, marks, pr.seq);
+    }
+    else {
+        printf("Received (src= server) %s (seq= %u)\n\n", pr.type, pr.seq);
+    }
+    free(file);
+    return 0;
+}
+
+// Wait for every request in flight to be answered; returns 1 once the server is gone
+int drain_window(struct Window *w) {
+    while (w->in_flight > 0) {
+        if (wait_reply(w) != 0) {
+            return 1;
+        }
+    }
+    return 0;
 }
\ No newline at end of file
@@ -1,10 +1,17 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE         // splice
+#endif
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include <ctype.h>
@@ -12,30 +19,142 @@
 #include <stdlib.h>
 
 #define MAXWORD 32		// Max characters in an object name
-#define NCLIENT 3       // Number of clients 
 #define POLLTIMEOUT 10000	// Max time (ms) to wait for reply
+#define SOCKET_PATH "fts.sock"	// Default Unix domain socket of the server
+#define MAXBATCH 4096		// Max object names in one MPUT, MGET or MDEL
+#define MAXBODY (MAXBATCH * (MAXWORD + 1))	// Max bytes of a batch body
+#define CHUNK_SIZE (1 << 20)	// Max bytes of a file moved per system call
+#define MAXFILE ((double) (1LL << 53))	// Max bytes of an FPUT file; exact in a double, fits off_t
 
 
-// Packet structure for FIFO communication
+// Packet structure for socket communication. A batch (MPUT, MGET or
+// MDEL) is a packet followed by a body of body bytes: each object name
+// as one length byte then its characters. Its STATUS reply has num set to
+// the items that succeeded and a body of one bit per item, item i in bit
+// i % 8 of byte i / 8. FPUT, and the FILE reply to FGET, are followed by
+// num bytes of file content instead.
 struct Packet {
     int id;
-    char type[7];            // PUT, GET, DELETE, GTIME, TIME, OK, ERROR
+    char type[7];            // PUT, GET, DELETE, GTIME, MPUT, MGET, MDEL, FPUT, FGET, TIME, OK, ERROR, STATUS, FILE
     char message[MAXWORD+1]; // Object name
     double num;
+    unsigned int seq;        // Request number, echoed in its reply; 0 in CQUIT
+    unsigned int body;       // Bytes following the packet, 0 unless a batch or STATUS
 };
 
-int send_packet(char fifo_name[9], struct Packet * p) {
-    int fd = open(fifo_name, O_WRONLY);
+// Is type one of the batch requests
+int is_batch(const char *type) {
+    return !strcmp(type, "MPUT") || !strcmp(type, "MGET") || !strcmp(type, "MDEL");
+}
+
+// Append an object name to a batch body of len bytes, returns the new length
+size_t batch_add(char *body, size_t len, const char *name) {
+    size_t name_len = strlen(name);
+    body[len] = name_len;
+    memcpy(body + len + 1, name, name_len);
+    return len + 1 + name_len;
+}
+
+// Write all len bytes to a blocking fd, returns 0 on success
+int write_full(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Read exactly len bytes from a blocking fd, returns 0 on success and 1 on EOF or error
+int read_full(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Send size bytes of file fd to a blocking socket without copying them through user space, returns 0 on success
+int send_file(int sock, int fd, off_t size) {
+    while (size > 0) {
+        ssize_t n = sendfile(sock, fd, NULL, size < CHUNK_SIZE ? size : CHUNK_SIZE);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        size -= n;
+    }
+    return 0;
+}
+
+// Move size bytes from a blocking socket into file fd through pipe_fds, without copying them through user space
+int recv_file(int sock, int fd, off_t size, int pipe_fds[2]) {
+    while (size > 0) {
+        ssize_t n = splice(sock, NULL, pipe_fds[1], NULL, size < CHUNK_SIZE ? size : CHUNK_SIZE, SPLICE_F_MOVE);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        size -= n;
+        while (n > 0) {
+            ssize_t m = splice(pipe_fds[0], NULL, fd, NULL, n, SPLICE_F_MOVE);
+            if (m < 0 && errno == EINTR) {
+                continue;
+            }
+            if (m <= 0) {
+                return 1;
+            }
+            n -= m;
+        }
+    }
+    return 0;
+}
+
+// Connect to the server's Unix domain socket, returns the socket or -1
+int connect_server(const char *path) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
     if (fd < 0) {
-        fprintf(stderr, "Error opening write FIFO %s\n", fifo_name);
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int send_packet(int fd, struct Packet * p) {
+    if (write_full(fd, p, sizeof(*p)) != 0) {
+        fprintf(stderr, "Error writing to server\n");
         return 1;
     }
-    write(fd, p, sizeof(*p));
-    close(fd);
     return 0;
 }
 
-int recv_packet(int fd) {
+// Wait for the next packet from the server, returns 0 on success and 1 once the server is gone
+int recv_packet(int fd, struct Packet *pr) {
 	// is blocking
     struct pollfd fdarray[1];
     fdarray[0].fd = fd;
@@ -43,29 +162,15 @@ int recv_packet(int fd) {
 
     while(1) {
         poll(fdarray, 1, POLLTIMEOUT);
-        if (fdarray[0].revents & POLLIN) {
-            struct Packet pr;
-            read(fd, (char *) &pr, sizeof(pr));
-            
-            if (strcmp(pr.type, "ERROR") == 0) {
-                printf("Received (src= server)  %s: %s\n\n", pr.type, pr.message);
-            }
-            else if (strcmp(pr.type, "CQUIT") == 0) {
-                printf("Received (src= server) %s\n\n", pr.type);
-                close(fd);
+        if (fdarray[0].revents & (POLLIN | POLLHUP)) {
+            if (read_full(fd, (char *) pr, sizeof(*pr)) != 0) {
+                printf("Server closed the connection\n\n");
                 return 1;
             }
-            else if (strcmp(pr.type, "TIME") == 0) {
-                printf("Received (src= server) %s: %.2f s\n\n", pr.type, pr.num);
-            }
-            else {
-                printf("Received (src= server) %s\n\n", pr.type);
-            }
-            break;
+            return 0;
         }
     }
-    return 0;
 }
 
 
-#endif
\ No newline at end of file
+#endif
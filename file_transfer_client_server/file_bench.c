@@ -0,0 +1,726 @@
+/*
+    Description: Load generator and benchmarks for the server.
+    Usage: ./file_bench clients num_clients requests_per_client [socket_path] [load_threads]
+            Connects num_clients clients at once, each sending its
+            requests (PUT, then GET of the same object) one at a time,
+            and reports request latency percentiles and throughput.
+           ./file_bench pipeline num_requests [socket_path]
+            One client sends num_requests requests with 1 (stop-and-wait)
+            up to 256 of them in flight, and reports the throughput of each.
+           ./file_bench batch num_objects [socket_path]
+            Puts, gets and deletes num_objects objects one request at a
+            time and in MPUT/MGET/MDEL batches, and reports objects/s and
+            read/write system calls per object on both sides.
+           ./file_bench files size_mb [socket_path]
+            Uploads (FPUT) and downloads (FGET) a size_mb MB file with
+            sendfile and splice and with read/write copies, and reports
+            MB/s and how far the server's memory grew.
+           ./file_bench table num_objects
+            Times PUT, GET and DELETE of num_objects objects on the hash
+            indexed object table and on the linear table it replaced.
+           ./file_bench load num_objects [socket_path]
+            Puts num_objects objects in MPUT batches, each answered only
+            once the server's log has it, and reports objects/s.
+           ./file_bench verify num_objects [socket_path]
+            Checks with MGET that the objects of a load are all there,
+            as after the server is killed and restarted.
+*/
+
+#define _GNU_SOURCE
+#include "common.h"
+#include "objects.h"
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define MAXEVENTS 256
+#define LOAD_ID 9           // client id of load and verify
+
+// A benchmark client with one request in flight
+struct BenchClient {
+    int fd;
+    int id;
+    int sent;               // requests sent so far
+    size_t in_len;
+    char in[sizeof(struct Packet)];
+    struct timespec sent_at;
+};
+
+// The object table the server used before objects.c: names scanned
+// in order with strcmp, deletes leaving holes that are never reused
+struct LinearTable {
+    int index;
+    char (*files)[MAXWORD];
+    int *owners;
+};
+
+int bench_clients(int num_clients, int requests, const char *path, int num_threads);
+int bench_pipeline(int requests, const char *path);
+int bench_batch(int num_objects, const char *path);
+int bench_files(long size_mb, const char *path);
+int bench_table(int num_objects);
+int bench_load(int num_objects, const char *path, int verify);
+
+
+int main (int argc, char *argv[]) {
+    if (argc >= 4 && strcmp(argv[1], "clients") == 0) {
+        return bench_clients(atoi(argv[2]), atoi(argv[3]), argc > 4 ? argv[4] : SOCKET_PATH, argc > 5 ? atoi(argv[5]) : 1);
+    }
+    if (argc >= 3 && strcmp(argv[1], "pipeline") == 0) {
+        return bench_pipeline(atoi(argv[2]), argc > 3 ? argv[3] : SOCKET_PATH);
+    }
+    if (argc >= 3 && strcmp(argv[1], "batch") == 0) {
+        return bench_batch(atoi(argv[2]), argc > 3 ? argv[3] : SOCKET_PATH);
+    }
+    if (argc >= 3 && strcmp(argv[1], "files") == 0) {
+        return bench_files(atol(argv[2]), argc > 3 ? argv[3] : SOCKET_PATH);
+    }
+    if (argc >= 3 && strcmp(argv[1], "table") == 0) {
+        return bench_table(atoi(argv[2]));
+    }
+    if (argc >= 3 && (strcmp(argv[1], "load") == 0 || strcmp(argv[1], "verify") == 0)) {
+        return bench_load(atoi(argv[2]), argc > 3 ? argv[3] : SOCKET_PATH, argv[1][0] == 'v');
+    }
+    fprintf(stderr, "Usage: %s clients num_clients requests_per_client [socket_path] [load_threads]\n", argv[0]);
+    fprintf(stderr, "       %s pipeline num_requests [socket_path]\n", argv[0]);
+    fprintf(stderr, "       %s batch num_objects [socket_path]\n", argv[0]);
+    fprintf(stderr, "       %s files size_mb [socket_path]\n", argv[0]);
+    fprintf(stderr, "       %s table num_objects\n", argv[0]);
+    fprintf(stderr, "       %s load|verify num_objects [socket_path]\n", argv[0]);
+    return 1;
+}
+
+double elapsed_ms(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Print throughput and latency percentiles of count requests taken in total_ms
+void print_latencies(double *latencies, long count, double total_ms) {
+    qsort(latencies, count, sizeof(double), compare_doubles);
+    printf("Throughput= %.0f requests/s\n", count / (total_ms / 1000));
+    printf("Latency= p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+        latencies[count / 2], latencies[count * 9 / 10], latencies[count * 99 / 100], latencies[count - 1]);
+}
+
+// Send client c's next request: even requests PUT an object, odd ones GET it back
+void send_next(struct BenchClient *c) {
+    struct Packet p = {c->id, "", "", 0.0};
+    strcpy(p.type, c->sent % 2 == 0 ? "PUT" : "GET");
+    snprintf(p.message, sizeof(p.message), "c%d-%d", c->id, c->sent / 2);
+    clock_gettime(CLOCK_MONOTONIC, &c->sent_at);
+    write_full(c->fd, &p, sizeof(p));
+    c->sent++;
+}
+
+// Clients run by one load thread
+struct ClientRange {
+    struct BenchClient *clients;
+    int count;
+    int requests;
+    double *latencies;      // requests slots per client, in client order
+    int failed;
+};
+
+/*
+    Runs a range of clients over one epoll loop. Each has one request
+    outstanding at a time, so latency is the server's round trip.
+*/
+void *run_clients(void *arg) {
+    struct ClientRange *r = arg;
+    long total = (long) r->count * r->requests, done = 0;
+    int epfd = epoll_create1(0);
+    for (int i = 0; i < r->count; i++) {
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN;
+        ev.data.ptr = &r->clients[i];
+        epoll_ctl(epfd, EPOLL_CTL_ADD, r->clients[i].fd, &ev);
+        if (r->requests > 0) {
+            send_next(&r->clients[i]);
+        }
+    }
+    struct epoll_event events[MAXEVENTS];
+    while (done < total) {
+        int n = epoll_wait(epfd, events, MAXEVENTS, POLLTIMEOUT);
+        if (n == 0) {
+            fprintf(stderr, "Server stopped replying\n");
+            r->failed = 1;
+            break;
+        }
+        for (int e = 0; e < n; e++) {
+            struct BenchClient *c = events[e].data.ptr;
+            ssize_t got = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+            if (got <= 0) {
+                fprintf(stderr, "Server closed client %d\n", c->id);
+                r->failed = 1;
+                done = total;
+                break;
+            }
+            c->in_len += got;
+            if (c->in_len < sizeof(c->in)) {
+                continue;
+            }
+            c->in_len = 0;
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            r->latencies[(c - r->clients) * r->requests + c->sent - 1] = elapsed_ms(&c->sent_at, &now);
+            done++;
+            if (c->sent < r->requests) {
+                send_next(c);
+            }
+        }
+    }
+    close(epfd);
+    return NULL;
+}
+
+/*
+    Connects num_clients clients and runs them, split over num_threads
+    load threads so the load generator itself can use several cores.
+*/
+int bench_clients(int num_clients, int requests, const char *path, int num_threads) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (num_threads < 1 || num_threads > num_clients) {
+        num_threads = 1;
+    }
+
+    struct BenchClient *clients = calloc(num_clients, sizeof(*clients));
+    long total = (long) num_clients * requests;
+    double *latencies = malloc(total * sizeof(double));
+    for (int i = 0; i < num_clients; i++) {
+        clients[i].fd = connect_server(path);
+        if (clients[i].fd < 0) {
+            fprintf(stderr, "Error connecting client %d to %s\n", i + 1, path);
+            return 1;
+        }
+        clients[i].id = i + 1;
+    }
+    printf("Clients: %d clients x %d requests on %s (%d load threads)\n", num_clients, requests, path, num_threads);
+
+    struct ClientRange *ranges = calloc(num_threads, sizeof(*ranges));
+    pthread_t *tids = malloc(num_threads * sizeof(pthread_t));
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int t = 0; t < num_threads; t++) {
+        int first = (long) num_clients * t / num_threads;
+        int last = (long) num_clients * (t + 1) / num_threads;
+        ranges[t] = (struct ClientRange) {&clients[first], last - first, requests, &latencies[(long) first * requests], 0};
+        pthread_create(&tids[t], NULL, run_clients, &ranges[t]);
+    }
+    int failed = 0;
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(tids[t], NULL);
+        failed |= ranges[t].failed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (failed) {
+        return 1;
+    }
+    print_latencies(latencies, total, elapsed_ms(&start, &end));
+
+    for (int i = 0; i < num_clients; i++) {
+        struct Packet p_close = {clients[i].id, "QUIT", "", 0.0};
+        write_full(clients[i].fd, &p_close, sizeof(p_close));
+        close(clients[i].fd);
+    }
+    free(ranges);
+    free(tids);
+    free(latencies);
+    free(clients);
+    return 0;
+}
+
+/*
+    Sends requests requests from one client keeping up to window of them
+    in flight, the way ./client -w does: requests are written in batches
+    when the window fills and replies matched by seq. Returns the time
+    taken in ms, or -1 on error.
+*/
+double run_pipeline(int fd, int id, int requests, int window) {
+    struct Packet *out = malloc(window * sizeof(struct Packet));
+    struct Packet *in = malloc(window * sizeof(struct Packet));
+    char *answered = calloc(requests + 1, 1);
+    int sent = 0, done = 0, out_len = 0;
+    size_t in_len = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (done < requests) {
+        // Fill the window, then send it all at once
+        while (sent < requests && sent - done < window) {
+            struct Packet *p = &out[out_len++];
+            memset(p, 0, sizeof(*p));
+            p->id = id;
+            strcpy(p->type, sent % 2 == 0 ? "PUT" : "GET");
+            snprintf(p->message, sizeof(p->message), "p%d-%d", id, sent / 2);
+            p->seq = ++sent;
+        }
+        if (out_len > 0) {
+            if (write_full(fd, out, out_len * sizeof(struct Packet)) != 0) {
+                return -1;
+            }
+            out_len = 0;
+        }
+        // Take every reply that has arrived, at least one
+        ssize_t n = read(fd, (char *) in + in_len, window * sizeof(struct Packet) - in_len);
+        if (n <= 0) {
+            return -1;
+        }
+        in_len += n;
+        size_t count = in_len / sizeof(struct Packet);
+        for (size_t i = 0; i < count; i++) {
+            if (in[i].seq == 0 || in[i].seq > (unsigned) requests || answered[in[i].seq]) {
+                fprintf(stderr, "Reply to unknown request %u\n", in[i].seq);
+                return -1;
+            }
+            answered[in[i].seq] = 1;
+            done++;
+        }
+        in_len -= count * sizeof(struct Packet);
+        memmove(in, (char *) in + count * sizeof(struct Packet), in_len);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(out);
+    free(in);
+    free(answered);
+    return elapsed_ms(&start, &end);
+}
+
+// Throughput of one client as its window grows from stop-and-wait
+int bench_pipeline(int requests, const char *path) {
+    int windows[] = {1, 4, 16, 64, 256};
+    int num_windows = sizeof(windows) / sizeof(windows[0]);
+    printf("Pipeline: 1 client x %d requests on %s\n", requests, path);
+    double base = 0;
+    for (int i = 0; i < num_windows; i++) {
+        // A fresh client id each time, so its PUTs don't collide
+        int fd = connect_server(path);
+        if (fd < 0) {
+            fprintf(stderr, "Error connecting to %s\n", path);
+            return 1;
+        }
+        double ms = run_pipeline(fd, i + 1, requests, windows[i]);
+        struct Packet p_close = {i + 1, "QUIT", "", 0.0};
+        write_full(fd, &p_close, sizeof(p_close));
+        close(fd);
+        if (ms < 0) {
+            fprintf(stderr, "Server stopped replying\n");
+            return 1;
+        }
+        double rate = requests / (ms / 1000);
+        if (i == 0) {
+            base = rate;
+        }
+        printf("\twindow %d:\t%.0f requests/s (%.1fx)\n", windows[i], rate, rate / base);
+    }
+    return 0;
+}
+
+// Read and write system calls made so far by process pid, or -1 if /proc won't say
+long io_syscalls(pid_t pid) {
+    char path[64], line[128];
+    snprintf(path, sizeof(path), "/proc/%d/io", (int) pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    long total = 0, n;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "syscr: %ld", &n) == 1 || sscanf(line, "syscw: %ld", &n) == 1) {
+            total += n;
+        }
+    }
+    fclose(f);
+    return total;
+}
+
+// Send type for each of num_objects objects and wait for each reply; returns the failures
+int run_singles(int fd, int id, const char *type, int num_objects) {
+    int failed = 0;
+    for (int i = 0; i < num_objects; i++) {
+        struct Packet p = {id, "", "", 0.0, i + 1};
+        strcpy(p.type, type);
+        snprintf(p.message, sizeof(p.message), "b%d-%d", id, i);
+        struct Packet pr;
+        if (write_full(fd, &p, sizeof(p)) != 0 || read_full(fd, &pr, sizeof(pr)) != 0) {
+            return num_objects;
+        }
+        failed += strcmp(pr.type, "OK") != 0;
+    }
+    return failed;
+}
+
+// Send type for num_objects objects in batches of batch names; returns the failures
+int run_batches(int fd, int id, const char *type, int num_objects, int batch) {
+    char *msg = malloc(sizeof(struct Packet) + MAXBODY);
+    unsigned char done[MAXBATCH / 8];
+    int failed = 0;
+    for (int first = 0; first < num_objects; first += batch) {
+        int count = num_objects - first < batch ? num_objects - first : batch;
+        char *body = msg + sizeof(struct Packet);
+        size_t len = 0;
+        for (int i = first; i < first + count; i++) {
+            char name[MAXWORD + 1];
+            snprintf(name, sizeof(name), "b%d-%d", id, i);
+            len = batch_add(body, len, name);
+        }
+        struct Packet p = {id, "", "", 0.0, first + 1, len};
+        strcpy(p.type, type);
+        memcpy(msg, &p, sizeof(p));
+
+        struct Packet pr;
+        if (write_full(fd, msg, sizeof(p) + len) != 0 || read_full(fd, &pr, sizeof(pr)) != 0
+                || pr.body > sizeof(done) || read_full(fd, done, pr.body) != 0) {
+            free(msg);
+            return num_objects;
+        }
+        if (strcmp(pr.type, "STATUS") != 0) {
+            failed += count;
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            failed += (done[i / 8] & (1 << (i % 8))) == 0;
+        }
+    }
+    free(msg);
+    return failed;
+}
+
+/*
+    Bulk load, read back and delete num_objects objects, first one request
+    per object, then in batches of MAXBATCH. System calls are the read and
+    write calls in /proc/<pid>/io of this process and of the server, found
+    from the socket's peer credentials.
+*/
+int bench_batch(int num_objects, const char *path) {
+    const char *singles[] = {"PUT", "GET", "DELETE"};
+    const char *batches[] = {"MPUT", "MGET", "MDEL"};
+    printf("Batch: %d objects on %s\n", num_objects, path);
+    for (int mode = 0; mode < 2; mode++) {
+        int fd = connect_server(path);
+        if (fd < 0) {
+            fprintf(stderr, "Error connecting to %s\n", path);
+            return 1;
+        }
+        struct ucred peer;
+        socklen_t peer_len = sizeof(peer);
+        pid_t server = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) == 0 ? peer.pid : -1;
+
+        for (int op = 0; op < 3; op++) {
+            long client_calls = io_syscalls(getpid()), server_calls = io_syscalls(server);
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            int failed = mode == 0 ? run_singles(fd, mode + 1, singles[op], num_objects)
+                : run_batches(fd, mode + 1, batches[op], num_objects, MAXBATCH);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            client_calls = io_syscalls(getpid()) - client_calls;
+            server_calls = server_calls < 0 ? -1 : io_syscalls(server) - server_calls;
+            if (failed != 0) {
+                fprintf(stderr, "%d of %d objects failed\n", failed, num_objects);
+                return 1;
+            }
+
+            printf("\t%s:\t%.0f objects/s, syscalls/object client %.4f",
+                mode == 0 ? singles[op] : batches[op],
+                num_objects / (elapsed_ms(&start, &end) / 1000), (double) client_calls / num_objects);
+            if (server_calls >= 0) {
+                printf(", server %.4f", (double) server_calls / num_objects);
+            }
+            printf("\n");
+        }
+        struct Packet p_close = {mode + 1, "QUIT", "", 0.0};
+        write_full(fd, &p_close, sizeof(p_close));
+        close(fd);
+    }
+    return 0;
+}
+
+/*
+    Puts num_objects objects as client LOAD_ID in batches of MAXBATCH,
+    or with verify gets them and counts the ones missing.
+*/
+int bench_load(int num_objects, const char *path, int verify) {
+    int fd = connect_server(path);
+    if (fd < 0) {
+        fprintf(stderr, "Error connecting to %s\n", path);
+        return 1;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int failed = run_batches(fd, LOAD_ID, verify ? "MGET" : "MPUT", num_objects, MAXBATCH);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    struct Packet p_close = {LOAD_ID, "QUIT", "", 0.0};
+    write_full(fd, &p_close, sizeof(p_close));
+    close(fd);
+    if (verify) {
+        printf("Verify: %d of %d objects missing\n", failed, num_objects);
+    } else {
+        printf("Load: %d objects at %.0f objects/s, %d failed\n", num_objects,
+            num_objects / (elapsed_ms(&start, &end) / 1000), failed);
+    }
+    return failed != 0;
+}
+
+// Peak resident memory of process pid in kB, or -1 if /proc won't say
+long peak_rss_kb(pid_t pid) {
+    char path[64], line[128];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int) pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    long kb = -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "VmHWM: %ld", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+// Copy size bytes from in to out through a user-space buffer, the way it is done without sendfile and splice
+int copy_through(int in, int out, off_t size) {
+    static char buffer[CHUNK_SIZE];
+    while (size > 0) {
+        size_t n = size < CHUNK_SIZE ? (size_t) size : CHUNK_SIZE;
+        if (read_full(in, buffer, n) != 0 || write_full(out, buffer, n) != 0) {
+            return 1;
+        }
+        size -= n;
+    }
+    return 0;
+}
+
+// Are the first size bytes of files a and b the same
+int same_content(const char *a, const char *b, off_t size) {
+    static char x[CHUNK_SIZE], y[CHUNK_SIZE];
+    int fa = open(a, O_RDONLY), fb = open(b, O_RDONLY), same = fa >= 0 && fb >= 0;
+    while (same && size > 0) {
+        size_t n = size < CHUNK_SIZE ? (size_t) size : CHUNK_SIZE;
+        same = read_full(fa, x, n) == 0 && read_full(fb, y, n) == 0 && memcmp(x, y, n) == 0;
+        size -= n;
+    }
+    close(fa);
+    close(fb);
+    return same;
+}
+
+/*
+    One round trip of a file: FPUT of the local file src as object name,
+    then FGET of it into dst, each timed in *put_ms and *get_ms. With
+    zero_copy the content moves with sendfile and splice, otherwise
+    through a buffer. Returns 1 on error.
+*/
+int transfer_file(int fd, int id, const char *name, const char *src, const char *dst, off_t size,
+        int zero_copy, int pipe_fds[2], double *put_ms, double *get_ms) {
+    struct timespec start, end;
+    struct Packet p = {id, "FPUT", "", (double) size, 1};
+    snprintf(p.message, sizeof(p.message), "%s", name);
+    int in = open(src, O_RDONLY);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int err = write_full(fd, &p, sizeof(p));
+    err = err || (zero_copy ? send_file(fd, in, size) : copy_through(in, fd, size));
+    struct Packet pr;
+    err = err || read_full(fd, &pr, sizeof(pr)) || strcmp(pr.type, "OK") != 0;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    close(in);
+    *put_ms = elapsed_ms(&start, &end);
+    if (err) {
+        return 1;
+    }
+
+    strcpy(p.type, "FGET");
+    p.num = 0;
+    p.seq = 2;
+    int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    err = write_full(fd, &p, sizeof(p)) || read_full(fd, &pr, sizeof(pr))
+        || strcmp(pr.type, "FILE") != 0 || (off_t) pr.num != size;
+    err = err || (zero_copy ? recv_file(fd, out, size, pipe_fds) : copy_through(fd, out, size));
+    // Time it to disk's page cache, like the upload
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    close(out);
+    *get_ms = elapsed_ms(&start, &end);
+    return err;
+}
+
+/*
+    Uploads and downloads a size_mb MB file, zero-copy and through
+    buffers, checking the content that comes back. The server's peak
+    memory, before and after, shows it streams instead of buffering.
+*/
+int bench_files(long size_mb, const char *path) {
+    off_t size = (off_t) size_mb << 20;
+    char src[] = "/tmp/fts-bench-src-XXXXXX";
+    char dst[] = "/tmp/fts-bench-dst-XXXXXX";
+    int in = mkstemp(src), out = mkstemp(dst);
+    close(out);
+    static char block[CHUNK_SIZE];
+    for (off_t left = size; left > 0; left -= CHUNK_SIZE) {
+        for (size_t i = 0; i < CHUNK_SIZE; i += sizeof(long)) {
+            *(long *) (block + i) = (long) (size - left + i) * 2654435761L;
+        }
+        write_full(in, block, left < CHUNK_SIZE ? (size_t) left : CHUNK_SIZE);
+    }
+    close(in);
+
+    int fd = connect_server(path);
+    if (fd < 0) {
+        fprintf(stderr, "Error connecting to %s\n", path);
+        unlink(src);
+        unlink(dst);
+        return 1;
+    }
+    struct ucred peer;
+    socklen_t peer_len = sizeof(peer);
+    pid_t server = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) == 0 ? peer.pid : -1;
+    long rss_before = peak_rss_kb(server);
+    int pipe_fds[2];
+    pipe(pipe_fds);
+    fcntl(pipe_fds[0], F_SETPIPE_SZ, CHUNK_SIZE);
+
+    printf("Files: %ld MB on %s\n", size_mb, path);
+    int failed = 0;
+    for (int zero_copy = 1; zero_copy >= 0 && !failed; zero_copy--) {
+        char name[MAXWORD];
+        snprintf(name, sizeof(name), "file-%d-%d", (int) getpid(), zero_copy);
+        double put_ms, get_ms;
+        failed = transfer_file(fd, 1, name, src, dst, size, zero_copy, pipe_fds, &put_ms, &get_ms);
+        if (failed || !same_content(src, dst, size)) {
+            fprintf(stderr, "The file did not come back the same\n");
+            failed = 1;
+            break;
+        }
+        printf("\t%s:\tFPUT %.0f MB/s, FGET %.0f MB/s\n", zero_copy ? "sendfile/splice" : "read/write",
+            size_mb / (put_ms / 1000), size_mb / (get_ms / 1000));
+        struct Packet p_del = {1, "DELETE", "", 0.0, 3};
+        snprintf(p_del.message, sizeof(p_del.message), "%s", name);
+        struct Packet pr;
+        write_full(fd, &p_del, sizeof(p_del));
+        read_full(fd, &pr, sizeof(pr));
+    }
+    long rss_after = peak_rss_kb(server);
+    if (rss_before >= 0 && rss_after >= 0) {
+        printf("\tserver peak memory: %ld kB before, %ld kB after\n", rss_before, rss_after);
+    }
+
+    struct Packet p_close = {1, "QUIT", "", 0.0};
+    write_full(fd, &p_close, sizeof(p_close));
+    close(fd);
+    unlink(src);
+    unlink(dst);
+    return failed;
+}
+
+int linear_put(struct LinearTable *fs, const char *name, int owner) {
+    for (int i = 0; i < fs->index; i++) {
+        if (strcmp(fs->files[i], name) == 0) {
+            return 1;
+        }
+    }
+    strcpy(fs->files[fs->index], name);
+    fs->owners[fs->index] = owner;
+    fs->index++;
+    return 0;
+}
+
+int linear_get(struct LinearTable *fs, const char *name) {
+    for (int i = 0; i < fs->index; i++) {
+        if (strcmp(fs->files[i], name) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int linear_del(struct LinearTable *fs, const char *name, int owner) {
+    for (int i = 0; i < fs->index; i++) {
+        if (strcmp(fs->files[i], name) == 0) {
+            if (fs->owners[i] != owner) {
+                return 1;
+            }
+            strcpy(fs->files[i], "");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Print ns per operation of count operations from start to now
+void print_rate(const char *table, const char *op, struct timespec *start, int count) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("\t%s %s:\t%.1f ns/op\n", table, op, elapsed_ms(start, &end) * 1e6 / count);
+}
+
+/*
+    PUTs num_objects objects, GETs each of them and DELETEs each of them,
+    on the hash indexed table and, up to 50000 objects where its scans
+    still finish, on the linear table.
+*/
+int bench_table(int num_objects) {
+    char (*names)[MAXWORD] = malloc((size_t) num_objects * MAXWORD);
+    for (int i = 0; i < num_objects; i++) {
+        snprintf(names[i], MAXWORD, "object-%d.dat", i);
+    }
+    printf("Object table: %d objects\n", num_objects);
+    struct timespec start;
+    int errors = 0;
+
+    struct ObjectTable t;
+    objects_init(&t);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < num_objects; i++) {
+        errors += objects_put(&t, names[i], 1 + i % 3) != OBJECT_OK;
+    }
+    print_rate("hash", "PUT", &start, num_objects);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < num_objects; i++) {
+        errors += objects_owner(&t, names[i]) == 0;
+    }
+    print_rate("hash", "GET", &start, num_objects);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < num_objects; i++) {
+        errors += objects_delete(&t, names[i], 1 + i % 3) != OBJECT_OK;
+    }
+    print_rate("hash", "DELETE", &start, num_objects);
+    errors += t.count != 0;
+    objects_free(&t);
+
+    if (num_objects <= 50000) {
+        struct LinearTable fs = {0, malloc((size_t) num_objects * MAXWORD), malloc(num_objects * sizeof(int))};
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < num_objects; i++) {
+            errors += linear_put(&fs, names[i], 1 + i % 3);
+        }
+        print_rate("linear", "PUT", &start, num_objects);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < num_objects; i++) {
+            errors += linear_get(&fs, names[i]);
+        }
+        print_rate("linear", "GET", &start, num_objects);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < num_objects; i++) {
+            errors += linear_del(&fs, names[i], 1 + i % 3);
+        }
+        print_rate("linear", "DELETE", &start, num_objects);
+        free(fs.files);
+        free(fs.owners);
+    }
+    free(names);
+    if (errors != 0) {
+        fprintf(stderr, "%d operations gave the wrong result\n", errors);
+        return 1;
+    }
+    return 0;
+}
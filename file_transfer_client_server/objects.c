@@ -0,0 +1,355 @@
+/*
+    Description: Hash-indexed object table of the server (see objects.h).
+*/
+
+#include "objects.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SLOT_DELETED UINT32_MAX
+#define MIN_CAPACITY 64
+
+// FNV-1a hash of a name
+static uint32_t hash_name(const char *name, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char) name[i]) * 16777619u;
+    }
+    return h;
+}
+
+void objects_init(struct ObjectTable *t) {
+    memset(t, 0, sizeof(*t));
+    t->capacity = MIN_CAPACITY;
+    t->slots = calloc(t->capacity, sizeof(struct Slot));
+}
+
+void objects_free(struct ObjectTable *t) {
+    free(t->slots);
+    free(t->objects);
+    free(t->arena);
+    memset(t, 0, sizeof(*t));
+}
+
+const char *objects_name(struct ObjectTable *t, struct Object *o) {
+    return t->arena + o->name_off;
+}
+
+/*
+    Finds the slot of name. Returns its index, or if name is not in the
+    table, -1 with *insert_at set to the slot an insert should use: the
+    first tombstone passed on the way, else the empty slot that ended the
+    probe.
+*/
+static long find_slot(struct ObjectTable *t, const char *name, size_t len, uint32_t hash, size_t *insert_at) {
+    size_t mask = t->capacity - 1;
+    long tombstone = -1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        struct Slot *s = &t->slots[i];
+        if (s->entry == 0) {
+            if (insert_at != NULL) {
+                *insert_at = tombstone >= 0 ? (size_t) tombstone : i;
+            }
+            return -1;
+        }
+        if (s->entry == SLOT_DELETED) {
+            if (tombstone < 0) {
+                tombstone = i;
+            }
+            continue;
+        }
+        struct Object *o = &t->objects[s->entry - 1];
+        if (s->hash == hash && o->name_len == len && memcmp(t->arena + o->name_off, name, len) == 0) {
+            return i;
+        }
+    }
+}
+
+/*
+    Rebuilds the table with capacity slots, dropping tombstones and dead
+    objects and packing the live names into a fresh arena, in order.
+*/
+static void rebuild(struct ObjectTable *t, size_t capacity) {
+    struct Slot *slots = calloc(capacity, sizeof(struct Slot));
+    size_t arena_cap = t->arena_len > 0 ? t->arena_len : 1;
+    char *arena = malloc(arena_cap);
+    size_t arena_len = 0, live = 0;
+    for (size_t k = 0; k < t->num_objects; k++) {
+        struct Object o = t->objects[k];
+        if (o.owner == 0) {
+            continue;
+        }
+        memcpy(arena + arena_len, t->arena + o.name_off, o.name_len + 1);
+        o.name_off = arena_len;
+        arena_len += o.name_len + 1;
+        t->objects[live] = o;
+
+        uint32_t hash = hash_name(arena + o.name_off, o.name_len);
+        size_t i = hash & (capacity - 1);
+        while (slots[i].entry != 0) {
+            i = (i + 1) & (capacity - 1);
+        }
+        slots[i].hash = hash;
+        slots[i].entry = ++live;
+    }
+    free(t->slots);
+    free(t->arena);
+    t->slots = slots;
+    t->capacity = capacity;
+    t->used = live;
+    t->num_objects = live;
+    t->count = live;
+    t->arena = arena;
+    t->arena_len = arena_len;
+    t->arena_cap = arena_cap;
+}
+
+/* Makes room for n more objects, so adding them never rebuilds the index */
+void objects_reserve(struct ObjectTable *t, size_t n) {
+    size_t capacity = t->capacity;
+    while ((t->used + n) * 2 > capacity) {
+        capacity *= 2;
+    }
+    if (capacity > t->capacity) {
+        rebuild(t, capacity);
+    }
+    if (t->num_objects + n > t->objects_cap) {
+        t->objects_cap = t->num_objects + n;
+        t->objects = realloc(t->objects, t->objects_cap * sizeof(struct Object));
+    }
+}
+
+/* Adds name, owned by owner (>= 1); OBJECT_EXISTS if it is already there */
+int objects_put(struct ObjectTable *t, const char *name, int owner) {
+    size_t len = strlen(name);
+    uint32_t hash = hash_name(name, len);
+    size_t at;
+    if (find_slot(t, name, len, hash, &at) >= 0) {
+        return OBJECT_EXISTS;
+    }
+
+    if (t->slots[at].entry == 0) {
+        // Taking an empty slot; keep the index under 3/4 full
+        if ((t->used + 1) * 4 > t->capacity * 3) {
+            size_t capacity = t->capacity;
+            while ((t->count + 1) * 2 > capacity) {
+                capacity *= 2;
+            }
+            rebuild(t, capacity);
+            find_slot(t, name, len, hash, &at);
+        }
+        t->used++;
+    }
+
+    if (t->num_objects == t->objects_cap) {
+        t->objects_cap = t->objects_cap ? t->objects_cap * 2 : MIN_CAPACITY;
+        t->objects = realloc(t->objects, t->objects_cap * sizeof(struct Object));
+    }
+    while (t->arena_len + len + 1 > t->arena_cap) {
+        t->arena_cap = t->arena_cap ? t->arena_cap * 2 : MIN_CAPACITY * 16;
+        t->arena = realloc(t->arena, t->arena_cap);
+    }
+    struct Object *o = &t->objects[t->num_objects++];
+    o->name_off = t->arena_len;
+    o->name_len = len;
+    o->has_data = 0;
+    o->owner = owner;
+    memcpy(t->arena + t->arena_len, name, len + 1);
+    t->arena_len += len + 1;
+
+    t->slots[at].hash = hash;
+    t->slots[at].entry = t->num_objects;
+    t->count++;
+    return OBJECT_OK;
+}
+
+/* Owner of name, or 0 if there is no such object */
+int objects_owner(struct ObjectTable *t, const char *name) {
+    size_t len = strlen(name);
+    long i = find_slot(t, name, len, hash_name(name, len), NULL);
+    return i < 0 ? 0 : t->objects[t->slots[i].entry - 1].owner;
+}
+
+/* Removes name if owner owns it, setting *had_data if it was put with data */
+static int delete_object(struct ObjectTable *t, const char *name, int owner, int *had_data) {
+    size_t len = strlen(name);
+    long i = find_slot(t, name, len, hash_name(name, len), NULL);
+    if (i < 0) {
+        return OBJECT_MISSING;
+    }
+    struct Object *o = &t->objects[t->slots[i].entry - 1];
+    if (o->owner != owner) {
+        return OBJECT_NOT_OWNER;
+    }
+    *had_data = o->has_data;
+    o->owner = 0;
+    t->slots[i].entry = SLOT_DELETED;
+    t->count--;
+
+    // Compact once dead objects outnumber live ones
+    size_t dead = t->num_objects - t->count;
+    if (dead > t->count && dead >= MIN_CAPACITY) {
+        size_t capacity = t->capacity;
+        while (capacity > MIN_CAPACITY && t->count * 8 < capacity) {
+            capacity /= 2;
+        }
+        rebuild(t, capacity);
+    }
+    return OBJECT_OK;
+}
+
+/* Removes name if owner owns it */
+int objects_delete(struct ObjectTable *t, const char *name, int owner) {
+    int had_data;
+    return delete_object(t, name, owner, &had_data);
+}
+
+// Shard of a name, from the top bits of its hash; tables index with the low ones
+static int shard_index(const char *name) {
+    return hash_name(name, strlen(name)) >> 26;
+}
+
+static struct ObjectShard *shard_of(struct ShardedObjects *s, const char *name) {
+    return &s->shards[shard_index(name)];
+}
+
+void sharded_init(struct ShardedObjects *s, ObjectHook hook) {
+    s->hook = hook;
+    for (int i = 0; i < OBJECT_SHARDS; i++) {
+        pthread_rwlock_init(&s->shards[i].lock, NULL);
+        objects_init(&s->shards[i].table);
+    }
+}
+
+void sharded_free(struct ShardedObjects *s) {
+    for (int i = 0; i < OBJECT_SHARDS; i++) {
+        pthread_rwlock_destroy(&s->shards[i].lock);
+        objects_free(&s->shards[i].table);
+    }
+}
+
+int sharded_put(struct ShardedObjects *s, const char *name, int owner, void *arg) {
+    struct ObjectShard *shard = shard_of(s, name);
+    pthread_rwlock_wrlock(&shard->lock);
+    int err = objects_put(&shard->table, name, owner);
+    if (err == OBJECT_OK) {
+        // objects_put appends the new object
+        shard->table.objects[shard->table.num_objects - 1].has_data = arg != NULL;
+        if (s->hook != NULL) {
+            s->hook(BATCH_PUT, name, owner, arg != NULL, arg);
+        }
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return err;
+}
+
+int sharded_owner(struct ShardedObjects *s, const char *name) {
+    struct ObjectShard *shard = shard_of(s, name);
+    pthread_rwlock_rdlock(&shard->lock);
+    int owner = objects_owner(&shard->table, name);
+    pthread_rwlock_unlock(&shard->lock);
+    return owner;
+}
+
+int sharded_delete(struct ShardedObjects *s, const char *name, int owner) {
+    struct ObjectShard *shard = shard_of(s, name);
+    pthread_rwlock_wrlock(&shard->lock);
+    int had_data = 0;
+    int err = delete_object(&shard->table, name, owner, &had_data);
+    if (err == OBJECT_OK && s->hook != NULL) {
+        s->hook(BATCH_DELETE, name, owner, had_data, NULL);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return err;
+}
+
+/* Whether name exists and was put with data */
+int sharded_has_data(struct ShardedObjects *s, const char *name) {
+    struct ObjectShard *shard = shard_of(s, name);
+    pthread_rwlock_rdlock(&shard->lock);
+    struct ObjectTable *t = &shard->table;
+    size_t len = strlen(name);
+    long i = find_slot(t, name, len, hash_name(name, len), NULL);
+    int has_data = i >= 0 && t->objects[t->slots[i].entry - 1].has_data;
+    pthread_rwlock_unlock(&shard->lock);
+    return has_data;
+}
+
+/*
+    Calls reader on name if it exists, with its shard read locked, and
+    returns its owner, or 0 if there is no such object
+*/
+int sharded_read(struct ShardedObjects *s, const char *name, ObjectReader reader, void *arg) {
+    struct ObjectShard *shard = shard_of(s, name);
+    pthread_rwlock_rdlock(&shard->lock);
+    struct ObjectTable *t = &shard->table;
+    size_t len = strlen(name);
+    long i = find_slot(t, name, len, hash_name(name, len), NULL);
+    int owner = 0;
+    if (i >= 0) {
+        struct Object *o = &t->objects[t->slots[i].entry - 1];
+        owner = o->owner;
+        reader(name, o->has_data, arg);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return owner;
+}
+
+/*
+    Applies op to count names for owner in one pass: the names are
+    grouped by shard, keeping their order within each, and every shard is
+    locked once for all of its names. Sets bit i of done, which holds
+    (count + 7) / 8 bytes, if name i succeeded, and returns how many did.
+*/
+int sharded_batch(struct ShardedObjects *s, int op, char **names, int count, int owner, unsigned char *done) {
+    unsigned char *shard = malloc(count);
+    int *order = malloc(count * sizeof(int));
+    int start[OBJECT_SHARDS + 1] = {0};
+    for (int i = 0; i < count; i++) {
+        shard[i] = shard_index(names[i]);
+        start[shard[i] + 1]++;
+    }
+    for (int k = 0; k < OBJECT_SHARDS; k++) {
+        start[k + 1] += start[k];
+    }
+    int next[OBJECT_SHARDS];
+    memcpy(next, start, sizeof(next));
+    for (int i = 0; i < count; i++) {
+        order[next[shard[i]]++] = i;
+    }
+
+    memset(done, 0, (count + 7) / 8);
+    int succeeded = 0;
+    for (int k = 0; k < OBJECT_SHARDS; k++) {
+        if (start[k] == start[k + 1]) {
+            continue;
+        }
+        struct ObjectShard *sh = &s->shards[k];
+        if (op == BATCH_GET) {
+            pthread_rwlock_rdlock(&sh->lock);
+        } else {
+            pthread_rwlock_wrlock(&sh->lock);
+        }
+        for (int j = start[k]; j < start[k + 1]; j++) {
+            int i = order[j], ok, had_data = 0;
+            if (op == BATCH_PUT) {
+                ok = objects_put(&sh->table, names[i], owner) == OBJECT_OK;
+            } else if (op == BATCH_GET) {
+                ok = objects_owner(&sh->table, names[i]) != 0;
+            } else {
+                ok = delete_object(&sh->table, names[i], owner, &had_data) == OBJECT_OK;
+            }
+            if (ok && op != BATCH_GET && s->hook != NULL) {
+                s->hook(op, names[i], owner, had_data, NULL);
+            }
+            if (ok) {
+                done[i / 8] |= 1 << (i % 8);
+                succeeded++;
+            }
+        }
+        pthread_rwlock_unlock(&sh->lock);
+    }
+    free(shard);
+    free(order);
+    return succeeded;
+}
@@ -0,0 +1,97 @@
+#ifndef OBJECTS_H
+#define OBJECTS_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// An object: its name, in the table's arena, and the client that owns it
+struct Object {
+    uint32_t name_off;
+    uint16_t name_len;
+    uint8_t has_data;       // put with data kept beside the table, see ObjectHook
+    int owner;              // 0 once deleted
+};
+
+// Hash index slot: the object's hash, so most probes never touch the
+// arena, and its position in objects plus one
+struct Slot {
+    uint32_t hash;
+    uint32_t entry;         // 0 empty, SLOT_DELETED after a delete
+};
+
+// The server's object table. Objects are kept in insertion order in a
+// dense array with their names packed in one arena, and found through an
+// open-addressing hash index with linear probing. Deletes leave a
+// tombstone slot, reused by the next insert that probes over it, and a
+// dead object; once dead objects outnumber live ones everything is
+// compacted. The table grows without limit.
+struct ObjectTable {
+    struct Slot *slots;
+    size_t capacity;        // slots, a power of two
+    size_t used;            // slots that are not empty, tombstones included
+    struct Object *objects;
+    size_t num_objects, objects_cap;
+    size_t count;           // live objects
+    char *arena;
+    size_t arena_len, arena_cap;
+};
+
+void objects_init(struct ObjectTable *t);
+void objects_free(struct ObjectTable *t);
+void objects_reserve(struct ObjectTable *t, size_t n);
+int objects_put(struct ObjectTable *t, const char *name, int owner);
+int objects_owner(struct ObjectTable *t, const char *name);
+int objects_delete(struct ObjectTable *t, const char *name, int owner);
+const char *objects_name(struct ObjectTable *t, struct Object *o);
+
+// The object table shared by server worker threads: names are spread over
+// shards by hash, each an ObjectTable under its own reader-writer lock.
+// GETs only take read locks, and a PUT or DELETE holds up just the GETs
+// of its own shard, 1 in OBJECT_SHARDS, while it changes the table and
+// runs the hook: in the server, moving an FPUT's file into place with
+// rename() and buffering a log record. The log is synced after the
+// shard lock is released.
+#define OBJECT_SHARDS 64
+
+// Called with the shard still write locked after every PUT or DELETE that
+// succeeds, so a log or data kept beside the table changes in step with
+// it. has_data says if the object was put with data: a sharded_put given
+// arg, not NULL, which is passed on; a DELETE always gets NULL.
+typedef void (*ObjectHook)(int op, const char *name, int owner, int has_data, void *arg);
+
+// Called by sharded_read with the shard still read locked, so data kept
+// beside the table can't be changed by a hook meanwhile
+typedef void (*ObjectReader)(const char *name, int has_data, void *arg);
+
+struct ObjectShard {
+    pthread_rwlock_t lock;
+    struct ObjectTable table;
+} __attribute__((aligned(64)));
+
+struct ShardedObjects {
+    struct ObjectShard shards[OBJECT_SHARDS];
+    ObjectHook hook;        // NULL for none
+};
+
+void sharded_init(struct ShardedObjects *s, ObjectHook hook);
+void sharded_free(struct ShardedObjects *s);
+int sharded_put(struct ShardedObjects *s, const char *name, int owner, void *arg);
+int sharded_owner(struct ShardedObjects *s, const char *name);
+int sharded_has_data(struct ShardedObjects *s, const char *name);
+int sharded_read(struct ShardedObjects *s, const char *name, ObjectReader reader, void *arg);
+int sharded_delete(struct ShardedObjects *s, const char *name, int owner);
+int sharded_batch(struct ShardedObjects *s, int op, char **names, int count, int owner, unsigned char *done);
+
+// Operations of sharded_batch
+#define BATCH_PUT 0
+#define BATCH_GET 1
+#define BATCH_DELETE 2
+
+// Results of objects_put and objects_delete
+#define OBJECT_OK 0
+#define OBJECT_EXISTS 1
+#define OBJECT_NOT_OWNER 2
+#define OBJECT_MISSING 3
+
+#endif
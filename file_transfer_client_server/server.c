@@ -1,241 +1,1233 @@
 /*
-    Description: The server executes requests from multiple clients
-                and responds to commands from stdin (list or quit). 
-    Usage: ./server
+    Description: The server executes requests from any number of clients
+                connected to its Unix domain socket and responds to
+                commands from stdin (list, snapshot or quit). Objects
+                survive restarts and crashes through a log and snapshots
+                in the store directory.
+    Usage: ./server [-q] [-t num_workers] [-d store_dir] [-l log_mode] [-s snapshot_mb] [socket_path]
+            -q  don't print every request and reply
+            -t  threads carrying out requests (default: one per core)
+            -d  directory holding object contents and the log (default: fts-store)
+            -l  group (default) syncs the changes of many requests at once,
+                each syncs every change on its own, off keeps nothing
+                (and refuses a store that has a log)
+            -s  log size that starts a snapshot (default: 64, 0 for never)
 */
 
+#define _GNU_SOURCE
 #include "common.h"
+#include "objects.h"
+#include "store.h"
+#include "wal.h"
+#include "work_queue.h"
 #include <fcntl.h>
+#include <limits.h>
 #include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
-#define MAXFILES 50    // Max number of files that can be managed
+#define MAXEVENTS 256       // Max events handled per epoll_wait
+#define MAXBURST 64         // Max requests of one client a worker serves before requeueing it
+#define QUEUE_SIZE 65536    // Work queue slots; a client is queued at most once, so clients are capped below it
+#define READ_PACKETS 64     // Max packets taken from a client's socket per read
+#define STORE_DIR "fts-store"
+#define SNAPSHOT_MB 64      // Log size that starts a snapshot
 
 // Server's file system representation
 struct FileSys {
-    int index;
-    char files[MAXFILES][MAXWORD];
-    int owners[MAXFILES];
+    struct ShardedObjects objects;  // every object and its owner
 };
 
+// A request: a packet and, for a batch, its body
+struct Request {
+    struct Packet p;
+    char *body;
+    char *file;             // FPUT's uploaded content, a temporary file
+};
+
+// An FGET's file, opened by open_object; err if the object has content that can't be opened
+struct Download {
+    int fd;
+    off_t size;
+    int err;
+};
+
+// Replies of a burst held back until the log is synced up to lsn; they end at end in out
+struct Held {
+    size_t end;
+    uint64_t lsn;
+};
+
+// A connected client. The dispatcher reads as many requests as are
+// waiting into in and appends each whole one to requests; the rest of a
+// batch body goes straight to batch_body once in is empty, and the rest
+// of an FPUT's content is spliced from the socket to its upload file. A
+// client with requests is scheduled: queued for, or being served by,
+// exactly one worker at a time, so its requests are carried out and
+// answered in order. Replies are gathered in out and sent once per
+// burst, once the log holds the burst's changes and those before them:
+// until then they are held back beyond out_ready, while the client's
+// next requests are carried out, and the log's committer lets them out.
+// What the socket can't take yet waits in out for epoll to report it
+// writable. An FGET's file follows its reply with sendfile, and until
+// it is all sent the client is parked: still scheduled, but set aside
+// by its worker for the dispatcher to finish and hand back.
+struct Client {
+    int fd;
+    int id;                 // id of the client's last packet, 0 until it sends one
+    int active;             // has sent requests and not yet QUIT
+    size_t in_len;
+    char in[sizeof(struct Packet) * READ_PACKETS];
+    struct Packet batch;    // batch whose body is still arriving
+    char *batch_body;       // NULL if there is none
+    size_t batch_got;
+    size_t batch_skip;      // bytes of a malformed batch's body still to drop
+    struct Packet upload;   // FPUT whose content is still arriving
+    int upload_fd;          // -1 if there is none
+    off_t upload_left;
+    char *upload_file;
+    struct Client *prev, *next;     // the dispatcher's list
+
+    pthread_mutex_t lock;   // guards the fields below
+    struct Request *requests;
+    size_t req_head, req_len, req_cap;
+    int scheduled;
+    int closed;             // the dispatcher has dropped the client
+    char *out;
+    size_t out_len, out_sent, out_cap;
+    size_t out_ready;       // replies before this may be sent
+    struct Held *held;      // bursts whose replies are held back, oldest first
+    size_t held_head, held_len, held_cap;
+    uint64_t held_lsn;      // lsn the last burst held waits for
+    int held_waiting;       // wait is with the log, holding a reference
+    int want_out;           // out is waiting for the socket to be writable
+    int send_fd;            // file being sent after out, or -1
+    off_t send_off, send_end;
+    int parked;
+    atomic_int refs;        // the dispatcher's, a scheduled worker's and the log's
+    struct WalWaiter wait;  // for the log to reach the oldest held burst
+};
+
+// Epoll tags of the listening socket and stdin; clients are tagged with their Client
+static int listen_tag, stdin_tag;
+
 // Function prototypes
-int server_put(struct Packet * p_rec, struct Packet * p, struct FileSys * fs);
+int server_put(struct Packet * p_rec, struct Packet * p, struct FileSys * fs, char * upload);
 int server_del(struct Packet * p_rec, struct Packet * p, struct FileSys * fs);
 int server_get(struct Packet * p_rec, struct Packet * p, struct FileSys * fs);
 void server_print(struct FileSys * fs);
+int listen_socket(const char *path);
+void accept_clients(int listen_fd, struct Client **clients);
+void close_client(struct Client *c, struct Client **clients);
+void release_client(struct Client *c);
+int read_client(struct Client *c);
+int drain_pipe(int fd, size_t n);
+int take_requests(struct Client *c, struct Request *reqs);
+void schedule_requests(struct Client *c, struct Request *reqs, size_t count);
+int queue_packet(struct Client *c, struct Packet *p, const char *body);
+int write_pending(struct Client *c);
+int send_replies(struct Client *c);
+int flush_client(struct Client *c);
+void watch_writable(struct Client *c);
+int handle_packet(struct Client *c, struct Packet *p_rec, char *file);
+void handle_batch(struct Client *c, struct Packet *p_rec, char *body);
+void *worker(void *arg);
+int serve_client(struct Client *c, int max);
+int end_burst(struct Client *c);
+int release_held(struct Client *c);
+void log_synced(void *arg);
+int unpark(struct Client *c);
+void hand_back(struct Client *c, int action);
+void saw_table(void);
+void table_changed(int op, const char *name, int owner, int has_data, void *arg);
+void open_object(const char *name, int has_data, void *arg);
 
+struct timespec start;
+int verbose = 1;
+int epfd;
+int splice_pipe[2];         // the dispatcher's, for uploads
+struct FileSys fs;
+struct WorkQueue work;
+int log_mode = WAL_GROUP;
+struct Wal wal;
+int max_clients;            // room in the work queue for every client and each worker's stop signal
+atomic_int live_clients;    // accepted and not yet freed, closed ones a worker still holds included
+static _Thread_local uint64_t burst_lsn;   // lsn the log must reach before the worker's burst is replied to
 
 
 /*
     Server main function that handles packet communication with clients
-    and responds to commands from stdin (list or quit). 
+    and responds to commands from stdin (list, snapshot or quit). This thread is the
+    dispatcher: one epoll loop over every client socket, all non-blocking,
+    that reads requests and hands clients that have some to the workers.
+    No client can stall the others.
 */
 int main (int argc, char *argv[]) {
-    // Initialize variables
-    struct pollfd pollfd[NCLIENT + 1];
-    int read_fifos[NCLIENT + 1] = {0};
-    int active_fifos[NCLIENT] = {0};
-    char fifo_x_server[] = "fifo-x-0";
-    char fifo_server_x[] = "fifo-0-x";
-    struct FileSys fs = {0};
-    struct timespec start, end;
-
-    // Create FIFOs for communication with clients
-    for (int i = 0; i < NCLIENT; i++) {
-        // Client to server FIFO
-        fifo_x_server[5] = i + '1';
-        if (access(fifo_x_server, F_OK) == -1) {
-            if (mkfifo(fifo_x_server, 0666) == -1) {
-                perror("Error making FIFO");
-                return 1;
-            }
+    const char *path = SOCKET_PATH;
+    const char *store_dir = STORE_DIR;
+    int num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t snapshot_mb = SNAPSHOT_MB;
+    int bad_arg = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-q") == 0) {
+            verbose = 0;
         }
-
-        // Server to client FIFO
-        fifo_server_x[7] = i + '1';
-        if (access(fifo_server_x, F_OK) == -1) {
-            if (mkfifo(fifo_server_x, 0666) == -1) {
-                perror("Error making FIFO");
-                return 1;
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            num_workers = atoi(argv[++i]);
+            bad_arg |= num_workers < 1 || num_workers >= QUEUE_SIZE;
+        }
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            store_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "off") == 0) {
+                log_mode = WAL_OFF;
+            } else if (strcmp(argv[i], "each") == 0) {
+                log_mode = WAL_EACH;
+            } else if (strcmp(argv[i], "group") == 0) {
+                log_mode = WAL_GROUP;
+            } else {
+                bad_arg = 1;
             }
         }
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            char *end;
+            errno = 0;
+            long mb = strtol(argv[++i], &end, 10);
+            bad_arg |= end == argv[i] || *end != '\0' || errno != 0 || mb < 0 || (size_t) mb > SIZE_MAX >> 20;
+            snapshot_mb = mb;
+        }
+        else if (argv[i][0] == '-') {
+            // An unknown option, or one missing its value
+            bad_arg = 1;
+        }
+        else {
+            path = argv[i];
+        }
+    }
+    if (bad_arg) {
+        fprintf(stderr, "Usage: %s [-q] [-t num_workers] [-d store_dir] [-l off|group|each] [-s snapshot_mb] [socket_path]\n", argv[0]);
+        fprintf(stderr, "       num_workers from 1 to %d, snapshot_mb 0 or more\n", QUEUE_SIZE - 1);
+        return 1;
     }
 
-    // Setup polling FIFOs
-    for (int i = 0; i < NCLIENT; i++) {
-        // Open FIFO for read-only
-        fifo_x_server[5] = i + '1'; 
-        int fd = open(fifo_x_server, O_RDONLY | O_NONBLOCK);
-        if (fd < 0) {
-            fprintf(stderr, "Error opening read FIFO %s\n", fifo_x_server);
-            return 1;
+    // Allow as many clients as the hard limit on open files
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    // A client that hangs up before its reply must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // Initialize variables
+    struct Client *clients = NULL;
+    max_clients = QUEUE_SIZE - num_workers;
+    if (store_init(store_dir, log_mode != WAL_OFF) != 0) {
+        return 1;
+    }
+    // Rebuild the table from the log before anything is logged
+    struct timespec recover_start;
+    clock_gettime(CLOCK_MONOTONIC, &recover_start);
+    sharded_init(&fs.objects, NULL);
+    if (wal_open(&wal, store_dir, log_mode, snapshot_mb << 20, &fs.objects, store_collect) != 0) {
+        return 1;
+    }
+    if (log_mode != WAL_OFF) {
+        store_recover(&fs.objects);
+        size_t count = 0;
+        for (int s = 0; s < OBJECT_SHARDS; s++) {
+            count += fs.objects.shards[s].table.count;
         }
-        read_fifos[i] = fd;
-        pollfd[i].fd = fd;
-        pollfd[i].events = POLLIN;
-        pollfd[i].revents = 0;
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("Recovered %zu objects (snapshot: %zu, log records: %zu) in %.3f s\n", count,
+                wal.snapshot_objects, wal.log_records, (end.tv_sec - recover_start.tv_sec) + (end.tv_nsec - recover_start.tv_nsec) / 1e9);
     }
+    fs.objects.hook = table_changed;
+    work_init(&work, QUEUE_SIZE);
+    pipe2(splice_pipe, O_CLOEXEC);
+    fcntl(splice_pipe[0], F_SETPIPE_SZ, CHUNK_SIZE);
+    int listen_fd = listen_socket(path);
+    if (listen_fd < 0) {
+        return 1;
+    }
+    epfd = epoll_create1(0);
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_tag;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.ptr = &stdin_tag;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, 0, &ev);
 
-    // Setup polling for stdin
-    read_fifos[NCLIENT] = 0;  // stdin file descriptor
-    pollfd[NCLIENT].fd = 0;
-    pollfd[NCLIENT].events = POLLIN;
-    pollfd[NCLIENT].revents = 0;
+    pthread_t *workers = malloc(num_workers * sizeof(pthread_t));
+    for (int i = 0; i < num_workers; i++) {
+        pthread_create(&workers[i], NULL, worker, NULL);
+    }
 
-    printf("Running server\n\n");  
+    printf("Running server (socket= %s, workers= %d)\n\n", path, num_workers);
+    fflush(stdout);
     clock_gettime(CLOCK_MONOTONIC, &start);
     int done_flag = 0;
 
     // Main server loop
+    struct epoll_event events[MAXEVENTS];
     while(!done_flag) {
-        poll(pollfd, NCLIENT + 1, 1000);
-
-        // Check for input from stdin
-        if (pollfd[NCLIENT].revents & POLLIN) {
-            char buffer[MAXWORD];
-            if (fgets(buffer, MAXWORD, stdin) != NULL) {
-                if (!strcmp(buffer, "quit\n")) {
+        int n = epoll_wait(epfd, events, MAXEVENTS, -1);
+        for (int e = 0; e < n; e++) {
+            void *tag = events[e].data.ptr;
+            if (tag == &listen_tag) {
+                accept_clients(listen_fd, &clients);
+            }
+            else if (tag == &stdin_tag) {
+                // Check for input from stdin
+                char buffer[MAXWORD];
+                if (fgets(buffer, MAXWORD, stdin) == NULL) {
+                    // No more commands; keep serving until killed
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, 0, NULL);
+                }
+                else if (!strcmp(buffer, "quit\n")) {
                     done_flag = 1;
-
-                    // Notify clients to quit
-                    for (int i = 0; i < NCLIENT; i++) {
-                        if (active_fifos[i]) {
-                            fifo_server_x[7] = i + '1'; 
-                            struct Packet p_quit = {i+1, "CQUIT", "", 0.0};
-                            send_packet(fifo_server_x, &p_quit);
-                        }
-                    }
-                    printf("Waiting for clients to quit\n");
-                    usleep(3000 * 1000); 
-                    for (int i = 0; i < NCLIENT; i++) {
-                        close(read_fifos[i]);
-                    } 
-                    printf("Quit\n");
-                    return 0;
                 }
-
-                if (!strcmp(buffer, "list\n")) {
+                else if (!strcmp(buffer, "list\n")) {
                     server_print(&fs);
                 }
+                else if (!strcmp(buffer, "snapshot\n")) {
+                    wal_snapshot(&wal);
+                }
             }
-        }
-
-        // Handle requests from client FIFOs
-        for (int i = 0; i < NCLIENT; i++) {
-            if (pollfd[i].revents & POLLIN) {
-                if (pollfd[i].fd == read_fifos[i]){
-                    active_fifos[i] = 1;
-                    fifo_server_x[7] = i + '1'; 
-                    struct Packet p_rec;
-                    read(read_fifos[i], (char *) &p_rec, sizeof(p_rec));
-                    
-                    if (strcmp(p_rec.type, "GTIME") == 0) {
-                        printf("Received (src= client:%d) %s\n", p_rec.id, p_rec.type);
-                        clock_gettime(CLOCK_MONOTONIC, &end);
-                        double time_diff = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
-                        struct Packet p = {i+1, "TIME", "", time_diff};
-                        send_packet(fifo_server_x, &p);
-                        printf("Transmitted (src= server) TIME: %.2f s\n\n", p.num);
-                    } 
-                    else if (strcmp(p_rec.type, "QUIT") == 0) {
-                        active_fifos[i] = 0;
-                        printf("Client:%d has finished\n\n", i+1);
-                    } 
-                    else {
-                        printf("Received (src= client:%d) %s: %s\n", p_rec.id, p_rec.type, p_rec.message);
-                        struct Packet p = {0, "OK", "", 0.0};
-                        int err_flag = 0;
-                        if (strcmp(p_rec.type, "PUT") == 0) {
-                            err_flag = server_put(&p_rec, &p, &fs);
-                        } else if (strcmp(p_rec.type, "GET") == 0) {
-                            err_flag = server_get(&p_rec, &p, &fs);
-                        } else if (strcmp(p_rec.type, "DELETE") == 0) {
-                            err_flag = server_del(&p_rec, &p, &fs);
+            else {
+                // Pending replies and new requests of a client
+                struct Client *c = tag;
+                int closed = 0;
+                if (events[e].events & EPOLLOUT) {
+                    closed = flush_client(c) != 0;
+                }
+                if (!closed && (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                    // A pipelining client may have many requests waiting
+                    struct Request reqs[READ_PACKETS + 1];
+                    int status, count;
+                    while ((status = read_client(c)) == 1) {
+                        if ((count = take_requests(c, reqs)) < 0) {
+                            status = -1;
+                            break;
                         }
-                        send_packet(fifo_server_x, &p);
-                        if (err_flag == 0) {
-                            printf("Transmitted (src= server) %s\n\n", p.type);
-                        } else {
-                            printf("Transmitted (src= server) %s: %s\n\n", p.type, p.message);
+                        schedule_requests(c, reqs, count);
+                        if (c->upload_fd >= 0) {
+                            break;      // a chunk per event, so uploads share the dispatcher
                         }
                     }
+                    closed = status < 0;
+                }
+                if (closed) {
+                    close_client(c, &clients);
                 }
             }
         }
+        if (verbose) {
+            fflush(stdout);
+        }
+    }
+
+    // Let the workers finish what was already read, except for the requests
+    // of clients parked on an FGET: those are answered below
+    for (int i = 0; i < num_workers; i++) {
+        while (work_push(&work, NULL) != 0) {
+            sched_yield();
+        }
+    }
+    for (int i = 0; i < num_workers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    // Clients a worker requeued behind the stop signals, or the log hands back
+    struct Client *requeued;
+    while (1) {
+        while ((requeued = work_try_pop(&work)) != NULL) {
+            if (serve_client(requeued, INT_MAX)) {
+                work_push(&work, requeued);
+            }
+        }
+        wal_flush(&wal);
+        if ((requeued = work_try_pop(&work)) == NULL) {
+            break;
+        }
+        work_push(&work, requeued);
+    }
+    wal_close(&wal);
+
+    // Give clients what is left of their replies and files, refuse what a
+    // parked client asked for after its FGET, then notify them to quit
+    printf("Waiting for clients to quit\n");
+    while (clients != NULL) {
+        struct Client *c = clients;
+        // Block for at most a second on a client that stopped reading
+        struct timeval timeout = {1, 0};
+        setsockopt(c->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) & ~O_NONBLOCK);
+        int failed = write_full(c->fd, c->out + c->out_sent, c->out_len - c->out_sent);
+        if (!failed && c->send_fd >= 0) {
+            lseek(c->send_fd, c->send_off, SEEK_SET);
+            failed = send_file(c->fd, c->send_fd, c->send_end - c->send_off);
+        }
+        for (size_t i = c->req_head; !failed && i < c->req_len; i++) {
+            struct Packet p = {0, "ERROR", "server shutting down", 0.0, c->requests[i].p.seq};
+            failed = write_full(c->fd, &p, sizeof(p));
+        }
+        if (!failed && c->active) {
+            struct Packet p_quit = {c->id, "CQUIT", "", 0.0};
+            write_full(c->fd, &p_quit, sizeof(p_quit));
+        }
+        close_client(c, &clients);
+    }
+    close(listen_fd);
+    close(splice_pipe[0]);
+    close(splice_pipe[1]);
+    unlink(path);
+    work_free(&work);
+    sharded_free(&fs.objects);
+    printf("Quit\n");
+    return 0;
+}
+
+/*
+    Carries out a batch in one pass over the object table and queues a
+    STATUS reply with a bit per object. An empty or malformed batch, or
+    one take_requests dropped the body of, gets an ERROR.
+*/
+void handle_batch(struct Client *c, struct Packet *p_rec, char *body) {
+    c->id = p_rec->id;
+    c->active = 1;
+    // Give each name a terminator, moving it down over its length byte
+    char *names[MAXBATCH];
+    int count = 0;
+    size_t pos = 0;
+    while (body != NULL && pos < p_rec->body && count < MAXBATCH) {
+        size_t len = (unsigned char) body[pos];
+        if (len == 0 || len > MAXWORD || pos + 1 + len > p_rec->body) {
+            break;
+        }
+        memmove(body + pos, body + pos + 1, len);
+        body[pos + len] = '\0';
+        names[count++] = body + pos;
+        pos += 1 + len;
+    }
+    if (count == 0 || pos != p_rec->body) {
+        struct Packet p = {0, "ERROR", "malformed batch", 0.0, p_rec->seq};
+        queue_packet(c, &p, NULL);
+        if (verbose) printf("Received (src= client:%d) %s\nTransmitted (src= server) %s: %s\n\n", p_rec->id, p_rec->type, p.type, p.message);
+        return;
+    }
+    if (verbose) printf("Received (src= client:%d) %s: %d objects\n", p_rec->id, p_rec->type, count);
+
+    int op = BATCH_PUT;
+    if (strcmp(p_rec->type, "MGET") == 0) {
+        op = BATCH_GET;
+    } else if (strcmp(p_rec->type, "MDEL") == 0) {
+        op = BATCH_DELETE;
+    }
+    unsigned char done[MAXBATCH / 8];
+    struct Packet p = {0, "STATUS", "", 0.0, p_rec->seq, (count + 7) / 8};
+    p.num = sharded_batch(&fs.objects, op, names, count, p_rec->id, done);
+    saw_table();
+    queue_packet(c, &p, (char *) done);
+    if (verbose) printf("Transmitted (src= server) %s: %.0f of %d\n\n", p.type, p.num, count);
+}
+
+/*
+    Worker thread: takes a scheduled client off the work queue and carries
+    out its requests in order, requeueing it behind the others after
+    MAXBURST of them. A NULL client tells the worker to stop.
+*/
+void *worker(void *arg) {
+    struct Client *c;
+    while ((c = work_pop(&work)) != NULL) {
+        if (serve_client(c, MAXBURST)) {
+            // Still scheduled; the queue keeps the worker's reference
+            while (work_push(&work, c) != 0) {
+                sched_yield();
+            }
+        }
+        if (verbose) {
+            fflush(stdout);
+        }
+    }
+    return NULL;
+}
+
+/*
+    Carries out up to max requests of a scheduled client, stopping after
+    one whose reply a file follows, and sends their replies together.
+    Returns 1 if it has more and is to be requeued.
+*/
+int serve_client(struct Client *c, int max) {
+    burst_lsn = 0;
+    for (int served = 0; served < max; served++) {
+        pthread_mutex_lock(&c->lock);
+        if (c->req_head == c->req_len) {
+            pthread_mutex_unlock(&c->lock);
+            break;
+        }
+        struct Request req = c->requests[c->req_head++];
+        pthread_mutex_unlock(&c->lock);
+        int file = 0;
+        if (req.body != NULL || req.p.body != 0 || is_batch(req.p.type)) {
+            handle_batch(c, &req.p, req.body);
+            free(req.body);
+        }
+        else {
+            file = handle_packet(c, &req.p, req.file);
+        }
+        free(req.file);
+        if (file) {
+            break;
+        }
+    }
+    return end_burst(c);
+}
+
+/*
+    Holds a burst's replies back until the log is synced past its changes
+    and those of bursts held before, then sends what may go. Returns 1 if
+    the client has more requests and stays scheduled; otherwise, unless
+    it is parked while its file is sent, unschedules it and drops the
+    reference taken when it was scheduled.
+*/
+int end_burst(struct Client *c) {
+    pthread_mutex_lock(&c->lock);
+    if (burst_lsn > c->held_lsn) {
+        c->held_lsn = burst_lsn;
+    }
+    if (c->held_len == c->held_cap) {
+        c->held_cap = c->held_cap ? c->held_cap * 2 : 4;
+        c->held = realloc(c->held, c->held_cap * sizeof(struct Held));
+    }
+    c->held[c->held_len++] = (struct Held) {c->out_len, c->held_lsn};
+    int wait = release_held(c);
+    pthread_mutex_unlock(&c->lock);
+    if (wait) {
+        wal_notify(&wal, &c->wait);
+    }
+
+    if (send_replies(c)) {
+        // Parked until its file is sent; the dispatcher or the log carries on from here
+        return 0;
+    }
+    pthread_mutex_lock(&c->lock);
+    if (c->req_head < c->req_len) {
+        pthread_mutex_unlock(&c->lock);
+        return 1;
+    }
+    c->req_head = c->req_len = 0;
+    c->scheduled = 0;
+    pthread_mutex_unlock(&c->lock);
+    release_client(c);
+    return 0;
+}
+
+/*
+    Lets out the replies of the held bursts the log is synced past.
+    Returns 1 if wait is to be handed to the log for the rest, with a
+    reference taken for it. Called with c->lock held.
+*/
+int release_held(struct Client *c) {
+    uint64_t durable = wal_durable(&wal);
+    while (c->held_head < c->held_len && c->held[c->held_head].lsn <= durable) {
+        c->out_ready = c->held[c->held_head++].end;
+    }
+    if (c->held_head == c->held_len) {
+        c->held_head = c->held_len = 0;
+        return 0;
+    }
+    if (c->held_waiting) {
+        return 0;
+    }
+    c->held_waiting = 1;
+    atomic_fetch_add(&c->refs, 1);
+    c->wait = (struct WalWaiter) {c->held[c->held_head].lsn, log_synced, c, NULL};
+    return 1;
+}
+
+// Committer callback: the log has reached a client's oldest held burst
+void log_synced(void *arg) {
+    struct Client *c = arg;
+    pthread_mutex_lock(&c->lock);
+    c->held_waiting = 0;
+    int wait = release_held(c);
+    int action = 0;
+    if (!c->closed && !c->want_out) {
+        int status = write_pending(c);
+        if (status == 1) {
+            watch_writable(c);
+        } else if (status == 0) {
+            action = unpark(c);
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+    if (wait) {
+        wal_notify(&wal, &c->wait);
+    }
+    hand_back(c, action);
+    release_client(c);
+}
+
+/*
+    Holds the burst's replies until the log is synced up to every change
+    the table held when it was just read, so no reply tells of one a
+    crash could still lose.
+*/
+void saw_table(void) {
+    uint64_t lsn = wal_appended(&wal);
+    if (lsn > burst_lsn) {
+        burst_lsn = lsn;
+    }
+}
+
+/*
+    Object table hook, under the shard write lock: logs a change, moving
+    an FPUT's upload into place before the log can promise it and a
+    deleted object's file out of the way once it is logged.
+*/
+void table_changed(int op, const char *name, int owner, int has_data, void *arg) {
+    if (has_data && op == BATCH_PUT) {
+        store_put(name, arg);
+    }
+    uint64_t lsn = 0;
+    if (log_mode != WAL_OFF) {
+        lsn = wal_append(&wal, op, name, owner, has_data);
+        burst_lsn = lsn;
+    }
+    if (has_data && op == BATCH_DELETE) {
+        store_delete(name, lsn > wal_durable(&wal) ? lsn : 0);
+    }
+}
+
+/* Object table reader for FGET, under the shard read lock: opens the object's file, if it has one */
+void open_object(const char *name, int has_data, void *arg) {
+    struct Download *download = arg;
+    if (has_data) {
+        download->fd = store_open(name, &download->size);
+        download->err = download->fd < 0;
+    }
+}
+
+/*
+    Appends requests to the client's requests and, unless a worker
+    already has the client, queues it for one.
+*/
+void schedule_requests(struct Client *c, struct Request *reqs, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    pthread_mutex_lock(&c->lock);
+    if (c->req_len + count > c->req_cap) {
+        while (c->req_len + count > c->req_cap) {
+            c->req_cap = c->req_cap ? c->req_cap * 2 : 4;
+        }
+        c->requests = realloc(c->requests, c->req_cap * sizeof(struct Request));
+    }
+    memcpy(c->requests + c->req_len, reqs, count * sizeof(struct Request));
+    c->req_len += count;
+    int schedule = !c->scheduled;
+    if (schedule) {
+        c->scheduled = 1;
+        atomic_fetch_add(&c->refs, 1);
+    }
+    pthread_mutex_unlock(&c->lock);
+    if (schedule) {
+        while (work_push(&work, c) != 0) {
+            sched_yield();
+        }
+    }
+}
+
+/*
+    Carries out one request of a client and queues the reply on its
+    connection. Same packet semantics as when clients used FIFOs. An
+    FPUT's content has been uploaded to file already. Returns 1 if the
+    reply is to be followed by an object's file.
+*/
+int handle_packet(struct Client *c, struct Packet *p_rec, char *file) {
+    c->id = p_rec->id;
+    c->active = 1;
+    p_rec->message[MAXWORD] = '\0';
+    if (strcmp(p_rec->type, "GTIME") == 0) {
+        if (verbose) printf("Received (src= client:%d) %s\n", p_rec->id, p_rec->type);
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double time_diff = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        struct Packet p = {p_rec->id, "TIME", "", time_diff, p_rec->seq};
+        queue_packet(c, &p, NULL);
+        if (verbose) printf("Transmitted (src= server) TIME: %.2f s\n\n", p.num);
+    }
+    else if (strcmp(p_rec->type, "QUIT") == 0) {
+        c->active = 0;
+        if (verbose) printf("Client:%d has finished\n\n", p_rec->id);
+    }
+    else if (strcmp(p_rec->type, "FGET") == 0) {
+        if (verbose) printf("Received (src= client:%d) %s: %s\n", p_rec->id, p_rec->type, p_rec->message);
+        struct Packet p = {0, "FILE", "", 0.0, p_rec->seq};
+        // Opened under the shard lock, so no DELETE or FPUT moves the file in between
+        struct Download download = {-1, 0, 0};
+        int found = sharded_read(&fs.objects, p_rec->message, open_object, &download);
+        saw_table();
+        if (found == 0 || download.err) {
+            strcpy(p.type, "ERROR");
+            strcpy(p.message, download.err ? "can't read content" : "object not found");
+            queue_packet(c, &p, NULL);
+            if (verbose) printf("Transmitted (src= server) %s: %s\n\n", p.type, p.message);
+            return 0;
+        }
+        off_t size = download.size;
+        int fd = download.fd;
+        p.num = size;
+        int sending = 0;
+        if (queue_packet(c, &p, NULL) == 0 && size > 0) {
+            pthread_mutex_lock(&c->lock);
+            c->send_fd = fd;
+            c->send_off = 0;
+            c->send_end = size;
+            pthread_mutex_unlock(&c->lock);
+            sending = 1;
+        }
+        else if (fd >= 0) {
+            close(fd);
+        }
+        if (verbose) printf("Transmitted (src= server) %s: %.0f bytes\n\n", p.type, p.num);
+        return sending;
+    }
+    else {
+        if (verbose) printf("Received (src= client:%d) %s: %s\n", p_rec->id, p_rec->type, p_rec->message);
+        struct Packet p = {0, "OK", "", 0.0, p_rec->seq};
+        int err_flag = 0;
+        if (strcmp(p_rec->type, "PUT") == 0) {
+            err_flag = server_put(p_rec, &p, &fs, NULL);
+        } else if (strcmp(p_rec->type, "FPUT") == 0) {
+            // The log must not promise content the disk doesn't have yet
+            if (log_mode != WAL_OFF && store_sync(file) != 0) {
+                strcpy(p.type, "ERROR");
+                strcpy(p.message, "can't store content");
+                err_flag = 1;
+            } else {
+                err_flag = server_put(p_rec, &p, &fs, file);
+            }
+            if (err_flag) {
+                unlink(file);
+            }
+        } else if (strcmp(p_rec->type, "GET") == 0) {
+            err_flag = server_get(p_rec, &p, &fs);
+        } else if (strcmp(p_rec->type, "DELETE") == 0) {
+            err_flag = server_del(p_rec, &p, &fs);
+        }
+        saw_table();
+        queue_packet(c, &p, NULL);
+        if (!verbose) {
+            return 0;
+        }
+        if (err_flag == 0) {
+            printf("Transmitted (src= server) %s\n\n", p.type);
+        } else {
+            printf("Transmitted (src= server) %s: %s\n\n", p.type, p.message);
+        }
     }
-    
     return 0;
 }
 
+// Create the listening socket at path, replacing a stale one
+int listen_socket(const char *path) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("Error making socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        perror("Error binding socket");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
 
-// Server function: Stores the object name or sends an error if the object already exists
-int server_put(struct Packet * p_rec, struct Packet * p, struct FileSys * fs) {
-    for(int i = 0; i < fs->index; i++)  {
-        if (strcmp(fs->files[i], p_rec->message) == 0) {
-            strcpy(p->type, "ERROR");
-            strcpy(p->message, "object already exists");
+/*
+    Accept every pending connection as a non-blocking client. Beyond
+    max_clients a connection is closed at once: the work queue could fill
+    up, and nobody would be left to pop it while workers and the
+    dispatcher waited to push.
+*/
+void accept_clients(int listen_fd, struct Client **clients) {
+    int fd;
+    while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+        if (atomic_load(&live_clients) >= max_clients) {
+            if (verbose) printf("Refused a client: %d connected already\n\n", max_clients);
+            close(fd);
+            continue;
+        }
+        atomic_fetch_add(&live_clients, 1);
+        struct Client *c = calloc(1, sizeof(*c));
+        c->fd = fd;
+        c->upload_fd = -1;
+        c->send_fd = -1;
+        pthread_mutex_init(&c->lock, NULL);
+        atomic_init(&c->refs, 1);
+        c->next = *clients;
+        if (*clients != NULL) {
+            (*clients)->prev = c;
+        }
+        *clients = c;
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+/*
+    Drops a client from the dispatcher. A worker may still be serving it;
+    its socket stays open, so the fd can't be reused under the worker,
+    until the last reference is released.
+*/
+void close_client(struct Client *c, struct Client **clients) {
+    pthread_mutex_lock(&c->lock);
+    c->closed = 1;
+    int parked = c->parked;
+    c->parked = 0;
+    pthread_mutex_unlock(&c->lock);
+    if (parked) {
+        release_client(c);
+    }
+    if (c->upload_fd >= 0) {
+        close(c->upload_fd);
+        unlink(c->upload_file);
+        free(c->upload_file);
+    }
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    if (c->prev != NULL) {
+        c->prev->next = c->next;
+    } else {
+        *clients = c->next;
+    }
+    if (c->next != NULL) {
+        c->next->prev = c->prev;
+    }
+    release_client(c);
+}
+
+void release_client(struct Client *c) {
+    if (atomic_fetch_sub(&c->refs, 1) == 1) {
+        close(c->fd);
+        pthread_mutex_destroy(&c->lock);
+        for (size_t i = c->req_head; i < c->req_len; i++) {
+            free(c->requests[i].body);
+            if (c->requests[i].file != NULL) {
+                unlink(c->requests[i].file);
+                free(c->requests[i].file);
+            }
+        }
+        if (c->send_fd >= 0) {
+            close(c->send_fd);
+        }
+        free(c->requests);
+        free(c->held);
+        free(c->batch_body);
+        free(c->out);
+        free(c);
+        atomic_fetch_sub(&live_clients, 1);
+    }
+}
+
+/*
+    Moves n bytes the dispatcher spliced into its pipe on to fd. If they
+    can't all go, the pipe is replaced so no upload gets another's bytes.
+*/
+int drain_pipe(int fd, size_t n) {
+    while (n > 0) {
+        ssize_t m = splice(splice_pipe[0], NULL, fd, NULL, n, SPLICE_F_MOVE);
+        if (m < 0 && errno == EINTR) {
+            continue;
+        }
+        if (m <= 0) {
+            close(splice_pipe[0]);
+            close(splice_pipe[1]);
+            pipe2(splice_pipe, O_CLOEXEC);
+            fcntl(splice_pipe[0], F_SETPIPE_SZ, CHUNK_SIZE);
             return 1;
         }
+        n -= m;
     }
-    strcpy(fs->files[fs->index], p_rec->message);
-    fs->owners[fs->index] = p_rec->id;
-    fs->index ++;
     return 0;
 }
 
-// Server function: Removes the object name or sends an error if deleting an object owned by another client
-int server_del(struct Packet * p_rec, struct Packet * p, struct FileSys * fs) {
-    int index_to_delete = -1;
-    for(int i = 0; i < fs->index; i++)  {
-        if (strcmp(fs->files[i], p_rec->message) == 0) {
-            if (fs->owners[i] != p_rec->id) {
-                strcpy(p->type, "ERROR");
-                strcpy(p->message, "client not owner");
+/*
+    Reads what the client has sent, up to READ_PACKETS packets at once,
+    the rest of a batch body or a chunk of an upload. Returns 1 if it read something, 0 if the
+    socket has nothing more for now, and -1 once the client has closed
+    its end.
+*/
+int read_client(struct Client *c) {
+    while (1) {
+        ssize_t n;
+        if (c->upload_fd >= 0 && c->in_len == 0) {
+            size_t want = c->upload_left < CHUNK_SIZE ? c->upload_left : CHUNK_SIZE;
+            n = splice(c->fd, NULL, splice_pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                c->upload_left -= n;
+                return drain_pipe(c->upload_fd, n) == 0 ? 1 : -1;
+            }
+        }
+        else if (c->batch_body != NULL && c->in_len == 0) {
+            n = read(c->fd, c->batch_body + c->batch_got, c->batch.body - c->batch_got);
+            if (n > 0) {
+                c->batch_got += n;
                 return 1;
-            } 
-            else {
-                index_to_delete = i;
+            }
+        } else {
+            n = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+            if (n > 0) {
+                c->in_len += n;
+                return 1;
+            }
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        return -1;
+    }
+}
+
+/*
+    Moves every whole request read from the client into reqs, which has
+    room for READ_PACKETS + 1, and returns how many there were, starting
+    the upload of an FPUT's content. A malformed batch, one that is empty
+    or too long or a body after some other request, has its body dropped
+    and is still passed on, for handle_batch to answer with an error.
+    Returns -1 if an FPUT's size is impossible or its upload can't be
+    written.
+*/
+int take_requests(struct Client *c, struct Request *reqs) {
+    size_t pos = 0;
+    int count = 0;
+    while (1) {
+        if (c->upload_fd >= 0) {
+            // Content that came in with the packets
+            size_t take = c->in_len - pos;
+            if ((off_t) take > c->upload_left) {
+                take = c->upload_left;
+            }
+            if (write_full(c->upload_fd, c->in + pos, take) != 0) {
+                return -1;
+            }
+            pos += take;
+            c->upload_left -= take;
+            if (c->upload_left > 0) {
+                break;
+            }
+            close(c->upload_fd);
+            c->upload_fd = -1;
+            reqs[count++] = (struct Request) {c->upload, NULL, c->upload_file};
+            c->upload_file = NULL;
+        }
+        else if (c->batch_body != NULL) {
+            size_t take = c->batch.body - c->batch_got;
+            if (take > c->in_len - pos) {
+                take = c->in_len - pos;
+            }
+            memcpy(c->batch_body + c->batch_got, c->in + pos, take);
+            pos += take;
+            c->batch_got += take;
+            if (c->batch_got < c->batch.body) {
+                break;
+            }
+            reqs[count++] = (struct Request) {c->batch, c->batch_body, NULL};
+            c->batch_body = NULL;
+        }
+        else if (c->batch_skip > 0) {
+            size_t take = c->batch_skip < c->in_len - pos ? c->batch_skip : c->in_len - pos;
+            pos += take;
+            c->batch_skip -= take;
+            if (c->batch_skip > 0) {
                 break;
             }
+            reqs[count++] = (struct Request) {c->batch, NULL, NULL};
+        }
+        else if (c->in_len - pos >= sizeof(struct Packet)) {
+            struct Packet p;
+            memcpy(&p, c->in + pos, sizeof(p));
+            pos += sizeof(p);
+            p.type[sizeof(p.type) - 1] = '\0';
+            if (strcmp(p.type, "FPUT") == 0 && p.body == 0) {
+                if (!(p.num >= 0 && p.num <= MAXFILE)) {
+                    return -1;
+                }
+                char tmp_path[PATH_MAX];
+                c->upload_fd = store_upload(tmp_path);
+                if (c->upload_fd < 0) {
+                    perror("Error making upload file");
+                    return -1;
+                }
+                c->upload = p;
+                c->upload_left = (off_t) p.num;
+                c->upload_file = strdup(tmp_path);
+                continue;
+            }
+            if (p.body == 0 && !is_batch(p.type)) {
+                reqs[count++] = (struct Request) {p, NULL, NULL};
+                continue;
+            }
+            if (p.body == 0 || p.body > MAXBODY || !is_batch(p.type)) {
+                c->batch = p;
+                c->batch_skip = p.body;
+                if (p.body == 0) {
+                    reqs[count++] = (struct Request) {p, NULL, NULL};
+                }
+                continue;
+            }
+            c->batch = p;
+            c->batch_body = malloc(p.body);
+            c->batch_got = 0;
+        }
+        else {
+            break;
         }
     }
-    if (index_to_delete == -1) {
+    memmove(c->in, c->in + pos, c->in_len - pos);
+    c->in_len -= pos;
+    return count;
+}
+
+// Adds a reply and its p->body bytes of body to the client's out, to be sent by send_replies
+int queue_packet(struct Client *c, struct Packet *p, const char *body) {
+    size_t len = sizeof(*p) + p->body;
+    pthread_mutex_lock(&c->lock);
+    if (c->closed) {
+        pthread_mutex_unlock(&c->lock);
+        return 1;
+    }
+    if (c->out_len + len > c->out_cap) {
+        c->out_cap = (c->out_len + len) * 2;
+        c->out = realloc(c->out, c->out_cap);
+    }
+    memcpy(c->out + c->out_len, p, sizeof(*p));
+    memcpy(c->out + c->out_len + sizeof(*p), body, p->body);
+    c->out_len += len;
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+/*
+    Writes the client's ready replies, then the file being sent once no
+    reply is held back, as far as the socket takes them right away and at
+    most CHUNK_SIZE bytes of file. Returns 0 once everything is sent, 1 if
+    the rest has to wait for the socket, 2 if it waits for the log, and
+    -1 if the reader is gone. Called with c->lock held.
+*/
+int write_pending(struct Client *c) {
+    while (c->out_sent < c->out_ready) {
+        ssize_t n = write(c->fd, c->out + c->out_sent, c->out_ready - c->out_sent);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        c->out_sent += n;
+    }
+    memmove(c->out, c->out + c->out_sent, c->out_len - c->out_sent);
+    c->out_len -= c->out_sent;
+    for (size_t i = c->held_head; i < c->held_len; i++) {
+        c->held[i].end -= c->out_sent;
+    }
+    c->out_ready = c->out_sent = 0;
+    if (c->out_len > 0) {
+        return 2;
+    }
+    off_t budget = CHUNK_SIZE;
+    while (c->send_fd >= 0 && c->send_off < c->send_end) {
+        if (budget == 0) {
+            return 1;
+        }
+        off_t left = c->send_end - c->send_off;
+        ssize_t n = sendfile(c->fd, c->send_fd, &c->send_off, left < budget ? left : budget);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        budget -= n;
+    }
+    if (c->send_fd >= 0) {
+        close(c->send_fd);
+        c->send_fd = -1;
+    }
+    return 0;
+}
+
+/*
+    Sends the client's queued replies that may go, and the file they end
+    with, or as much as the socket takes right away. The rest is sent by
+    the dispatcher once epoll reports the socket writable, so a slow
+    reader never blocks a worker, or by the committer once the log lets
+    it. Returns 1 if a file is still to be sent: the client is then
+    parked, and its worker must leave it.
+*/
+int send_replies(struct Client *c) {
+    pthread_mutex_lock(&c->lock);
+    int status = 1;
+    if (!c->closed && !c->want_out) {
+        status = write_pending(c);
+        if (status == 1) {
+            watch_writable(c);
+        }
+    }
+    if (status < 0 || c->closed) {
+        // Reader is gone; closed when its EOF is read
+        c->out_len = c->out_sent = c->out_ready = 0;
+        c->held_head = c->held_len = 0;
+        if (c->send_fd >= 0) {
+            close(c->send_fd);
+            c->send_fd = -1;
+        }
+    }
+    c->parked = c->send_fd >= 0;
+    int parked = c->parked;
+    pthread_mutex_unlock(&c->lock);
+    return parked;
+}
+
+// Has epoll report when the client's socket takes more. Called with c->lock held.
+void watch_writable(struct Client *c) {
+    c->want_out = 1;
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = c;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/*
+    Sends pending replies and file; once the socket has taken all it may
+    for now, stops watching for writability, and once they are all out
+    hands a parked client back to the workers.
+*/
+int flush_client(struct Client *c) {
+    pthread_mutex_lock(&c->lock);
+    int status = write_pending(c);
+    if (status == 1 || status < 0) {
+        pthread_mutex_unlock(&c->lock);
+        return status < 0;
+    }
+    c->want_out = 0;
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    int action = status == 0 ? unpark(c) : 0;
+    pthread_mutex_unlock(&c->lock);
+    hand_back(c, action);
+    return 0;
+}
+
+/*
+    Ends the parking of a client whose file is all sent: returns 1 if it
+    has more requests to be served, -1 if it is unscheduled, its
+    reference to be dropped, and 0 if it wasn't parked. Called with
+    c->lock held.
+*/
+int unpark(struct Client *c) {
+    if (!c->parked) {
+        return 0;
+    }
+    c->parked = 0;
+    if (c->req_head < c->req_len) {
+        return 1;
+    }
+    c->req_head = c->req_len = 0;
+    c->scheduled = 0;
+    return -1;
+}
+
+// Carries out what unpark decided
+void hand_back(struct Client *c, int action) {
+    if (action > 0) {
+        while (work_push(&work, c) != 0) {
+            sched_yield();
+        }
+    }
+    if (action < 0) {
+        release_client(c);
+    }
+}
+
+// Server function: Stores the object name, and any uploaded content, or sends an error if the object already exists
+int server_put(struct Packet * p_rec, struct Packet * p, struct FileSys * fs, char * upload) {
+    if (sharded_put(&fs->objects, p_rec->message, p_rec->id, upload) == OBJECT_EXISTS) {
+        strcpy(p->type, "ERROR");
+        strcpy(p->message, "object already exists");
+        return 1;
+    }
+    return 0;
+}
+
+// Server function: Removes the object name or sends an error if deleting an object owned by another client
+int server_del(struct Packet * p_rec, struct Packet * p, struct FileSys * fs) {
+    int err = sharded_delete(&fs->objects, p_rec->message, p_rec->id);
+    if (err == OBJECT_NOT_OWNER) {
+        strcpy(p->type, "ERROR");
+        strcpy(p->message, "client not owner");
+        return 1;
+    }
+    if (err == OBJECT_MISSING) {
         strcpy(p->type, "ERROR");
         strcpy(p->message, "can't delete non-existing");
         return 1;
-    } 
-    else {
-        // Leaves hole that is not shown when printing file system
-        strcpy(fs->files[index_to_delete], ""); 
     }
     return 0;
 }
 
 // Server function: Sends the object name or sends an error if object does not exist
 int server_get(struct Packet * p_rec, struct Packet * p, struct FileSys * fs) {
-    for(int i = 0; i < fs->index; i++)  {
-        if (strcmp(fs->files[i], p_rec->message) == 0) {
-            return 0;
-        }
+    if (sharded_owner(&fs->objects, p_rec->message) != 0) {
+        return 0;
     }
     strcpy(p->type, "ERROR");
     strcpy(p->message, "object not found");
     return 1;
 }
 
-// Server function: Prints the objects and who owns them in a table 
+// Server function: Prints the objects and who owns them in a table, shard by shard
 void server_print(struct FileSys * fs) {
     printf("Object Table:\n");
-    for(int i = 0; i < fs->index; i++) {
-        if (strcmp(fs->files[i], "") != 0) {
-            printf("(owner: %d, name= %s)\n", fs->owners[i], fs->files[i]);
+    for (int s = 0; s < OBJECT_SHARDS; s++) {
+        struct ObjectShard *shard = &fs->objects.shards[s];
+        pthread_rwlock_rdlock(&shard->lock);
+        for (size_t i = 0; i < shard->table.num_objects; i++) {
+            struct Object *o = &shard->table.objects[i];
+            if (o->owner != 0) {
+                printf("(owner: %d, name= %s)\n", o->owner, objects_name(&shard->table, o));
+            }
         }
+        pthread_rwlock_unlock(&shard->lock);
     }
     printf("\n");
 }
-
-
@@ -0,0 +1,237 @@
+/*
+    Description: File store holding the contents of the server's objects
+                (see store.h).
+*/
+
+#include "store.h"
+#include "objects.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAXNAME 255
+#define STORE_MARKER ".fts-store"     // marks a directory as a store
+
+// A deleted object's file waiting for its DELETE to be synced
+struct Trash {
+    uint64_t lsn;
+    char *path;
+};
+
+static char store_dir[PATH_MAX / 2];
+static atomic_uint uploads, trashed;
+static pthread_mutex_t trash_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct Trash *trash;
+static size_t trash_len, trash_cap;
+
+// Path of name's file: the store directory, then name in hex
+static void store_path(const char *name, char *path) {
+    int len = snprintf(path, PATH_MAX, "%s/", store_dir);
+    for (const char *c = name; *c != '\0'; c++) {
+        len += snprintf(path + len, PATH_MAX - len, "%02x", (unsigned char) *c);
+    }
+}
+
+// Decodes a file name made by store_path back into the object name; returns 1 if it isn't one
+static int decode_name(const char *hex, size_t len, char *name) {
+    if (len == 0 || len % 2 != 0 || len / 2 > MAXNAME) {
+        return 1;
+    }
+    for (size_t i = 0; i < len; i += 2) {
+        unsigned int byte;
+        if (!isxdigit((unsigned char) hex[i]) || !isxdigit((unsigned char) hex[i + 1]) || sscanf(hex + i, "%2x", &byte) != 1) {
+            return 1;
+        }
+        name[i / 2] = byte;
+    }
+    name[len / 2] = '\0';
+    return 0;
+}
+
+// Is file one the store or its log makes (see wal.c), rather than someone else's
+static int is_store_file(const char *file) {
+    char name[MAXNAME + 1];
+    return decode_name(file, strlen(file), name) == 0 || strncmp(file, ".upload-", 8) == 0
+        || strncmp(file, ".trash-", 7) == 0 || strncmp(file, "wal.", 4) == 0 || !strcmp(file, "snapshot") || !strcmp(file, "snapshot.tmp");
+}
+
+/*
+    Creates dir if needed and marks it as a store. A directory without the
+    mark must be empty, so pointing -d at one holding other files can
+    never remove them. Without keep the store's files are removed, as the
+    table starts out empty too, but a store holding a log or snapshot is
+    refused rather than lose what they made durable; with keep only uploads
+    a crash cut short are removed. Anything else in the directory is left alone.
+*/
+int store_init(const char *dir, int keep) {
+    snprintf(store_dir, sizeof(store_dir), "%s", dir);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        perror("Error making store directory");
+        return 1;
+    }
+    char marker[PATH_MAX];
+    snprintf(marker, sizeof(marker), "%s/%s", dir, STORE_MARKER);
+    int marked = access(marker, F_OK) == 0;
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        perror("Error opening store directory");
+        return 1;
+    }
+    // Check every entry before removing any
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..") || !strcmp(entry->d_name, STORE_MARKER)) {
+            continue;
+        }
+        if (!marked) {
+            fprintf(stderr, "Not a store directory and not empty: %s\n", dir);
+            closedir(d);
+            return 1;
+        }
+        if (!keep && (strncmp(entry->d_name, "wal.", 4) == 0 || strncmp(entry->d_name, "snapshot", 8) == 0)) {
+            fprintf(stderr, "Store holds a log or snapshot, run it with -l group or each: %s\n", dir);
+            closedir(d);
+            return 1;
+        }
+    }
+    rewinddir(d);
+    while ((entry = readdir(d)) != NULL) {
+        if (is_store_file(entry->d_name) && (!keep || strncmp(entry->d_name, ".upload-", 8) == 0)) {
+            unlinkat(dirfd(d), entry->d_name, 0);
+        }
+    }
+    closedir(d);
+    int fd = open(marker, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("Error marking store directory");
+        return 1;
+    }
+    close(fd);
+    return 0;
+}
+
+/* Creates a temporary file for an upload; returns its fd, or -1 */
+int store_upload(char *tmp_path) {
+    snprintf(tmp_path, PATH_MAX, "%s/.upload-%u", store_dir, atomic_fetch_add(&uploads, 1));
+    return open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+/* Makes an upload's content durable before it is put */
+int store_sync(const char *tmp_path) {
+    int fd = open(tmp_path, O_WRONLY);
+    int err = fd < 0 || fdatasync(fd) != 0;
+    if (fd >= 0) {
+        close(fd);
+    }
+    return err;
+}
+
+/* Moves an FPUT's upload into place as name's file */
+void store_put(const char *name, const char *tmp_path) {
+    char path[PATH_MAX];
+    store_path(name, path);
+    rename(tmp_path, path);
+}
+
+/*
+    Drops name's file. If the DELETE is logged at lsn and not yet synced,
+    the file is only moved aside, out of the way of a new FPUT of name,
+    until store_collect learns it is: a crash before then brings the
+    object back, and store_recover its file.
+*/
+void store_delete(const char *name, uint64_t lsn) {
+    char path[PATH_MAX];
+    store_path(name, path);
+    if (lsn == 0) {
+        unlink(path);
+        return;
+    }
+    char trash_path[PATH_MAX];
+    int len = snprintf(trash_path, sizeof(trash_path), "%s/.trash-", store_dir);
+    len += snprintf(trash_path + len, sizeof(trash_path) - len, "%s-%u", path + strlen(store_dir) + 1, atomic_fetch_add(&trashed, 1));
+    if (rename(path, trash_path) != 0) {
+        return;
+    }
+    pthread_mutex_lock(&trash_lock);
+    if (trash_len == trash_cap) {
+        trash_cap = trash_cap ? trash_cap * 2 : 16;
+        trash = realloc(trash, trash_cap * sizeof(struct Trash));
+    }
+    trash[trash_len++] = (struct Trash) {lsn, strdup(trash_path)};
+    pthread_mutex_unlock(&trash_lock);
+}
+
+/* Removes the files of DELETEs logged up to lsn, now synced */
+void store_collect(uint64_t lsn) {
+    pthread_mutex_lock(&trash_lock);
+    size_t kept = 0;
+    for (size_t i = 0; i < trash_len; i++) {
+        if (trash[i].lsn <= lsn) {
+            unlink(trash[i].path);
+            free(trash[i].path);
+        } else {
+            trash[kept++] = trash[i];
+        }
+    }
+    trash_len = kept;
+    pthread_mutex_unlock(&trash_lock);
+}
+
+/*
+    Makes the files agree with the table recovered from the log: puts
+    back the file of an object whose DELETE never became durable and
+    removes every file no object with data owns, like the upload of an
+    FPUT that never did.
+*/
+void store_recover(struct ShardedObjects *s) {
+    DIR *d = opendir(store_dir);
+    if (d == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    char name[MAXNAME + 1], path[PATH_MAX];
+    for (int pass = 0; pass < 2; pass++) {
+        rewinddir(d);
+        while ((entry = readdir(d)) != NULL) {
+            const char *file = entry->d_name;
+            if (pass == 0 && strncmp(file, ".trash-", 7) == 0) {
+                const char *end = strrchr(file, '-');
+                if (decode_name(file + 7, end - (file + 7), name) == 0 && sharded_has_data(s, name)) {
+                    store_path(name, path);
+                    if (access(path, F_OK) != 0 && renameat(dirfd(d), file, AT_FDCWD, path) == 0) {
+                        continue;
+                    }
+                }
+                unlinkat(dirfd(d), file, 0);
+            }
+            else if (pass == 1 && decode_name(file, strlen(file), name) == 0 && !sharded_has_data(s, name)) {
+                unlinkat(dirfd(d), file, 0);
+            }
+        }
+    }
+    closedir(d);
+}
+
+/*
+    Opens name's file for reading and sets *size. An object stored
+    without content has no file: returns -1 with *size 0.
+*/
+int store_open(const char *name, off_t *size) {
+    char path[PATH_MAX];
+    store_path(name, path);
+    *size = 0;
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0) {
+        *size = st.st_size;
+    }
+    return fd;
+}
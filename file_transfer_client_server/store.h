@@ -0,0 +1,28 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Object contents, one file per object in the store directory, named by
+// the object name in hex so any name is a safe file name. An upload goes
+// to a temporary file that a successful FPUT renames into place; an
+// object without a file is empty. Renames and removals happen from the
+// object table's hook, under its shard lock, so they are ordered like
+// the FPUTs and DELETEs themselves. The log of the table shares the
+// directory (see wal.h). The directory is marked as a store when first
+// used, and one that holds other files without the mark is refused.
+
+struct ShardedObjects;
+
+int store_init(const char *dir, int keep);
+int store_upload(char *tmp_path);
+int store_sync(const char *tmp_path);
+void store_put(const char *name, const char *tmp_path);
+void store_delete(const char *name, uint64_t lsn);
+void store_collect(uint64_t lsn);
+void store_recover(struct ShardedObjects *s);
+int store_open(const char *name, off_t *size);
+
+#endif
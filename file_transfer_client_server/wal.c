@@ -0,0 +1,646 @@
+/*
+    Description: Write-ahead log and snapshots of the server's object
+                table (see wal.h).
+*/
+
+#include "wal.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC "FTSSNAP1"
+
+// A log record, followed by the name; crc covers everything after itself
+struct WalRecord {
+    uint32_t crc;
+    uint8_t op;
+    uint8_t has_data;
+    uint8_t name_len;
+    uint8_t pad;
+    int32_t owner;
+};
+
+// A snapshot is this header, then shard by shard the number of objects
+// (8 bytes) and per object its owner (4 bytes), has_data and name length
+// (a byte each) and name
+struct SnapshotHeader {
+    char magic[8];
+    uint64_t gen;           // logs from wal.<gen> on are replayed on top
+    uint64_t count;
+};
+
+static uint32_t crc_table[256];
+
+static void *commit_loop(void *arg);
+static void *snapshot_loop(void *arg);
+
+// CRC-32 (IEEE) of len bytes
+static uint32_t crc32(const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static double seconds_since(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Log files present in the directory, their numbers sorted; returns how many
+static size_t list_logs(struct Wal *w, uint64_t **gens) {
+    size_t count = 0, cap = 16;
+    *gens = malloc(cap * sizeof(uint64_t));
+    DIR *d = opendir(w->dir);
+    struct dirent *entry;
+    while (d != NULL && (entry = readdir(d)) != NULL) {
+        char *end;
+        if (strncmp(entry->d_name, "wal.", 4) != 0) {
+            continue;
+        }
+        uint64_t gen = strtoull(entry->d_name + 4, &end, 10);
+        if (*end != '\0' || end == entry->d_name + 4) {
+            continue;
+        }
+        if (count == cap) {
+            cap *= 2;
+            *gens = realloc(*gens, cap * sizeof(uint64_t));
+        }
+        size_t i = count++;
+        while (i > 0 && (*gens)[i - 1] > gen) {
+            (*gens)[i] = (*gens)[i - 1];
+            i--;
+        }
+        (*gens)[i] = gen;
+    }
+    if (d != NULL) {
+        closedir(d);
+    }
+    return count;
+}
+
+static void log_path(struct Wal *w, uint64_t gen, char *path) {
+    snprintf(path, PATH_MAX, "%s/wal.%llu", w->dir, (unsigned long long) gen);
+}
+
+// Creates log file gen and makes its name durable; returns its fd, or -1
+static int open_log(struct Wal *w, uint64_t gen) {
+    char path[PATH_MAX];
+    log_path(w, gen, path);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0 || fsync(w->dir_fd) != 0) {
+        perror("Error making log file");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// Applies a logged change to the table, which has no hook yet
+static void apply(struct ShardedObjects *s, int op, const char *name, int owner, int has_data) {
+    if (op == BATCH_PUT) {
+        // Any arg marks the object as put with data
+        sharded_put(s, name, owner, has_data ? (void *) name : NULL);
+    } else {
+        sharded_delete(s, name, owner);
+    }
+}
+
+/*
+    Loads the snapshot, mapped rather than read, straight into each
+    shard's table: nobody shares them yet, and the names are known to be
+    distinct and to belong to the shard. Returns the first log it doesn't
+    cover, 0 if there is no snapshot, or -1 if it is unreadable.
+*/
+static int64_t load_snapshot(struct Wal *w) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/snapshot", w->dir);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    struct stat st;
+    struct SnapshotHeader h;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(h)) {
+        close(fd);
+        return -1;
+    }
+    const char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    madvise((void *) data, st.st_size, MADV_SEQUENTIAL);
+    memcpy(&h, data, sizeof(h));
+    size_t pos = sizeof(h), size = st.st_size, count = 0;
+    int ok = memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) == 0;
+    for (int k = 0; k < OBJECT_SHARDS && ok; k++) {
+        uint64_t shard_count;
+        if (pos + 8 > size) {
+            ok = 0;
+            break;
+        }
+        memcpy(&shard_count, data + pos, 8);
+        pos += 8;
+        struct ObjectTable *t = &w->objects->shards[k].table;
+        objects_reserve(t, shard_count);
+        for (uint64_t i = 0; i < shard_count; i++) {
+            int32_t owner;
+            size_t len = pos + 6 <= size ? (unsigned char) data[pos + 5] : 0;
+            if (len == 0 || pos + 6 + len > size) {
+                ok = 0;
+                break;
+            }
+            memcpy(&owner, data + pos, 4);
+            char name[256];
+            memcpy(name, data + pos + 6, len);
+            name[len] = '\0';
+            objects_put(t, name, owner);
+            // objects_put appends the new object
+            t->objects[t->num_objects - 1].has_data = data[pos + 4];
+            pos += 6 + len;
+            count++;
+        }
+    }
+    munmap((void *) data, size);
+    if (!ok || count != h.count) {
+        return -1;
+    }
+    w->snapshot_objects = count;
+    return h.gen;
+}
+
+/*
+    Replays log gen onto the table. A record that is cut short or fails
+    its checksum was never synced, so it and anything after it are
+    dropped from the file.
+*/
+static void replay_log(struct Wal *w, uint64_t gen) {
+    char path[PATH_MAX];
+    log_path(w, gen, path);
+    int fd = open(path, O_RDWR);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        if (fd >= 0) {
+            // Nothing was logged before a restart
+            close(fd);
+            unlink(path);
+        }
+        return;
+    }
+    size_t size = st.st_size, pos = 0;
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+    madvise((void *) data, size, MADV_SEQUENTIAL);
+    while (pos + sizeof(struct WalRecord) <= size) {
+        struct WalRecord r;
+        memcpy(&r, data + pos, sizeof(r));
+        size_t len = sizeof(r) + r.name_len;
+        if (r.name_len == 0 || pos + len > size || crc32(data + pos + 4, len - 4) != r.crc) {
+            break;
+        }
+        char name[256];
+        memcpy(name, data + pos + sizeof(r), r.name_len);
+        name[r.name_len] = '\0';
+        apply(w->objects, r.op, name, r.owner, r.has_data);
+        pos += len;
+        w->log_records++;
+    }
+    munmap((void *) data, size);
+    if (pos < size) {
+        ftruncate(fd, pos);
+        fsync(fd);
+    }
+    close(fd);
+}
+
+/*
+    Opens the log in dir, which must exist, after rebuilding the table s
+    from the snapshot and the logs after it, and starts the committer and
+    snapshotter threads. A new log file is started, so a torn end of the
+    last one is never appended to. WAL_OFF leaves dir and s alone.
+    synced, if not NULL, is called by the committer after every sync.
+    Returns 0, or 1 if the log can't be recovered or opened.
+*/
+int wal_open(struct Wal *w, const char *dir, int mode, size_t snapshot_bytes, struct ShardedObjects *s, void (*synced)(uint64_t)) {
+    memset(w, 0, sizeof(*w));
+    w->mode = mode;
+    w->fd = -1;
+    w->dir_fd = -1;
+    if (mode == WAL_OFF) {
+        return 0;
+    }
+    crc_init();
+    snprintf(w->dir, sizeof(w->dir), "%s", dir);
+    w->snapshot_bytes = snapshot_bytes;
+    w->objects = s;
+    w->synced = synced;
+    w->dir_fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (w->dir_fd < 0) {
+        perror("Error opening log directory");
+        return 1;
+    }
+
+    int64_t first = load_snapshot(w);
+    if (first < 0) {
+        fprintf(stderr, "Error loading snapshot in %s\n", dir);
+        return 1;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/snapshot.tmp", dir);
+    unlink(path);
+    uint64_t *gens;
+    size_t count = list_logs(w, &gens);
+    w->gen = first;
+    for (size_t i = 0; i < count; i++) {
+        if (gens[i] < (uint64_t) first) {
+            // Covered by the snapshot; left over from a crash after writing it
+            log_path(w, gens[i], path);
+            unlink(path);
+            continue;
+        }
+        replay_log(w, gens[i]);
+        w->gen = gens[i];
+    }
+    free(gens);
+    w->fd = open_log(w, ++w->gen);
+    if (w->fd < 0) {
+        return 1;
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->wake, NULL);
+    pthread_cond_init(&w->snap_wake, NULL);
+    pthread_cond_init(&w->done, NULL);
+    pthread_create(&w->committer, NULL, commit_loop, w);
+    pthread_create(&w->snapshotter, NULL, snapshot_loop, w);
+    return 0;
+}
+
+// Writes records to the log and syncs them; the directory first if a file was renamed into it
+static void sync_records(struct Wal *w, const char *buf, size_t len, int dir_dirty) {
+    if ((dir_dirty && fsync(w->dir_fd) != 0) || write_all(w->fd, buf, len) != 0 || fdatasync(w->fd) != 0) {
+        // Whatever isn't durable now can't be promised to clients
+        perror("Error writing log");
+        exit(1);
+    }
+}
+
+/*
+    Appends a change, made with its shard write locked. A PUT with data
+    must have renamed the object's file into the directory already.
+    Only buffers the record, in either mode; the committer writes it.
+    Returns its lsn: its reply can be sent once wal_durable reaches it.
+*/
+uint64_t wal_append(struct Wal *w, int op, const char *name, int owner, int has_data) {
+    char rec[sizeof(struct WalRecord) + 256];
+    struct WalRecord r = {0, op, has_data, 0, 0, owner};
+    size_t name_len = strlen(name);
+    r.name_len = name_len;
+    memcpy(rec, &r, sizeof(r));
+    memcpy(rec + sizeof(r), name, name_len);
+    size_t len = sizeof(r) + name_len;
+    r.crc = crc32(rec + 4, len - 4);
+    memcpy(rec, &r.crc, sizeof(r.crc));
+
+    pthread_mutex_lock(&w->lock);
+    w->appended += len;
+    w->log_bytes += len;
+    uint64_t lsn = w->appended;
+    if (w->len + len > w->buf_cap) {
+        w->buf_cap = (w->len + len) * 2;
+        w->buf = realloc(w->buf, w->buf_cap);
+    }
+    memcpy(w->buf + w->len, rec, len);
+    w->len += len;
+    w->dir_dirty |= op == BATCH_PUT && has_data;
+    if (w->len == len) {
+        // Otherwise the committer has yet to take the earlier records
+        pthread_cond_signal(&w->wake);
+    }
+    if (w->snapshot_bytes > 0 && w->log_bytes >= w->snapshot_bytes && w->snapshot_gen == 0 && !w->rotate) {
+        w->rotate = 1;
+        pthread_cond_signal(&w->wake);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return lsn;
+}
+
+uint64_t wal_durable(struct Wal *w) {
+    return atomic_load(&w->durable);
+}
+
+/* lsn of the last record; a change visible in the table has one up to here */
+uint64_t wal_appended(struct Wal *w) {
+    return atomic_load(&w->appended);
+}
+
+/* Calls waiter->fn once the log is synced up to waiter->lsn */
+void wal_notify(struct Wal *w, struct WalWaiter *waiter) {
+    pthread_mutex_lock(&w->lock);
+    if (waiter->lsn > atomic_load(&w->durable)) {
+        waiter->next = w->waiters;
+        w->waiters = waiter;
+        pthread_mutex_unlock(&w->lock);
+        return;
+    }
+    pthread_mutex_unlock(&w->lock);
+    waiter->fn(waiter->arg);
+}
+
+/* Waits until everything appended so far is synced and its waiters told */
+void wal_flush(struct Wal *w) {
+    if (w->mode == WAL_OFF) {
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    uint64_t target = w->appended;
+    while (w->notified < target) {
+        pthread_cond_wait(&w->done, &w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* Starts a new log file and a snapshot, unless one is being taken */
+void wal_snapshot(struct Wal *w) {
+    if (w->mode == WAL_OFF) {
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    if (w->snapshot_gen == 0) {
+        w->rotate = 1;
+        pthread_cond_signal(&w->wake);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+/*
+    Switches appends to a new log file, once what went to the old one is
+    synced, and has the snapshotter dump the table. Everything in the old
+    logs is in the table by now. Called with w->lock held.
+*/
+static void rotate_log(struct Wal *w) {
+    w->rotate = 0;
+    if (w->snapshot_gen != 0) {
+        return;
+    }
+    int fd = open_log(w, w->gen + 1);
+    if (fd < 0) {
+        return;
+    }
+    close(w->fd);
+    w->fd = fd;
+    w->gen++;
+    w->log_bytes = w->len;
+    w->snapshot_gen = w->gen;
+    pthread_cond_signal(&w->snap_wake);
+}
+
+/*
+    Marks the log synced up to upto and tells the waiters that covers.
+    Called with w->lock held, which is dropped while they are told.
+*/
+static void tell_synced(struct Wal *w, uint64_t upto) {
+    atomic_store(&w->durable, upto);
+    struct WalWaiter *ready = NULL, **link = &w->waiters;
+    while (*link != NULL) {
+        struct WalWaiter *waiter = *link;
+        if (waiter->lsn <= upto) {
+            *link = waiter->next;
+            waiter->next = ready;
+            ready = waiter;
+        } else {
+            link = &waiter->next;
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    if (w->synced != NULL) {
+        w->synced(upto);
+    }
+    while (ready != NULL) {
+        // A waiter may be reused as soon as it is told
+        struct WalWaiter *next = ready->next;
+        ready->fn(ready->arg);
+        ready = next;
+    }
+    pthread_mutex_lock(&w->lock);
+    w->notified = upto;
+    pthread_cond_broadcast(&w->done);
+}
+
+/*
+    Committer thread: writes and syncs whatever has been appended since
+    its last sync, however many requests that covers, then tells their
+    waiters. WAL_EACH gives every record a sync of its own instead. Appends
+    go on into the other buffer meanwhile, so no shard lock is ever held
+    across a sync.
+*/
+static void *commit_loop(void *arg) {
+    struct Wal *w = arg;
+    pthread_mutex_lock(&w->lock);
+    while (1) {
+        if (w->len == 0 && !w->rotate) {
+            if (w->stop) {
+                break;
+            }
+            pthread_cond_wait(&w->wake, &w->lock);
+            continue;
+        }
+        char *buf = w->buf;
+        size_t len = w->len, cap = w->buf_cap;
+        uint64_t upto = w->appended;
+        int dir_dirty = w->dir_dirty;
+        w->buf = w->spare;
+        w->buf_cap = w->spare_cap;
+        w->spare = buf;
+        w->spare_cap = cap;
+        w->len = 0;
+        w->dir_dirty = 0;
+        pthread_mutex_unlock(&w->lock);
+
+        if (w->mode == WAL_EACH) {
+            // The first sync takes the directory along with the renames of all of them
+            for (size_t pos = 0; pos < len; ) {
+                struct WalRecord r;
+                memcpy(&r, buf + pos, sizeof(r));
+                size_t rec_len = sizeof(r) + r.name_len;
+                sync_records(w, buf + pos, rec_len, dir_dirty && pos == 0);
+                pos += rec_len;
+                pthread_mutex_lock(&w->lock);
+                tell_synced(w, upto - len + pos);
+                pthread_mutex_unlock(&w->lock);
+            }
+            pthread_mutex_lock(&w->lock);
+            if (w->rotate) {
+                rotate_log(w);
+            }
+            continue;
+        }
+        if (len > 0) {
+            sync_records(w, buf, len, dir_dirty);
+        }
+        pthread_mutex_lock(&w->lock);
+        if (w->rotate) {
+            rotate_log(w);
+        }
+        if (len > 0) {
+            tell_synced(w, upto);
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/*
+    Dumps the table to a new snapshot covering every log before gen,
+    shard by shard under read locks, then replaces the old snapshot with
+    it and removes those logs.
+*/
+static void write_snapshot(struct Wal *w, uint64_t gen) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char tmp_path[PATH_MAX], path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s/snapshot.tmp", w->dir);
+    snprintf(path, sizeof(path), "%s/snapshot", w->dir);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Error making snapshot");
+        return;
+    }
+    struct SnapshotHeader h = {SNAPSHOT_MAGIC, gen, 0};
+    int failed = write_all(fd, (char *) &h, sizeof(h));
+    char *buf = NULL;
+    size_t cap = 0;
+    for (int k = 0; k < OBJECT_SHARDS && !failed; k++) {
+        struct ObjectShard *shard = &w->objects->shards[k];
+        size_t len = 0;
+        pthread_rwlock_rdlock(&shard->lock);
+        struct ObjectTable *t = &shard->table;
+        if (cap < 8 + t->count * 6 + t->arena_len) {
+            cap = 8 + t->count * 6 + t->arena_len;
+            buf = realloc(buf, cap);
+        }
+        uint64_t shard_count = t->count;
+        memcpy(buf, &shard_count, 8);
+        len = 8;
+        for (size_t i = 0; i < t->num_objects; i++) {
+            struct Object *o = &t->objects[i];
+            if (o->owner == 0) {
+                continue;
+            }
+            int32_t owner = o->owner;
+            memcpy(buf + len, &owner, 4);
+            buf[len + 4] = o->has_data;
+            buf[len + 5] = o->name_len;
+            memcpy(buf + len + 6, t->arena + o->name_off, o->name_len);
+            len += 6 + o->name_len;
+        }
+        h.count += shard_count;
+        pthread_rwlock_unlock(&shard->lock);
+        failed = write_all(fd, buf, len);
+    }
+    free(buf);
+    failed = failed || pwrite(fd, &h, sizeof(h), 0) != sizeof(h) || fdatasync(fd) != 0;
+    close(fd);
+    if (failed || rename(tmp_path, path) != 0 || fsync(w->dir_fd) != 0) {
+        perror("Error writing snapshot");
+        unlink(tmp_path);
+        return;
+    }
+
+    uint64_t *gens;
+    size_t count = list_logs(w, &gens);
+    for (size_t i = 0; i < count && gens[i] < gen; i++) {
+        log_path(w, gens[i], path);
+        unlink(path);
+    }
+    free(gens);
+    printf("Snapshot of %llu objects taken in %.2f s\n", (unsigned long long) h.count, seconds_since(&start));
+    fflush(stdout);
+}
+
+// Snapshotter thread: takes the snapshots rotate_log asks for
+static void *snapshot_loop(void *arg) {
+    struct Wal *w = arg;
+    pthread_mutex_lock(&w->lock);
+    while (1) {
+        if (w->snapshot_gen == 0) {
+            if (w->stop) {
+                break;
+            }
+            pthread_cond_wait(&w->snap_wake, &w->lock);
+            continue;
+        }
+        uint64_t gen = w->snapshot_gen;
+        pthread_mutex_unlock(&w->lock);
+        write_snapshot(w, gen);
+        pthread_mutex_lock(&w->lock);
+        w->snapshot_gen = 0;
+        pthread_cond_broadcast(&w->done);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/* Syncs what is left, lets a snapshot being taken finish, and stops the threads */
+void wal_close(struct Wal *w) {
+    if (w->mode == WAL_OFF) {
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_signal(&w->wake);
+    pthread_cond_signal(&w->snap_wake);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->committer, NULL);
+    pthread_join(w->snapshotter, NULL);
+    close(w->fd);
+    close(w->dir_fd);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->wake);
+    pthread_cond_destroy(&w->snap_wake);
+    pthread_cond_destroy(&w->done);
+    free(w->buf);
+    free(w->spare);
+}
@@ -0,0 +1,79 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include "objects.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// How changes to the object table reach the disk
+#define WAL_OFF 0           // not at all; the server starts empty
+#define WAL_GROUP 1         // a committer thread syncs everything appended since its last sync at once
+#define WAL_EACH 2          // the committer writes and syncs every change on its own
+
+// Someone waiting for the log to be synced up to lsn. fn(arg) is called
+// once it is, by the committer thread, or at once if it already is.
+struct WalWaiter {
+    uint64_t lsn;
+    void (*fn)(void *arg);
+    void *arg;
+    struct WalWaiter *next;
+};
+
+// Write-ahead log of the object table, kept in the store directory next
+// to the contents. Every successful PUT and DELETE appends a record,
+// under its shard lock, so records of a name are in the order the table
+// saw them. A position in the log (lsn) counts every byte ever appended;
+// replies to changes are held back until the log is synced past them,
+// and many clients' changes share one fdatasync. So are replies that
+// report the table, as of wal_appended when it was read, lest a GET
+// tell of a PUT a crash then loses. Once the log file has
+// grown to snapshot_bytes a new one is started and the table is dumped
+// to a snapshot in the background, after which older logs are removed.
+// The snapshot may already include changes of the new log; replaying a
+// change on top of its own effect is harmless, since only changes that
+// succeeded are logged and a PUT of an existing name or a DELETE by
+// someone else doesn't apply.
+struct Wal {
+    int mode;
+    char dir[PATH_MAX / 2];
+    int dir_fd;
+    int fd;                     // current log file
+    uint64_t gen;               // its number: wal.<gen>
+    size_t snapshot_bytes;      // 0 never snapshots
+    struct ShardedObjects *objects;
+    void (*synced)(uint64_t lsn);   // told after every sync
+
+    pthread_mutex_t lock;       // guards the fields below
+    pthread_cond_t wake;        // the committer has work
+    pthread_cond_t snap_wake;   // the snapshotter has work
+    pthread_cond_t done;        // notified moved, or a snapshot finished
+    char *buf, *spare;          // records not written yet, and the buffer being written
+    size_t len, buf_cap, spare_cap;
+    _Atomic uint64_t appended;  // lsn of the last record
+    _Atomic uint64_t durable;   // synced up to here
+    uint64_t notified;          // waiters up to here have been told
+    size_t log_bytes;           // in the current log file
+    int dir_dirty;              // a file was renamed into the directory
+    int rotate;                 // start a new log file and snapshot
+    uint64_t snapshot_gen;      // first log the snapshot being taken doesn't cover, 0 if none
+    int stop;
+    struct WalWaiter *waiters;
+    pthread_t committer, snapshotter;
+
+    // What wal_open recovered
+    size_t snapshot_objects, log_records;
+};
+
+int wal_open(struct Wal *w, const char *dir, int mode, size_t snapshot_bytes, struct ShardedObjects *s, void (*synced)(uint64_t));
+uint64_t wal_append(struct Wal *w, int op, const char *name, int owner, int has_data);
+uint64_t wal_durable(struct Wal *w);
+uint64_t wal_appended(struct Wal *w);
+void wal_notify(struct Wal *w, struct WalWaiter *waiter);
+void wal_flush(struct Wal *w);
+void wal_snapshot(struct Wal *w);
+void wal_close(struct Wal *w);
+
+#endif
@@ -0,0 +1,94 @@
+/*
+    Description: Lock-free MPMC work queue (see work_queue.h).
+*/
+
+#include "work_queue.h"
+#include <sched.h>
+#include <stdlib.h>
+
+static void *take(struct WorkQueue *q);
+
+// Capacity is rounded up to a power of two
+void work_init(struct WorkQueue *q, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+    q->cells = malloc(size * sizeof(struct WorkCell));
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&q->cells[i].seq, i);
+    }
+    q->mask = size - 1;
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+    sem_init(&q->items, 0, 0);
+}
+
+void work_free(struct WorkQueue *q) {
+    sem_destroy(&q->items);
+    free(q->cells);
+}
+
+/* Adds item; returns 1 without adding it if the queue is full */
+int work_push(struct WorkQueue *q, void *item) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    struct WorkCell *cell;
+    while (1) {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        long diff = (long) seq - (long) pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            return 1;
+        }
+        else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+    cell->item = item;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    sem_post(&q->items);
+    return 0;
+}
+
+/* Removes the oldest item, sleeping until there is one */
+void *work_pop(struct WorkQueue *q) {
+    while (sem_wait(&q->items) != 0) {
+        // Interrupted by a signal
+    }
+    return take(q);
+}
+
+/* Removes the oldest item, or returns NULL at once if there is none */
+void *work_try_pop(struct WorkQueue *q) {
+    return sem_trywait(&q->items) == 0 ? take(q) : NULL;
+}
+
+/* Removes the oldest item once the semaphore has promised one */
+static void *take(struct WorkQueue *q) {
+    // Its push may still be finishing
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    while (1) {
+        struct WorkCell *cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        long diff = (long) seq - (long) (pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                void *item = cell->item;
+                atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+                return item;
+            }
+        }
+        else if (diff < 0) {
+            sched_yield();
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+        else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+// One slot of the queue; seq says whose turn it is to use the slot
+struct WorkCell {
+    atomic_size_t seq;
+    void *item;
+};
+
+// Bounded lock-free multi-producer multi-consumer queue of pointers
+// (Vyukov's array queue). Producers and consumers each claim a slot with
+// one compare-and-swap on their own end. Consumers that find it empty
+// sleep on a semaphore counting the items, which costs no system call
+// while nobody is sleeping.
+struct WorkQueue {
+    struct WorkCell *cells;
+    size_t mask;
+    _Alignas(64) atomic_size_t tail;    // next slot to push to
+    _Alignas(64) atomic_size_t head;    // next slot to pop from
+    _Alignas(64) sem_t items;
+};
+
+void work_init(struct WorkQueue *q, size_t capacity);
+void work_free(struct WorkQueue *q);
+int work_push(struct WorkQueue *q, void *item);
+void *work_pop(struct WorkQueue *q);
+void *work_try_pop(struct WorkQueue *q);
+
+#endif
@@ -0,0 +1,113 @@
+/*
+	Lease benchmark: zero-duration iterations with one thread per task,
+	taking the mutex the way doTask does, with and without leases.
+	Usage: ./resource_bench lease inputFile [iterations]
+*/
+
+#include "../include/task_manager.h"
+
+
+// Shared by the threads of one run
+struct LeaseRun {
+	TaskManager *manager;
+	int iterations;
+};
+
+struct LeaseArg {
+	LeaseRun *run;
+	int taskNum;
+};
+
+/*
+	Runs the task's iterations with no busy or idle time: acquire, release
+	and count each one, or on a lease count it and renew, in one critical
+	section only when the lease may end.
+*/
+static void *leaseTask(void *arg) {
+	LeaseRun *run = ((LeaseArg *) arg)->run;
+	TaskManager &manager = *run->manager;
+	Task &task = manager.tasks[((LeaseArg *) arg)->taskNum];
+	bool leased = false;
+
+	while (task.iter < run->iterations) {
+		if (!leased) {
+			manager.lockMutex();
+			manager.acquireResources(task);
+			manager.endWait(task);
+			task.status = STATUS_RUN;
+			pthread_mutex_unlock(&manager.mutex);
+		}
+		if (manager.canLease(task)) {
+			task.iter++;
+			leased = task.iter < run->iterations && manager.renewLeaseUnlocked(task);
+			if (leased) {
+				continue;
+			}
+			manager.lockMutex();
+			leased = task.iter < run->iterations && manager.renewLease(task);
+			if (!leased) {
+				manager.releaseResources(task);
+				task.status = STATUS_IDLE;
+			}
+			pthread_mutex_unlock(&manager.mutex);
+			continue;
+		}
+		manager.lockMutex();
+		manager.releaseResources(task);
+		task.status = STATUS_IDLE;
+		pthread_mutex_unlock(&manager.mutex);
+		manager.lockMutex();
+		task.iter++;
+		pthread_mutex_unlock(&manager.mutex);
+	}
+	return nullptr;
+}
+
+/* Runs every task for iterations iterations; returns iterations per second */
+static double runLeases(const char *inputFile, int iterations, int leaseIterations, bool leaseYields) {
+	unique_ptr<TaskManager> manager(new TaskManager());
+	manager->leaseIterations = leaseIterations;
+	manager->leaseYields = leaseYields;
+	if (manager->parseInput(inputFile) != 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	LeaseRun run = {manager.get(), iterations};
+	vector<LeaseArg> args(manager->getNumTasks());
+	vector<pthread_t> tids(manager->getNumTasks());
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < manager->getNumTasks(); i++) {
+		args[i] = {&run, i};
+		pthread_create(&tids[i], nullptr, leaseTask, &args[i]);
+	}
+	for (int i = 0; i < manager->getNumTasks(); i++) {
+		pthread_join(tids[i], nullptr);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (!manager->resourcesAreConsistent()) {
+		cerr << "Resources not all returned after leasing" << endl;
+		exit(EXIT_FAILURE);
+	}
+	return (double) iterations * manager->getNumTasks() / (manager->getDuration(start, end) / 1000);
+}
+
+int benchLease(const char *inputFile, int iterations) {
+	struct Lease {
+		int iterations;
+		bool yields;
+	} leases[] = {{1, false}, {8, false}, {64, false}, {1024, false}, {64, true}};
+
+	cout << "Leases: " << inputFile << ", " << iterations << " zero-time iterations per task" << endl;
+	double baseline = 0;
+	for (const Lease &lease : leases) {
+		double rate = runLeases(inputFile, iterations, lease.iterations, lease.yields);
+		if (baseline == 0) {
+			baseline = rate;
+		}
+		cout << "\t" << (lease.iterations == 1 ? "no lease" : "-L " + to_string(lease.iterations)) << (lease.yields ? " -Y" : "")
+			<< ":\t" << (long) rate << " iter/s (x" << rate / baseline << ")" << endl;
+	}
+	return 0;
+}
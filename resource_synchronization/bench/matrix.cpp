@@ -0,0 +1,299 @@
+/*
+	Benchmark matrix: every input file x locking backend x thread count,
+	each run for a fixed time and written to outBase.json and outBase.csv
+	so results from different builds can be diffed.
+	Usage: ./resource_bench matrix outBase msPerScenario inputFile...
+*/
+
+#include "../include/task_manager.h"
+#include "../include/histogram.h"
+#include <sys/resource.h>
+#include <unistd.h>
+
+
+// One cell of the matrix and what it measured
+struct Scenario {
+	string file;
+	const char *backend;
+	LockMode lockMode;
+	int threads;
+
+	bool skipped = false;
+	double seconds = 0;
+	long ops = 0;
+	Histogram wait;		// ns from asking for resources to holding them
+	Histogram release;	// ns the release itself took; tasks hold resources for no time
+	long mutexLocks = 0;
+	long mutexContended = 0;	// manager mutex was already taken
+	double mutexWaitNs = 0;
+	Histogram mutexHold;	// ns the manager mutex was held, per critical section (global)
+	long lockHolds = 0;	// holds of resource locks (fine)
+	double lockHoldNs = 0;
+	long contextSwitches = 0;
+	long rssKb = 0;
+};
+
+// Shared by the threads of one scenario
+struct MatrixRun {
+	TaskManager *manager;
+	int threads;
+	atomic<bool> stop{false};
+	pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+	Scenario *scenario;
+};
+
+struct MatrixArg {
+	MatrixRun *run;
+	int thread;
+};
+
+static int64_t nowNs() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (int64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/* Current resident set size in KB */
+static long currentRssKb() {
+	long pages = 0, resident = 0;
+	FILE *statm = fopen("/proc/self/statm", "r");
+	if (statm != nullptr) {
+		if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+			resident = 0;
+		}
+		fclose(statm);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static long contextSwitches() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+/*
+	Takes the manager mutex, counting whether it was contended and how long
+	it took to get.
+*/
+static void lockManager(TaskManager &manager, long &locks, long &contended, double &waitNs) {
+	locks++;
+	if (pthread_mutex_trylock(&manager.mutex) == 0) {
+		return;
+	}
+	contended++;
+	int64_t start = nowNs();
+	pthread_mutex_lock(&manager.mutex);
+	waitNs += nowNs() - start;
+}
+
+/*
+	Cycles through the tasks this thread owns (every threads-th task),
+	acquiring and releasing each with no hold time, until stopped. Only one
+	thread ever uses a task, and no thread holds two tasks' resources.
+*/
+static void *matrixThread(void *arg) {
+	MatrixRun *run = ((MatrixArg *) arg)->run;
+	int thread = ((MatrixArg *) arg)->thread;
+	TaskManager &manager = *run->manager;
+	Histogram wait, release, mutexHold;
+	long ops = 0, locks = 0, contended = 0;
+	double mutexWaitNs = 0;
+
+	for (int t = thread; !run->stop; t = t + run->threads < manager.getNumTasks() ? t + run->threads : thread) {
+		Task &task = manager.tasks[t];
+		int64_t asked = nowNs();
+		if (manager.lockMode == LOCK_FINE) {
+			manager.acquireResourcesFine(task);
+		}
+		else if (manager.lockMode == LOCK_ATOMIC) {
+			manager.acquireResourcesAtomic(task);
+		}
+		else {
+			lockManager(manager, locks, contended, mutexWaitNs);
+			int64_t locked = nowNs();
+			task.status = STATUS_RUN;
+			for (uint phase = 0; phase < task.phases.size(); phase++) {
+				manager.acquireResources(task);
+			}
+			// A wait gives the mutex up meanwhile, so only count holds that never waited
+			if (task.status != STATUS_WAIT) {
+				mutexHold.record(nowNs() - locked);
+			}
+			pthread_mutex_unlock(&manager.mutex);
+		}
+		int64_t granted = nowNs();
+
+		if (manager.lockMode == LOCK_FINE) {
+			manager.releaseResourcesFine(task);
+		}
+		else if (manager.lockMode == LOCK_ATOMIC) {
+			manager.releaseResourcesAtomic(task);
+		}
+		else {
+			lockManager(manager, locks, contended, mutexWaitNs);
+			int64_t locked = nowNs();
+			manager.releaseResources(task);
+			mutexHold.record(nowNs() - locked);
+			pthread_mutex_unlock(&manager.mutex);
+		}
+		wait.record(granted - asked);
+		release.record(nowNs() - granted);
+		ops++;
+	}
+
+	pthread_mutex_lock(&run->statsMutex);
+	Scenario &scenario = *run->scenario;
+	scenario.wait.merge(wait);
+	scenario.release.merge(release);
+	scenario.mutexHold.merge(mutexHold);
+	scenario.ops += ops;
+	scenario.mutexLocks += locks;
+	scenario.mutexContended += contended;
+	scenario.mutexWaitNs += mutexWaitNs;
+	pthread_mutex_unlock(&run->statsMutex);
+	return nullptr;
+}
+
+/* Runs one scenario for ms milliseconds and fills in its results */
+static void runScenario(Scenario &scenario, int ms) {
+	unique_ptr<TaskManager> manager(new TaskManager());
+	manager->lockMode = scenario.lockMode;
+	manager->timeLockHolds = scenario.lockMode == LOCK_FINE;
+	if (manager->parseInput(scenario.file.c_str()) != 0) {
+		exit(EXIT_FAILURE);
+	}
+	if (scenario.threads > manager->getNumTasks() || (manager->hasPhasedTasks() && scenario.lockMode != LOCK_GLOBAL)) {
+		scenario.skipped = true;
+		return;
+	}
+	// Phased tasks can only acquire through the wait queue, with Banker's
+	// keeping their phases from deadlocking; other files run without it
+	if (manager->hasPhasedTasks()) {
+		manager->bankers = true;
+		manager->initBankers();
+	}
+
+	MatrixRun run;
+	run.manager = manager.get();
+	run.threads = scenario.threads;
+	run.scenario = &scenario;
+	vector<MatrixArg> args(scenario.threads);
+	vector<pthread_t> tids(scenario.threads);
+
+	long switchesBefore = contextSwitches();
+	int64_t start = nowNs();
+	for (int i = 0; i < scenario.threads; i++) {
+		args[i] = {&run, i};
+		pthread_create(&tids[i], nullptr, matrixThread, &args[i]);
+	}
+	struct timespec duration = {ms / 1000, (ms % 1000) * 1000000L};
+	nanosleep(&duration, nullptr);
+	run.stop = true;
+	for (int i = 0; i < scenario.threads; i++) {
+		pthread_join(tids[i], nullptr);
+	}
+	scenario.seconds = (nowNs() - start) / 1E9;
+	scenario.contextSwitches = contextSwitches() - switchesBefore;
+	scenario.rssKb = currentRssKb();
+	scenario.lockHoldNs = manager->getLockHoldNs(scenario.lockHolds);
+
+	if (!manager->resourcesAreConsistent()) {
+		cerr << "Resources overcommitted in " << scenario.file << " (" << scenario.backend << ")" << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Quote a string for JSON; file names need nothing beyond quotes and backslashes */
+static string jsonString(const string &text) {
+	string quoted = "\"";
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			quoted += '\\';
+		}
+		quoted += c;
+	}
+	return quoted + "\"";
+}
+
+int benchMatrix(const char *outBase, int ms, const vector<string> &files) {
+	struct Backend {
+		const char *name;
+		LockMode lockMode;
+	} backends[] = {
+		{"global", LOCK_GLOBAL},
+		{"fine", LOCK_FINE},
+		{"atomic", LOCK_ATOMIC},
+	};
+	const int threadCounts[] = {1, 2, 4, 8};
+
+	vector<unique_ptr<Scenario>> scenarios;
+	for (const string &file : files) {
+		for (const Backend &backend : backends) {
+			for (int threads : threadCounts) {
+				unique_ptr<Scenario> scenario(new Scenario());
+				scenario->file = file;
+				scenario->backend = backend.name;
+				scenario->lockMode = backend.lockMode;
+				scenario->threads = threads;
+				runScenario(*scenario, ms);
+				if (!scenario->skipped) {
+					Scenario &s = *scenario;
+					cout << s.file << " " << s.backend << " x" << s.threads << ":\t" << (long) (s.ops / s.seconds) << " ops/s, wait p50/p99/p999 "
+						<< s.wait.percentile(50) / 1000.0 << "/" << s.wait.percentile(99) / 1000.0 << "/" << s.wait.percentile(99.9) / 1000.0 << " us";
+					if (s.mutexHold.getCount() > 0) {
+						cout << ", mutex hold p50/p99 " << s.mutexHold.percentile(50) / 1000.0 << "/" << s.mutexHold.percentile(99) / 1000.0 << " us";
+					}
+					if (s.lockHolds > 0) {
+						cout << ", resource lock hold mean " << s.lockHoldNs / s.lockHolds / 1000.0 << " us";
+					}
+					cout << endl;
+					scenarios.push_back(move(scenario));
+				}
+			}
+		}
+	}
+
+	string csvPath = string(outBase) + ".csv";
+	string jsonPath = string(outBase) + ".json";
+	ofstream csv(csvPath), json(jsonPath);
+	if (!csv.is_open() || !json.is_open()) {
+		cerr << "Failed to open " << csvPath << " or " << jsonPath << endl;
+		return EXIT_FAILURE;
+	}
+	const char *columns[] = {"file", "backend", "threads", "seconds", "ops", "ops_per_s",
+		"wait_p50_ns", "wait_p99_ns", "wait_p999_ns", "wait_max_ns", "wait_mean_ns",
+		"release_p50_ns", "release_p99_ns", "release_mean_ns",
+		"mutex_locks", "mutex_contended", "mutex_wait_ns",
+		"mutex_hold_p50_ns", "mutex_hold_p99_ns", "mutex_hold_mean_ns",
+		"resource_lock_holds", "resource_lock_hold_mean_ns",
+		"context_switches", "rss_kb"};
+	for (uint i = 0; i < sizeof(columns) / sizeof(columns[0]); i++) {
+		csv << (i > 0 ? "," : "") << columns[i];
+	}
+	csv << "\n";
+	json << "[\n";
+	for (uint n = 0; n < scenarios.size(); n++) {
+		const Scenario &s = *scenarios[n];
+		vector<string> values = {s.file, s.backend, to_string(s.threads), to_string(s.seconds), to_string(s.ops),
+			to_string(s.ops / s.seconds),
+			to_string(s.wait.percentile(50)), to_string(s.wait.percentile(99)), to_string(s.wait.percentile(99.9)),
+			to_string(s.wait.getMax()), to_string(s.wait.getMean()),
+			to_string(s.release.percentile(50)), to_string(s.release.percentile(99)), to_string(s.release.getMean()),
+			to_string(s.mutexLocks), to_string(s.mutexContended), to_string((long) s.mutexWaitNs),
+			to_string(s.mutexHold.percentile(50)), to_string(s.mutexHold.percentile(99)), to_string(s.mutexHold.getMean()),
+			to_string(s.lockHolds), to_string(s.lockHolds > 0 ? s.lockHoldNs / s.lockHolds : 0),
+			to_string(s.contextSwitches), to_string(s.rssKb)};
+		json << "  {";
+		for (uint i = 0; i < values.size(); i++) {
+			csv << (i > 0 ? "," : "") << values[i];
+			// The first two columns are strings, the rest numbers
+			json << (i > 0 ? ", " : "") << "\"" << columns[i] << "\": " << (i < 2 ? jsonString(values[i]) : values[i]);
+		}
+		csv << "\n";
+		json << "}" << (n + 1 < scenarios.size() ? "," : "") << "\n";
+	}
+	json << "]\n";
+	cout << "Wrote " << scenarios.size() << " scenarios to " << csvPath << " and " << jsonPath << endl;
+	return 0;
+}
@@ -0,0 +1,544 @@
+/*
+	Benchmarks for the TaskManager locking backends.
+	Usage: ./resource_bench stress inputFile [seconds]
+	       ./resource_bench hold inputFile [iterations]
+	       ./resource_bench banker [numResources] [numTasks]
+	       ./resource_bench timers [numTimers]
+	       ./resource_bench decode logFile
+	       ./resource_bench generate numTasks numResources [uniform|hotspot|groups|ring] [needsPerTask] [seed] > file.dat
+	       ./resource_bench parse inputFile
+	       ./resource_bench matrix outBase msPerScenario inputFile...
+	       ./resource_bench lease inputFile [iterations]
+	       ./resource_bench shared inputFile [numProcesses] [ms]
+*/
+
+#include "../include/task_manager.h"
+#include <unistd.h>
+#include <sys/resource.h>
+
+
+// Shared by stress threads
+struct StressRun {
+	TaskManager *manager;
+	atomic<bool> stop{false};
+	atomic<long> ops{0};
+	atomic<long> checks{0};
+	atomic<bool> consistent{true};
+};
+
+struct StressArg {
+	StressRun *run;
+	int taskNum;
+};
+
+void *stressTask(void *arg);
+void *stressChecker(void *arg);
+double stress(const char *inputFile, LockMode lockMode, bool packCounters, int seconds, bool &consistent);
+int benchHold(const char *inputFile, int iterations);
+int benchBanker(int numResources, int numTasks);
+int benchTimers(int numTimers);
+int decodeLog(const char *path);
+int generate(int numTasks, int numResources, const string &pattern, int needsPerTask, int seed);
+int benchParse(const char *inputFile);
+int benchMatrix(const char *outBase, int ms, const vector<string> &files);
+int benchLease(const char *inputFile, int iterations);
+int benchShared(const char *inputFile, int numProcesses, int ms);
+
+
+/*
+	Runs a benchmark chosen by the first argument.
+*/
+int main (int argc, char *argv[]) {
+	if (argc >= 2 && string(argv[1]) == "banker") {
+		return benchBanker(argc > 2 ? atoi(argv[2]) : 256, argc > 3 ? atoi(argv[3]) : 64);
+	}
+	if (argc >= 4 && string(argv[1]) == "generate") {
+		return generate(atoi(argv[2]), atoi(argv[3]), argc > 4 ? argv[4] : "uniform",
+			argc > 5 ? atoi(argv[5]) : 2, argc > 6 ? atoi(argv[6]) : 1);
+	}
+	if (argc >= 3 && string(argv[1]) == "parse") {
+		return benchParse(argv[2]);
+	}
+	if (argc >= 3 && string(argv[1]) == "decode") {
+		return decodeLog(argv[2]);
+	}
+	if (argc >= 5 && string(argv[1]) == "matrix") {
+		return benchMatrix(argv[2], atoi(argv[3]), vector<string>(argv + 4, argv + argc));
+	}
+	if (argc >= 3 && string(argv[1]) == "lease") {
+		return benchLease(argv[2], argc > 3 ? atoi(argv[3]) : 1000000);
+	}
+	if (argc >= 3 && string(argv[1]) == "shared") {
+		return benchShared(argv[2], argc > 3 ? atoi(argv[3]) : 4, argc > 4 ? atoi(argv[4]) : 1000);
+	}
+	if (argc >= 2 && string(argv[1]) == "timers") {
+		return benchTimers(argc > 2 ? atoi(argv[2]) : 100000);
+	}
+	if (argc < 3 || (string(argv[1]) != "stress" && string(argv[1]) != "hold")) {
+		cerr << "Incorrect Usage: resource_bench stress|hold inputFile [seconds|iterations]" << endl;
+		cerr << "                 resource_bench banker [numResources] [numTasks]" << endl;
+		cerr << "                 resource_bench timers [numTimers]" << endl;
+		cerr << "                 resource_bench decode logFile" << endl;
+		cerr << "                 resource_bench generate numTasks numResources [uniform|hotspot|groups|ring] [needsPerTask] [seed]" << endl;
+		cerr << "                 resource_bench parse inputFile" << endl;
+		cerr << "                 resource_bench matrix outBase msPerScenario inputFile..." << endl;
+		cerr << "                 resource_bench lease inputFile [iterations]" << endl;
+		cerr << "                 resource_bench shared inputFile [numProcesses] [ms]" << endl;
+		return EXIT_FAILURE;
+	}
+	const char *inputFile = argv[2];
+	if (string(argv[1]) == "hold") {
+		return benchHold(inputFile, argc > 3 ? atoi(argv[3]) : 1000000);
+	}
+	int seconds = argc > 3 ? atoi(argv[3]) : 1;
+
+	struct Backend {
+		const char *name;
+		LockMode lockMode;
+		bool packCounters;
+	} backends[] = {
+		{"global", LOCK_GLOBAL, true},
+		{"fine", LOCK_FINE, true},
+		{"atomic (per-counter CAS)", LOCK_ATOMIC, false},
+		{"atomic (packed CAS)", LOCK_ATOMIC, true},
+	};
+
+	// With one core the global mutex is never contended, which caps what
+	// the lock-free backends can gain over it
+	cout << "Stress: " << inputFile << ", " << seconds << " s per backend, " 
+		<< sysconf(_SC_NPROCESSORS_ONLN) << " cores" << endl;
+	double baseline = 0;
+	for (const Backend &backend : backends) {
+		bool consistent;
+		double rate = stress(inputFile, backend.lockMode, backend.packCounters, seconds, consistent);
+		if (baseline == 0) {
+			baseline = rate;
+		}
+		cout << "\t" << backend.name << ":\t" << (long) rate << " acquire/release per s (x" 
+			<< rate / baseline << ", " << (consistent ? "never overcommitted" : "OVERCOMMITTED") << ")" << endl;
+		if (!consistent) {
+			return EXIT_FAILURE;
+		}
+	}
+	return 0;
+}
+
+/*
+	Runs one thread per task that acquires and releases its resources in a
+	tight loop, while a checker thread keeps verifying that no resource is
+	overcommitted. Returns acquire/release pairs per second.
+*/
+double stress(const char *inputFile, LockMode lockMode, bool packCounters, int seconds, bool &consistent) {
+	unique_ptr<TaskManager> manager(new TaskManager());
+	manager->lockMode = lockMode;
+	manager->packCounters = packCounters;
+	if (manager->parseInput(inputFile) != 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	StressRun run;
+	run.manager = manager.get();
+	vector<StressArg> args(manager->getNumTasks());
+	vector<pthread_t> tids(manager->getNumTasks());
+	pthread_t tidChecker;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_create(&tidChecker, nullptr, stressChecker, &run);
+	for (int i = 0; i < manager->getNumTasks(); i++) {
+		args[i] = {&run, i};
+		pthread_create(&tids[i], nullptr, stressTask, &args[i]);
+	}
+	sleep(seconds);
+	run.stop = true;
+	for (int i = 0; i < manager->getNumTasks(); i++) {
+		pthread_join(tids[i], nullptr);
+	}
+	pthread_join(tidChecker, nullptr);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	// Every resource must be back at its maximum once all tasks stopped
+	consistent = run.consistent && manager->resourcesAreConsistent();
+	for (const Task &task : manager->tasks) {
+		for (int held : task.holding) {
+			if (held != 0) {
+				consistent = false;
+			}
+		}
+	}
+	return run.ops / (manager->getDuration(start, end) / 1000);
+}
+
+/* Acquires and releases the task's resources until stopped */
+void *stressTask(void *arg) {
+	StressRun *run = ((StressArg *) arg)->run;
+	TaskManager &manager = *run->manager;
+	Task &task = manager.tasks[((StressArg *) arg)->taskNum];
+	long ops = 0;
+
+	while (!run->stop) {
+		if (manager.lockMode == LOCK_FINE) {
+			manager.acquireResourcesFine(task);
+			manager.releaseResourcesFine(task);
+		}
+		else if (manager.lockMode == LOCK_ATOMIC) {
+			if (!manager.tryAcquireAtomic(task)) {
+				sched_yield();
+				continue;
+			}
+			manager.releaseResourcesAtomic(task);
+		}
+		else {
+			// Try once rather than block so stopping can never hang
+			pthread_mutex_lock(&manager.mutex);
+			bool acquired = manager.resourcesAreAvailable(task);
+			if (acquired) {
+				manager.grabResources(task);
+			}
+			pthread_mutex_unlock(&manager.mutex);
+			if (!acquired) {
+				sched_yield();
+				continue;
+			}
+			pthread_mutex_lock(&manager.mutex);
+			manager.releaseResources(task);
+			pthread_mutex_unlock(&manager.mutex);
+		}
+		ops++;
+	}
+	run->ops += ops;
+	return nullptr;
+}
+
+/* Repeatedly checks that no resource is overcommitted until stopped */
+void *stressChecker(void *arg) {
+	StressRun *run = (StressRun *) arg;
+	while (!run->stop) {
+		if (!run->manager->resourcesAreConsistent()) {
+			run->consistent = false;
+		}
+		run->checks++;
+		sched_yield();
+	}
+	return nullptr;
+}
+
+/*
+	Times the work done while holding the mutex: one availability check and
+	grab, then one release, for every task in turn. Compares the string-keyed
+	maps TaskManager used to keep against the interned resource ids.
+*/
+int benchHold(const char *inputFile, int iterations) {
+	TaskManager manager;
+	if (manager.parseInput(inputFile) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	// Rebuild the old string-keyed representation from the interned one
+	unordered_map<string, int> availableDict;
+	vector<unordered_map<string, int>> neededDicts, holdingDicts;
+	for (int resource = 0; resource < manager.getNumResources(); resource++) {
+		availableDict[manager.getResourceName(resource)] = manager.getAvailable(resource);
+	}
+	for (const Task &task : manager.tasks) {
+		unordered_map<string, int> needed, holding;
+		for (const auto& need : task.needs) {
+			needed[manager.getResourceName(need.first)] = need.second;
+			holding[manager.getResourceName(need.first)] = 0;
+		}
+		neededDicts.push_back(needed);
+		holdingDicts.push_back(holding);
+	}
+
+	struct timespec start, end;
+	long sections = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int n = 0; n < iterations; n++) {
+		for (uint t = 0; t < neededDicts.size(); t++) {
+			bool isAvailable = true;
+			for (const auto& pair : neededDicts[t]) {
+				string resource = pair.first;
+				if (availableDict[resource] < pair.second) {
+					isAvailable = false;
+					break;
+				}
+			}
+			if (isAvailable) {
+				for (const auto& pair : neededDicts[t]) {
+					string resource = pair.first;
+					availableDict[resource] -= pair.second;
+					holdingDicts[t][resource] += pair.second;
+				}
+				for (const auto& pair : neededDicts[t]) {
+					string resource = pair.first;
+					availableDict[resource] += pair.second;
+					holdingDicts[t][resource] -= pair.second;
+				}
+			}
+			sections++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double before = manager.getDuration(start, end) * 1e6 / sections;
+
+	sections = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int n = 0; n < iterations; n++) {
+		for (Task &task : manager.tasks) {
+			if (manager.resourcesAreAvailable(task)) {
+				manager.grabResources(task);
+				manager.releaseResources(task);
+			}
+			sections++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double after = manager.getDuration(start, end) * 1e6 / sections;
+
+	cout << "Lock hold time: " << inputFile << ", " << iterations << " iterations per task" << endl;
+	cout << "\tstring-keyed maps:\t" << before << " ns per check+grab+release" << endl;
+	cout << "\tinterned ids:\t" << after << " ns per check+grab+release (x" << before / after << " faster)" << endl;
+	return 0;
+}
+
+/*
+	Measures the per-request cost of the Banker's safety check against the
+	plain availability check used by all-at-once acquisition. Builds a
+	random workload of two-phase tasks over many resources, lets half the
+	tasks take their first phase, then times checking every task's next
+	request with and without the incremental fast path.
+*/
+int benchBanker(int numResources, int numTasks) {
+	char path[] = "/tmp/resource_bench_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		cerr << "Failed to create temporary input file" << endl;
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	// Every task claims 8 random resources in each of two phases
+	ofstream out(path);
+	srand(1);
+	out << "resources";
+	for (int r = 0; r < numResources; r++) {
+		out << " R" << r << ":" << numTasks / 4 + 1;
+	}
+	out << endl;
+	for (int t = 0; t < numTasks; t++) {
+		out << "task T" << t << " 0 0";
+		for (int phase = 0; phase < 2; phase++) {
+			out << (phase > 0 ? " |" : "");
+			for (int k = 0; k < 8; k++) {
+				out << " R" << rand() % numResources << ":" << 1 + rand() % 3;
+			}
+		}
+		out << endl;
+	}
+	out.close();
+
+	TaskManager manager;
+	manager.bankers = true;
+	int err = manager.parseInput(path);
+	unlink(path);
+	if (err != 0) {
+		return EXIT_FAILURE;
+	}
+	for (int t = 0; t < numTasks; t += 2) {
+		if (manager.canGrant(manager.tasks[t])) {
+			manager.grabResources(manager.tasks[t]);
+		}
+	}
+
+	const int rounds = max(1, 2000000 / (numTasks * numResources / 64 + 1));
+	long requests = (long) rounds * numTasks;
+	struct timespec start, end;
+	volatile int granted = 0; // keeps the checks from being optimized away
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int n = 0; n < rounds; n++) {
+		for (Task &task : manager.tasks) {
+			granted += manager.resourcesAreAvailable(task);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double plain = manager.getDuration(start, end) * 1e6 / requests;
+
+	double timings[2];
+	for (int fastPath = 1; fastPath >= 0; fastPath--) {
+		manager.bankersFastPath = fastPath;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int n = 0; n < rounds; n++) {
+			for (Task &task : manager.tasks) {
+				granted += manager.resourcesAreAvailable(task) && manager.isSafeToGrant(task);
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		timings[fastPath] = manager.getDuration(start, end) * 1e6 / requests;
+	}
+
+	cout << "Banker's check: " << numResources << " resources, " << numTasks << " tasks" << endl;
+	cout << "\tavailability only (all-at-once):\t" << plain << " ns per request" << endl;
+	cout << "\tBanker's, incremental:\t" << timings[1] << " ns per request (+" << timings[1] - plain << " ns)" << endl;
+	cout << "\tBanker's, full check every time:\t" << timings[0] << " ns per request (+" << timings[0] - plain << " ns)" << endl;
+	return 0;
+}
+
+/*
+	Loads a TimerWheel with numTimers pending timers due over the next two
+	seconds, cancels every tenth, and reports insert and cancel cost and how
+	late the rest fired.
+*/
+int benchTimers(int numTimers) {
+	TimerWheel wheel;
+	wheel.start();
+	atomic<int> fired{0};
+	vector<TimerId> ids(numTimers);
+	struct timespec start, end;
+	srand(1);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < numTimers; i++) {
+		ids[i] = wheel.schedule(1 + rand() % 2000, [&fired]() {
+			fired++;
+		});
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double insert = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+	int cancelled = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < numTimers; i += 10) {
+		cancelled += wheel.cancel(ids[i]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double cancel = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+	while (fired + cancelled < numTimers) {
+		wheel.sleep(10);
+	}
+	wheel.stop();
+
+	cout << "Timer wheel: " << numTimers << " timers over 2 s" << endl;
+	cout << "	schedule:\t" << insert / numTimers << " ns per timer" << endl;
+	cout << "	cancel:\t" << cancel / max(cancelled, 1) << " ns per timer" << endl;
+	cout << "	";
+	wheel.printStats();
+	return 0;
+}
+
+/* Prints a binary log written by main -B as the text stdout would have shown */
+int decodeLog(const char *path) {
+	ifstream in(path, ios::binary);
+	string magic(8, '\0');
+	uint32_t count = 0;
+	in.read(&magic[0], magic.size());
+	in.read((char *) &count, sizeof(count));
+	if (!in || magic != LOG_MAGIC) {
+		cerr << "Not a binary log: " << path << endl;
+		return EXIT_FAILURE;
+	}
+	vector<string> names(count);
+	for (string &name : names) {
+		uint16_t length = 0;
+		in.read((char *) &length, sizeof(length));
+		name.resize(length);
+		in.read(&name[0], length);
+	}
+
+	LogCompletion event;
+	while (in.read((char *) &event, sizeof(event))) {
+		if (event.task >= count) {
+			cerr << "Corrupt record in " << path << endl;
+			return EXIT_FAILURE;
+		}
+		Logger::formatCompletion(cout, names[event.task], event);
+	}
+	return 0;
+}
+
+/*
+	Writes a synthetic input file to stdout. Every resource has two units
+	and every task needs needsPerTask distinct resources, one unit each,
+	chosen by pattern:
+		uniform	any resources, so contention is spread evenly
+		hotspot	nine picks in ten from the hottest 1% of resources
+		groups	resources split into groups of needsPerTask, with tasks
+			spread over the groups, so groups never contend
+		ring	task i needs resources i .. i+needsPerTask-1 (mod
+			numResources), a dining-philosophers ring
+*/
+int generate(int numTasks, int numResources, const string &pattern, int needsPerTask, int seed) {
+	const string patterns[] = {"uniform", "hotspot", "groups", "ring"};
+	if (numTasks < 0 || numResources < 1 || needsPerTask < 1 || needsPerTask > numResources
+		|| find(begin(patterns), end(patterns), pattern) == end(patterns)) {
+		cerr << "generate needs numResources >= needsPerTask >= 1 and a known pattern" << endl;
+		return EXIT_FAILURE;
+	}
+	srand(seed);
+	string out;
+	out += "# Generated: " + to_string(numTasks) + " tasks, " + to_string(numResources) + " resources, "
+		+ pattern + ", " + to_string(needsPerTask) + " needs per task, seed " + to_string(seed) + "\n\n";
+	out += "resources";
+	for (int r = 0; r < numResources; r++) {
+		out += " R" + to_string(r) + ":2";
+	}
+	out += "\n\n";
+
+	int numHot = max(1, numResources / 100);
+	int numGroups = max(1, numResources / needsPerTask);
+	vector<int> picked;
+	for (int t = 0; t < numTasks; t++) {
+		picked.clear();
+		while ((int) picked.size() < needsPerTask) {
+			int k = picked.size();
+			int resource;
+			if (pattern == "uniform") {
+				resource = rand() % numResources;
+			}
+			else if (pattern == "hotspot") {
+				resource = rand() % 10 < 9 && numHot >= needsPerTask ? rand() % numHot : rand() % numResources;
+			}
+			else if (pattern == "groups") {
+				resource = (t % numGroups) * needsPerTask + k;
+			}
+			else {
+				resource = (t + k) % numResources;
+			}
+			if (find(picked.begin(), picked.end(), resource) == picked.end()) {
+				picked.push_back(resource);
+			}
+		}
+		out += "task T" + to_string(t) + " 1 1";
+		for (int resource : picked) {
+			out += " R" + to_string(resource) + ":1";
+		}
+		out += "\n";
+		if (out.size() > (1 << 20)) {
+			cout << out;
+			out.clear();
+		}
+	}
+	cout << out << flush;
+	return 0;
+}
+
+/* Times parsing inputFile into a TaskManager and the memory the tasks take */
+int benchParse(const char *inputFile) {
+	struct rusage before, after;
+	struct timespec start, end;
+	getrusage(RUSAGE_SELF, &before);
+	TaskManager manager;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (manager.parseInput(inputFile) != 0) {
+		return EXIT_FAILURE;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	getrusage(RUSAGE_SELF, &after);
+
+	double ms = manager.getDuration(start, end);
+	cout << "Parsed " << inputFile << ": " << manager.getNumTasks() << " tasks, " << manager.getNumResources() << " resources" << endl;
+	cout << "\tparse time:\t" << ms << " ms (" << (ms > 0 ? manager.getNumTasks() / ms * 1000 : 0) << " tasks/s)" << endl;
+	cout << "\tpeak RSS growth:\t" << (after.ru_maxrss - before.ru_maxrss) / 1024 << " MB" << endl;
+	return 0;
+}
@@ -0,0 +1,202 @@
+/*
+	Shared pool benchmark: zero-duration acquire/release cycles with one
+	thread per task, numProcesses copies of the input file's tasks either
+	in one process on the global mutex or in that many processes on a
+	shared memory pool. Then kills a process holding every resource and
+	times how long the pool takes to get them back.
+	Usage: ./resource_bench shared inputFile [numProcesses] [ms]
+*/
+
+#include "../include/task_manager.h"
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+// Shared by the threads of one run
+struct SharedRun {
+	TaskManager *manager;
+	atomic<bool> stop{false};
+	atomic<long> ops{0};
+};
+
+struct SharedArg {
+	SharedRun *run;
+	int taskNum;
+};
+
+/* Acquires and releases the task's resources until stopped */
+static void *sharedTask(void *arg) {
+	SharedRun *run = ((SharedArg *) arg)->run;
+	TaskManager &manager = *run->manager;
+	Task &task = manager.tasks[((SharedArg *) arg)->taskNum];
+	long ops = 0;
+	while (!run->stop.load(memory_order_relaxed)) {
+		if (manager.lockMode == LOCK_SHARED) {
+			manager.acquireResourcesShared(task);
+			manager.releaseResourcesShared(task);
+		}
+		else {
+			manager.lockMutex();
+			manager.acquireResources(task);
+			pthread_mutex_unlock(&manager.mutex);
+			manager.lockMutex();
+			manager.releaseResources(task);
+			pthread_mutex_unlock(&manager.mutex);
+		}
+		ops++;
+	}
+	run->ops += ops;
+	return nullptr;
+}
+
+/* Runs a thread for every task of the manager for ms; returns cycles completed */
+static long runCycles(TaskManager &manager, int ms) {
+	SharedRun run;
+	run.manager = &manager;
+	vector<SharedArg> args(manager.getNumTasks());
+	vector<pthread_t> tids(manager.getNumTasks());
+	for (int i = 0; i < manager.getNumTasks(); i++) {
+		args[i] = {&run, i};
+		pthread_create(&tids[i], nullptr, sharedTask, &args[i]);
+	}
+	usleep(ms * 1000);
+	run.stop = true;
+	for (int i = 0; i < manager.getNumTasks(); i++) {
+		pthread_join(tids[i], nullptr);
+	}
+	if (!manager.resourcesAreConsistent()) {
+		cerr << "Resources overcommitted" << endl;
+		exit(EXIT_FAILURE);
+	}
+	return run.ops;
+}
+
+/* Every copy of the tasks in this process, on the global mutex */
+static double inProcess(const char *inputFile, int copies, int ms) {
+	TaskManager manager;
+	for (int i = 0; i < copies; i++) {
+		// Parsing again adds another copy of the tasks on the same resources
+		if (manager.parseInput(inputFile) != 0) {
+			exit(EXIT_FAILURE);
+		}
+	}
+	return runCycles(manager, ms) / (ms / 1000.0);
+}
+
+/* One copy of the tasks in each of numProcesses processes sharing a pool */
+static double acrossProcesses(const char *inputFile, const string &poolName, int numProcesses, int ms) {
+	vector<pid_t> pids;
+	vector<int> pipes;
+	for (int p = 0; p < numProcesses; p++) {
+		int fds[2];
+		if (pipe(fds) == -1) {
+			exit(EXIT_FAILURE);
+		}
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(fds[0]);
+			long ops = -1;
+			{
+				TaskManager manager;
+				if (manager.parseInput(inputFile) == 0 && manager.attachShared(poolName)) {
+					ops = runCycles(manager, ms);
+				}
+			}
+			if (write(fds[1], &ops, sizeof(ops)) != sizeof(ops)) {
+				_exit(EXIT_FAILURE);
+			}
+			_exit(0);
+		}
+		close(fds[1]);
+		pids.push_back(pid);
+		pipes.push_back(fds[0]);
+	}
+
+	long total = 0;
+	for (int p = 0; p < numProcesses; p++) {
+		long ops = -1;
+		if (read(pipes[p], &ops, sizeof(ops)) != sizeof(ops) || ops < 0) {
+			cerr << "Shared pool process " << p << " failed" << endl;
+			exit(EXIT_FAILURE);
+		}
+		total += ops;
+		close(pipes[p]);
+		waitpid(pids[p], nullptr, 0);
+	}
+	return total / (ms / 1000.0);
+}
+
+/*
+	A child takes every unit of every resource and is killed without
+	releasing them. Returns the ms from the kill until this process could
+	take them all, which a bounded wait in acquire makes at most about 50ms.
+*/
+static double reclaimAfterCrash(const char *inputFile, const string &poolName) {
+	TaskManager manager;
+	if (manager.parseInput(inputFile) != 0) {
+		exit(EXIT_FAILURE);
+	}
+	vector<string> names;
+	vector<int> amounts;
+	for (int r = 0; r < manager.getNumResources(); r++) {
+		names.push_back(manager.getResourceName(r));
+		amounts.push_back(manager.getAvailable(r));
+	}
+	SharedPool pool;
+	if (!pool.attach(poolName, names, amounts)) {
+		exit(EXIT_FAILURE);
+	}
+	vector<pair<int, int>> everything;
+	for (uint r = 0; r < names.size(); r++) {
+		everything.push_back(make_pair(pool.find(names[r]), pool.getMax(pool.find(names[r]))));
+	}
+
+	// Children are reaped at once, as a shell reaps a crashed process
+	signal(SIGCHLD, SIG_IGN);
+	int fds[2];
+	if (pipe(fds) == -1) {
+		exit(EXIT_FAILURE);
+	}
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		SharedPool holder;
+		char held = holder.attach(poolName, names, amounts) && holder.acquire(everything, 0);
+		if (write(fds[1], &held, 1) != 1 || !held) {
+			_exit(EXIT_FAILURE);
+		}
+		while (true) {
+			pause();
+		}
+	}
+	close(fds[1]);
+	char held = 0;
+	if (read(fds[0], &held, 1) != 1 || !held) {
+		cerr << "Crashing process failed to take the pool" << endl;
+		exit(EXIT_FAILURE);
+	}
+	close(fds[0]);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	kill(pid, SIGKILL);
+	while (!pool.acquire(everything, 50)) {
+		// Woken by a release, or the wait timed out; try again
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pool.release(everything);
+	signal(SIGCHLD, SIG_DFL);
+	return manager.getDuration(start, end);
+}
+
+int benchShared(const char *inputFile, int numProcesses, int ms) {
+	string poolName = "/resource-bench-" + to_string(getpid());
+	cout << "Shared pool: " << inputFile << ", " << numProcesses << " copies of the tasks, " << ms << " ms per run" << endl;
+	double local = inProcess(inputFile, numProcesses, ms);
+	cout << "\tone process, global mutex:\t" << (long) local << " cycles/s" << endl;
+	double shared = acrossProcesses(inputFile, poolName, numProcesses, ms);
+	cout << "\t" << numProcesses << " processes, shared pool:\t" << (long) shared << " cycles/s (x" << shared / local << ")" << endl;
+	cout << "\tresources of a killed holder back after " << reclaimAfterCrash(inputFile, poolName) << " ms" << endl;
+	return 0;
+}
@@ -8,7 +8,20 @@
 #include <fstream>
 #include <sstream>
 #include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <sched.h>
+#include <functional>
+#include <list>
+#include <deque>
+#include <queue>
 
 using namespace std;
 
+// Bytes per cache line. Data written by different threads is aligned to it
+// so that one thread's writes don't invalidate another's cached copy.
+#define CACHE_LINE 64
+
 #endif
\ No newline at end of file
@@ -0,0 +1,101 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include "common.h"
+#include "task_manager.h"
+#include "placement.h"
+
+// Coroutine task bodies need C++20 (make main_coro); the C++11 build leaves
+// all of this out
+#ifdef __cpp_impl_coroutine
+#include <coroutine>
+
+
+// A task body written as a coroutine. It starts suspended, runs once
+// CoExecutor::spawn hands it to the executor, and frees itself on return.
+struct CoTask {
+	struct promise_type {
+		CoTask get_return_object() {
+			return CoTask{coroutine_handle<promise_type>::from_promise(*this)};
+		}
+		suspend_always initial_suspend() noexcept { return {}; }
+		suspend_never final_suspend() noexcept { return {}; }
+		void return_void();
+		void unhandled_exception() { terminate(); }
+	};
+
+	coroutine_handle<promise_type> handle;
+};
+
+// co_await manager.acquire(task): takes the task's next phase, suspending
+// until it is granted. Resumes with false if the wait timed out instead.
+struct AcquireAwaiter {
+	TaskManager &manager;
+	Task &task;
+	bool immediate = false;	// granted without waiting
+
+	bool await_ready() { return false; }
+	bool await_suspend(coroutine_handle<> handle);
+	bool await_resume();
+};
+
+// co_await manager.release(task): gives back everything the task holds.
+// Releasing never has to wait, so this never suspends.
+struct ReleaseAwaiter {
+	TaskManager &manager;
+	Task &task;
+
+	bool await_ready() { return true; }
+	void await_suspend(coroutine_handle<>) {}
+	void await_resume();
+};
+
+// co_await sleepFor(ms): resumes on the executor once ms have passed
+struct SleepAwaiter {
+	int ms;
+
+	bool await_ready() { return ms <= 0; }
+	void await_suspend(coroutine_handle<> handle);
+	void await_resume() {}
+};
+
+SleepAwaiter sleepFor(int ms);
+
+
+// Runs coroutine task bodies on a small pool of worker threads. A suspended
+// body costs only its frame: grants and timeouts from TaskManager and timers
+// on its TimerWheel put it back on the ready queue.
+class CoExecutor {
+	public:
+		CoExecutor(TaskManager &manager, int numWorkers);
+
+		void spawn(CoTask task);
+		void run();
+		void schedule(coroutine_handle<> handle);
+		void resumeAfter(coroutine_handle<> handle, int ms);
+		void pinWorkers(const vector<int> &cpus);
+
+		// Executor of the worker thread running the current coroutine
+		static thread_local CoExecutor *current;
+
+	private:
+		friend struct CoTask::promise_type;
+
+		TaskManager &manager;
+		int numWorkers;
+		vector<int> workerCpus;	// core of each worker, round robin; empty leaves them free
+
+		deque<coroutine_handle<>> ready;
+		pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+		pthread_cond_t queueCond = PTHREAD_COND_INITIALIZER;
+		pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;
+		int bodiesRemaining = 0;
+		bool stopping = false;
+
+		static void *doWorker(void *executor);
+		void finished();
+};
+
+#endif
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include "common.h"
+#include "task_manager.h"
+#include "placement.h"
+
+
+// Runs tasks as state machines on a fixed pool of worker threads instead of
+// one thread per task. Waiting tasks are parked in TaskManager until a
+// release grants them, and busy/idle periods are timers on the manager's
+// TimerWheel, so no worker ever blocks on a single task.
+class Executor {
+	public:
+		Executor(TaskManager &manager, int numWorkers, int nIter, struct timespec &start);
+
+		void run();
+		void pinWorkers(const vector<int> &cpus);
+
+	private:
+		TaskManager &manager;
+		int numWorkers;
+		vector<int> workerCpus;	// core of each worker, round robin; empty leaves them free
+		int nIter;
+		struct timespec start;
+
+		// Tasks ready for their next step
+		deque<Task *> readyTasks;
+		pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+		pthread_cond_t queueCond = PTHREAD_COND_INITIALIZER;
+		pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;
+		int tasksRemaining = 0;
+		bool stopping = false;
+
+		static void *doWorker(void *executor);
+		void makeReady(Task &task);
+		void makeReadyAfter(Task &task, int ms);
+		void runStep(Task &task);
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef LOCK_PROFILER_H
+#define LOCK_PROFILER_H
+
+#include "common.h"
+
+// Lock contention profiling is compiled in only with -DPROFILE_LOCKS
+// (make main_profile). Otherwise PROFILE(...) expands to nothing and the
+// profiler does not exist, so normal builds pay nothing for it.
+#ifdef PROFILE_LOCKS
+#define PROFILE(statement) statement
+#else
+#define PROFILE(statement)
+#endif
+
+#ifdef PROFILE_LOCKS
+
+struct Task;
+
+// What one resource went through, as seen by the threads using it
+struct ResourceProfile {
+	long checks = 0;		// availability checks of this resource
+	long shortChecks = 0;		// checks that found too few units
+	long grants = 0;		// requests including this resource granted
+	int64_t grantNs = 0;		// time-to-grant summed over those grants
+	int64_t waitCausedNs = 0;	// waits that ended with this resource the one short
+	long holds = 0;			// holds of this resource released
+	int64_t holdNs = 0;
+
+	void add(const ResourceProfile &other);
+};
+
+
+// Per-resource and global mutex counters. Each thread counts into its own
+// copy, so resource paths that run in parallel (LOCK_FINE) never share a
+// cache line; the copies are merged when the report is printed at exit.
+class LockProfiler {
+	public:
+		void setNumResources(int numResources);
+
+		void checked(Task &task, int resource, bool available);
+		void granted(Task &task);
+		void released(Task &task);
+		void lockMutex(pthread_mutex_t &mutex);
+
+		void printReport(const vector<string> &resourceNames);
+
+		const long *virtualClock = nullptr;	// ms; times tasks while a Simulator runs
+
+	private:
+		struct Counters {
+			vector<ResourceProfile> resources;
+			long mutexLocks = 0;
+			long mutexContended = 0;	// mutex was already taken
+			int64_t mutexWaitNs = 0;
+		};
+
+		int numResources = 0;
+		vector<shared_ptr<Counters>> threads;
+		pthread_mutex_t threadsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+		Counters &local();
+		int64_t taskTimeNs();
+		static int64_t nowNs();
+};
+
+#endif
+
+#endif
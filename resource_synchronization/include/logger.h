@@ -0,0 +1,94 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include "common.h"
+
+// Binary log file: LOG_MAGIC, uint32 task count, each task name as uint16
+// length and bytes, then one LogCompletion per completed iteration
+#define LOG_MAGIC "RSLOG01\n"
+
+struct LogCompletion {
+	uint32_t task;	// index into the names in the header
+	int32_t iter;
+	double timeMs;	// since the run started
+};
+
+
+// Asynchronous output. Every thread appends records to its own lock-free
+// ring buffer and returns; a writer thread drains the rings, puts records
+// back in the order they were logged and writes them out in batches, so
+// console speed never holds up a task. Task completions are formatted by
+// the writer too, or go to a binary log instead of stdout.
+class Logger {
+	public:
+		Logger();
+		~Logger();
+
+		void start();
+		void stop();
+		bool openBinary(const char *path, const vector<string> &names);
+
+		void write(const string &text);
+		void writeCompletion(int task, const string &name, int iter, double timeMs);
+
+		static void formatCompletion(ostream &out, const string &name, const LogCompletion &event);
+
+	private:
+		static const int RING_SIZE = 8192;
+
+		enum RecordKind : uint8_t {
+			RECORD_TEXT,		// text follows the header
+			RECORD_LONG_TEXT,	// a heap string too big for the ring follows
+			RECORD_COMPLETION	// a Completion follows
+		};
+
+		struct RecordHeader {
+			uint32_t size;		// header included
+			RecordKind kind;
+			uint64_t seq;
+		};
+
+		struct Completion {
+			const string *name;
+			LogCompletion event;
+		};
+
+		// Single-producer single-consumer byte ring owned by one thread
+		struct Ring {
+			char data[RING_SIZE];
+			atomic<uint64_t> head{0};	// read by the writer up to here
+			atomic<uint64_t> tail{0};	// written by the owner up to here
+			atomic<bool> owned{true};	// freed for reuse once its thread exits
+		};
+
+		// A record taken off a ring, waiting for its turn to be written
+		struct Pending {
+			uint64_t seq;
+			RecordKind kind;
+			string text;
+			Completion completion;
+			bool operator>(const Pending &other) const { return seq > other.seq; }
+		};
+
+		// Rings are shared with their threads so either may go first. ringsMutex
+		// also serializes taking records off the rings and writing them out.
+		vector<shared_ptr<Ring>> rings;
+		pthread_mutex_t ringsMutex = PTHREAD_MUTEX_INITIALIZER;
+		atomic<uint64_t> nextSeq{0};
+		uint64_t written = 0;
+		priority_queue<Pending, vector<Pending>, greater<Pending>> pending;
+
+		int binaryFd = -1;
+		atomic<bool> running{false};
+		pthread_t tid;
+
+		Ring *localRing();
+		void append(RecordKind kind, const void *payload, uint32_t size);
+		Pending decode(const char *record);
+		bool drain();
+		void flushPending();
+		void writeOut(int fd, const string &buffer);
+		static void *run(void *logger);
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include "common.h"
+#include "task_manager.h"
+
+
+// Where task threads or pool workers run when pinned to cores (-P). Only
+// the first numCores usable cores are used, filling one NUMA node before
+// the next. Tasks that share resources, directly or through other tasks,
+// are kept on the same node so the lines they contend on never cross
+// between sockets; within a node they are spread over its cores.
+class Placement {
+	public:
+		Placement(TaskManager &manager, int numCores);
+
+		int cpuForTask(int task);
+		const vector<int> &getCpus();
+		void print(TaskManager &manager);
+
+		static void pin(pthread_attr_t &attr, int cpu);
+
+	private:
+		vector<vector<int>> nodes;	// cores used on each NUMA node
+		vector<int> cpus;		// the same cores in node order
+		vector<int> taskCpus;
+		vector<int> taskNodes;
+
+		static vector<vector<int>> readNodes();
+		static vector<int> parseCpuList(const string &list);
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "common.h"
+#include "task.h"
+
+
+// Decides the order in which waiting tasks are granted resources
+class Scheduler {
+	public:
+		virtual ~Scheduler() {}
+
+		virtual const char *getName() = 0;
+
+		// True if waiting task a should be granted before waiting task b
+		virtual bool ranksAhead(const Task &a, const Task &b, struct timespec &now) = 0;
+
+		// True if a waiter that can't be granted also holds back every waiter
+		// ranked after it, and new tasks may not overtake the queue
+		virtual bool isStrict() = 0;
+
+		// True if waiters rank in arrival order, so they never need sorting
+		virtual bool ranksByArrival() { return false; }
+};
+
+// Grants any waiter whose needs can be met, in arrival order (the default)
+class GreedyScheduler : public Scheduler {
+	public:
+		const char *getName();
+		bool ranksAhead(const Task &a, const Task &b, struct timespec &now);
+		bool isStrict();
+		bool ranksByArrival() { return true; }
+};
+
+// Grants strictly in ticket (arrival) order
+class FifoScheduler : public Scheduler {
+	public:
+		const char *getName();
+		bool ranksAhead(const Task &a, const Task &b, struct timespec &now);
+		bool isStrict();
+		bool ranksByArrival() { return true; }
+};
+
+// Grants strictly by static priority from the input file, highest first
+class PriorityScheduler : public Scheduler {
+	public:
+		const char *getName();
+		bool ranksAhead(const Task &a, const Task &b, struct timespec &now);
+		bool isStrict();
+};
+
+// Like PriorityScheduler, but a task gains one priority level for every
+// agingTime ms it has waited, so no task can starve
+class AgingScheduler : public Scheduler {
+	public:
+		AgingScheduler(int agingTime);
+		const char *getName();
+		bool ranksAhead(const Task &a, const Task &b, struct timespec &now);
+		bool isStrict();
+
+	private:
+		int agingTime;
+		double getEffectivePriority(const Task &task, struct timespec &now);
+};
+
+Scheduler *createScheduler(const string &name);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef SHARED_POOL_H
+#define SHARED_POOL_H
+
+#include "common.h"
+
+// Limits of a shared pool; its segment has a fixed layout so every process
+// maps the same size whatever input file it read
+#define SHARED_MAX_RESOURCES 64
+#define SHARED_MAX_PROCESSES 64
+#define SHARED_NAME_SIZE 32
+
+struct SharedSegment;
+
+
+// Resource counts in a POSIX shared memory segment (-S), so that tasks in
+// any number of processes draw from one pool. The first process to attach
+// creates the segment from its resources; later ones join it. Counts are
+// guarded by a process-shared robust mutex, and each process records the
+// units it holds in a slot of its own. When a process dies, holding the
+// mutex or not, the survivors notice and return its units to the pool.
+class SharedPool {
+	public:
+		~SharedPool();
+
+		bool attach(const string &name, const vector<string> &names, const vector<int> &amounts);
+		void detach();
+
+		int find(const string &resource);
+		int getMax(int index);
+		int getAvailable(int index);
+		int getAttached();
+
+		bool acquire(const vector<pair<int, int>> &needs, int waitMs);
+		void release(const vector<pair<int, int>> &needs);
+		int reclaimDead();
+
+	private:
+		SharedSegment *segment = nullptr;
+		string name;
+		int slot = -1;		// this process's holder slot
+		bool creator = false;
+
+		void lock();
+		void unlock();
+		bool take(const vector<pair<int, int>> &needs);
+		void repair();
+		void wakeWaiters();
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include "common.h"
+#include "task_manager.h"
+#include <random>
+
+
+// Replays the task cycle as a single-threaded discrete-event simulation on
+// a virtual clock. Tasks step through the same TaskManager requests,
+// grants, timeouts and releases as under Executor, but busy and idle
+// periods are events on a priority queue instead of timers, so a run takes
+// as long as its bookkeeping rather than its simulated time. Events at the
+// same virtual time run in the order they were scheduled, and busy and idle
+// periods are drawn from a seeded generator, so a seed always replays the
+// same run. Once no task has an event left while some still have
+// iterations to go, they are deadlocked and the run stops.
+class Simulator {
+	public:
+		Simulator(TaskManager &manager, int nIter, int monitorTime, unsigned seed);
+
+		bool run();
+		long getTime();
+		void printDeadlock();
+
+	private:
+		enum EventKind : uint8_t {
+			EVENT_STEP,	// run the task's next step
+			EVENT_TIMEOUT,	// the task's wait with ticket runs out
+			EVENT_MONITOR	// print a monitor report
+		};
+
+		struct Event {
+			long time;	// virtual ms
+			uint64_t seq;	// order scheduled, breaking ties
+			EventKind kind;
+			Task *task;
+			long ticket;
+			bool operator>(const Event &other) const {
+				return time != other.time ? time > other.time : seq > other.seq;
+			}
+		};
+
+		TaskManager &manager;
+		int nIter;
+		int monitorTime;
+		int waitTimeout = 0;
+
+		priority_queue<Event, vector<Event>, greater<Event>> events;
+		long now = 0;
+		uint64_t nextSeq = 0;
+		int tasksRemaining = 0;
+		long taskEvents = 0;	// queued EVENT_STEP and EVENT_TIMEOUT events
+
+		// With a seed, each period is drawn from an exponential distribution
+		// around the task's time; without one, every period is exact
+		bool randomize;
+		mt19937 random;
+
+		void schedule(long time, EventKind kind, Task *task, long ticket = 0);
+		int period(int ms);
+		void runStep(Task &task);
+};
+
+#endif
@@ -2,23 +2,90 @@
 #define TASK_H
 
 #include "common.h"
+#include "timer_wheel.h"
 
 
-// Represents a single task in the system
+// States a task moves through; a new task has no status yet
+enum TaskStatus : uint8_t {
+    STATUS_NONE,
+    STATUS_WAIT,
+    STATUS_RUN,
+    STATUS_IDLE
+};
+
+const char *statusName(TaskStatus status);
+
+// Next step of a task run by the pool executor
+enum TaskStep : uint8_t {
+    STEP_ACQUIRE,   // request the next phase
+    STEP_GRANTED,   // a waiting request was granted
+    STEP_RELEASE,   // busy period over
+    STEP_FINISH     // idle period over
+};
+
+// Task status that the monitor can read without taking any lock
+struct AtomicStatus {
+    atomic<TaskStatus> value{STATUS_NONE};
+
+    AtomicStatus() {}
+    AtomicStatus(const AtomicStatus &other) : value(other.value.load()) {}
+    AtomicStatus &operator=(TaskStatus status) {
+        value.store(status, memory_order_release);
+        return *this;
+    }
+    operator TaskStatus() const {
+        return value.load(memory_order_acquire);
+    }
+};
+
+// Represents a single task in the system. Fields the task updates as it
+// runs come first, on cache lines of their own, so that its writes don't
+// invalidate the read-mostly fields other threads scan (needs, phases) or
+// the lines of neighbouring tasks in TaskManager::tasks.
 struct Task {
-    string name;
-    string status;
-    
-    pthread_t tid;
+    alignas(CACHE_LINE) AtomicStatus status;
+    TaskStep step = STEP_ACQUIRE;
+    bool granted = false;       // a blocked request was granted
+    bool grantable = false;     // a release made this waiting task's needs satisfiable
+    uint phase = 0;             // phase to acquire next
     int iter = 0;
+    int leaseRenewals = 0;      // iterations run so far on the current lease
+    int timeSpentWaiting = 0;
+    int timeouts = 0;           // waits given up on
+    long ticket = 0;            // arrival order of the current wait
+    TimerId waitTimer = 0;      // gives up the current wait once it fires
+    struct timespec waitStart = {0, 0};
+    struct timespec grantableTime = {0, 0};  // when grantable was set
+    pthread_t tid;
+    void *coroutine = nullptr;  // suspended coroutine body to resume on a grant
+    vector<double> waitTimes;   // ms waited by every acquisition, for percentiles
+
+    // Blocking acquire: signalled by releaseResources once resources are granted
+    pthread_cond_t grantCond = PTHREAD_COND_INITIALIZER;
+
+    // Set when the input file is parsed
+    alignas(CACHE_LINE) string name;
     int busyTime = 0;
     int idleTime = 0;
-    int timeSpentWaiting = 0;
-    struct timespec busyTimespec = {0, 0};
-    struct timespec idleTimespec = {0, 0};
-    
-    unordered_map<string, int> resourcesNeededDict;
-    unordered_map<string, int> holdingDict;
+    int priority = 0;           // optional field in the input file; higher runs first
+    int index = 0;              // position in TaskManager::tasks
+
+    // Needed resources as (resourceId, amount) sorted by resourceId, units
+    // held of each, and the same needs packed into one word (LOCK_ATOMIC)
+    vector<pair<int, int>> needs;
+    vector<int> holding;
+    uint64_t packedNeed = 0;
+    vector<pair<int, int>> sharedNeeds;     // needs by index into the shared pool (LOCK_SHARED)
+
+    // Acquisition phases, each a list of (index into needs, amount). A task
+    // that takes all of its needs at once has a single phase. Each phase is
+    // held for an equal share of busyTime before the next one is requested.
+    vector<vector<pair<int, int>>> phases;
+    int phaseTime = 0;          // ms each phase is held for
+#ifdef PROFILE_LOCKS
+    int blockedBy = -1;         // resource last found short by the current wait
+    vector<int64_t> heldSince;  // ns each need was granted at, per index into needs
+#endif
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -3,30 +3,174 @@
 
 #include "common.h"
 #include "task.h"
+#include "scheduler.h"
+#include "timer_wheel.h"
+#include "logger.h"
+#include "lock_profiler.h"
+#include "shared_pool.h"
+
+// How a task waits for resources that are not yet available
+enum WaitMode {
+	WAIT_POLL,	// retry the availability check in a loop
+	WAIT_COND	// block on a condition variable until releaseResources grants
+};
+
+// How resource counts are protected from concurrent tasks
+enum LockMode {
+	LOCK_GLOBAL,	// mutex guards every resource
+	LOCK_FINE,	// each resource has its own lock, always taken in id order
+	LOCK_ATOMIC,	// lock-free atomic counters, reserved by compare-and-swap
+	LOCK_SHARED	// counts in a SharedPool that other processes attach to
+};
+
+#ifdef __cpp_impl_coroutine
+struct AcquireAwaiter;
+struct ReleaseAwaiter;
+#endif
+
+// Lock and count of a single resource when using LOCK_FINE, on cache lines
+// of its own so threads using different resources never share a line
+struct alignas(CACHE_LINE) ResourceLock {
+	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t released = PTHREAD_COND_INITIALIZER;
+	int available = 0;
+	long holds = 0;		// times held, counted only with timeLockHolds
+	int64_t holdNs = 0;
+};
+
+// LOCK_ATOMIC counter of a single resource, alone on its cache line
+struct alignas(CACHE_LINE) PaddedCounter {
+	atomic<int> value{0};
+};
 
 
 class TaskManager {
 	public: 
 		vector<Task> tasks;
+		pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+		WaitMode waitMode = WAIT_COND;
+		LockMode lockMode = LOCK_GLOBAL;
+		bool packCounters = true; // let LOCK_ATOMIC pack counters into one word
+		unique_ptr<Scheduler> scheduler{new GreedyScheduler()};
+		bool bankers = false;		// check every grant with the Banker's algorithm
+		bool bankersFastPath = true;	// skip the full check when the requester can finish
+		bool timeLockHolds = false;	// time how long LOCK_FINE resource locks are held
+		function<void(Task &)> onGrant;	// called instead of signalling a granted waiter
+		int waitTimeout = 0;		// ms a blocked request waits before giving up; 0 waits forever
+		function<void(Task &)> onTimeout;	// called instead of signalling a waiter that gave up
+		int leaseIterations = 1;	// iterations a task may keep its resources for; 1 disables leases
+		bool leaseYields = false;	// end a lease as soon as another task waits for its resources
+		TimerWheel timers;		// every task, monitor and wait deadline
+		Logger logger;			// task completions and monitor reports
+		const long *virtualClock = nullptr;	// ms; replaces the real clock while a Simulator runs
+#ifdef PROFILE_LOCKS
+		LockProfiler profiler;		// per-resource contention (make main_profile)
+#endif
 		
+		// Lock mutex, counting contention on it in profiling builds
+		void lockMutex() {
+#ifdef PROFILE_LOCKS
+			profiler.lockMutex(mutex);
+#else
+			pthread_mutex_lock(&mutex);
+#endif
+		}
+
 		int getNumTasks();
+		int getNumResources();
+		const string &getResourceName(int resource);
 		int parseInput(const char *inputFile);
 
 		double getDuration(struct timespec &start, struct timespec &end);
+		void getTime(struct timespec &time);
 		void setTimespec(int ms, struct timespec &delayTimespec);
 
 		bool resourcesAreAvailable(Task &task);
+		bool canGrant(Task &task);
+		bool isSafeToGrant(Task &task);
+		bool hasPhasedTasks();
+		void initBankers();	// parseInput calls it when bankers is already set
+		bool acquireResources(Task &task);
+		bool requestResources(Task &task);
+		void endWait(Task &task);
+		bool canLease(Task &task);
+		bool renewLease(Task &task);
+		bool renewLeaseUnlocked(Task &task);
 		void grabResources(Task &task);
 		void releaseResources(Task &task);
+		void acquireResourcesFine(Task &task);
+		void releaseResourcesFine(Task &task);
+		bool tryAcquireAtomic(Task &task);
+		void acquireResourcesAtomic(Task &task);
+		void releaseResourcesAtomic(Task &task);
+		bool attachShared(const string &poolName);
+		void acquireResourcesShared(Task &task);
+		void releaseResourcesShared(Task &task);
+#ifdef __cpp_impl_coroutine
+		// Awaitable acquire and release for coroutine task bodies (coroutine.h)
+		AcquireAwaiter acquire(Task &task);
+		ReleaseAwaiter release(Task &task);
+#endif
+
+		int getAvailable(int resource);
+		bool resourcesAreConsistent();
+		int64_t getLockHoldNs(long &holds);
+		void recordWakeup(Task &task);
 
 		void printMonitor();
 		void printTasks();
 		void printResources();
+		void printWakeups();
+		void printThroughput(double durationMs);
 
 	private:
+		friend class Simulator;	// runs expireWait from its own timeout events
+
 		int numTasks = 0;
-		unordered_map<string, int> resourcesAvailableDict;
-		unordered_map<string, int> maxResourcesDict;
+		// Resource symbol table; resources are referred to by id everywhere else
+		vector<string> resourceNames;
+		unordered_map<string, int> resourceIds;
+		vector<int> available;
+		vector<int> maxResources;
+		unique_ptr<ResourceLock[]> resourceLocks;
+
+		// LOCK_ATOMIC counters, indexed by resource id. When all counters fit
+		// in 64 bits they are packed into one word instead, each field having a
+		// guard bit on top so a short resource is detected by a single subtraction
+		unique_ptr<PaddedCounter[]> atomicAvailable;
+		atomic<uint64_t> packedAvailable{0};
+		uint64_t packedGuard = 0;
+		int packedWidth = 0;
+		bool packed = false;
+
+		// LOCK_SHARED pool and its index of each resource
+		unique_ptr<SharedPool> sharedPool;
+		vector<int> sharedIndex;
+
+		int internResource(const string &resource);
+		void countHold(ResourceLock &lock, int64_t lockedNs);
+		void unlockResource(int resource, int64_t lockedNs);
+
+		// Banker's algorithm state, one row of numResources per task so the
+		// safety check is a run of simple loops over contiguous ints
+		vector<int> bankersNeed;
+		vector<int> bankersAllocated;
+		vector<int> bankersWork;
+		vector<char> bankersFinished;
+		void updateBankers(Task &task, int resource, int amount);
+		void initAtomicCounters();
+
+		// Tasks waiting for their request to be granted
+		list<Task *> waiters;
+		long unitsAvailable = 0;	// sum of available, so grants stop once nothing is left
+		long nextTicket = 0;
+		void grantWaiters();
+		bool hasContender(Task &task);
+		void expireWait(Task &task, long ticket);
+
+		int numWakeups = 0;
+		double totalWakeupLatency = 0;
+		double maxWakeupLatency = 0;
 };
 
-#endif
\ No newline at end of file
+#endif
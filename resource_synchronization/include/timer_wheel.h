@@ -0,0 +1,76 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include "common.h"
+
+// Identifies a scheduled timer so it can be cancelled; 0 is never a timer
+typedef uint64_t TimerId;
+
+
+// Hierarchical timing wheel with 1ms ticks, driven by its own timer thread.
+// Four levels of 256 slots cover 2^32 ticks; a timer sits in the lowest level
+// whose slot its expiry shares every higher bit with and cascades down as the
+// wheel turns, so insert, cancel and expire are all O(1). Callbacks run on the
+// timer thread and should only hand work off.
+class TimerWheel {
+	public:
+		TimerWheel();
+		~TimerWheel();
+
+		void start();
+		void stop();
+		TimerId schedule(int ms, function<void()> callback);
+		bool cancel(TimerId timer);
+		void sleep(int ms);
+
+		void printStats();
+
+	private:
+		static const int LEVEL_BITS = 8;
+		static const int NUM_LEVELS = 4;
+		static const int NUM_SLOTS = 1 << LEVEL_BITS;
+		static const int OVERFLOW_SLOT = NUM_LEVELS * NUM_SLOTS;
+		static const int NUM_SLIP_BUCKETS = 1000;	// 0.1ms each
+
+		// Timers live in a pool and are linked into their slot by index
+		struct Timer {
+			uint64_t expiry;	// tick the timer fires on
+			int64_t deadline;	// nanoseconds the caller asked to fire at
+			function<void()> callback;
+			int prev, next;
+			int slot;		// -1 once fired, cancelled or free
+			uint32_t generation;
+		};
+
+		vector<Timer> timers;
+		vector<int> freeTimers;
+		// Head of each slot's list, NUM_LEVELS * NUM_SLOTS of them plus one
+		// overflow slot for timers beyond the top level, re-placed when it wraps
+		vector<int> slots;
+		uint64_t currentTick = 0;
+		int pending = 0;
+		int64_t base;	// nanoseconds tick 0 started at
+		bool running = false;
+		pthread_t tid;
+		pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+		pthread_cond_t scheduled = PTHREAD_COND_INITIALIZER;
+
+		// Slip: how late callbacks run after the deadline they asked for
+		long numFired = 0;
+		long numCancelled = 0;
+		int maxPending = 0;
+		double totalSlip = 0;
+		double maxSlip = 0;
+		vector<long> slipBuckets;
+
+		static void *run(void *wheel);
+		int64_t now();
+		void place(int timer);
+		void unlink(int timer);
+		void release(int timer);
+		void cascade(int slot);
+		void tick();
+		double slipPercentile(double p);
+};
+
+#endif
@@ -0,0 +1,171 @@
+#include "../include/coroutine.h"
+
+#ifdef __cpp_impl_coroutine
+
+thread_local CoExecutor *CoExecutor::current = nullptr;
+
+/* Tell the executor running the body that it has returned */
+void CoTask::promise_type::return_void() {
+	CoExecutor::current->finished();
+}
+
+/* Awaitable that takes the task's next phase */
+AcquireAwaiter TaskManager::acquire(Task &task) {
+	return AcquireAwaiter{*this, task};
+}
+
+/* Awaitable that gives back everything the task holds */
+ReleaseAwaiter TaskManager::release(Task &task) {
+	return ReleaseAwaiter{*this, task};
+}
+
+/*
+	Takes the resources right away if they can be granted, in which case the
+	coroutine carries on without suspending. Otherwise the task is queued
+	and the coroutine stays suspended until onGrant or onTimeout resumes it.
+*/
+bool AcquireAwaiter::await_suspend(coroutine_handle<> handle) {
+	manager.lockMutex();
+	task.coroutine = handle.address();
+	immediate = manager.requestResources(task);
+	bool suspend = !immediate;
+	// Once unlocked a grant may resume the coroutine on another worker, so
+	// this awaiter, which lives in the coroutine frame, must not be touched
+	pthread_mutex_unlock(&manager.mutex);
+	return suspend;
+}
+
+/* Ends the wait; returns false if it timed out rather than being granted */
+bool AcquireAwaiter::await_resume() {
+	manager.lockMutex();
+	bool granted = immediate || task.granted;
+	if (granted) {
+		task.tid = pthread_self();
+		manager.endWait(task);
+		task.status = STATUS_RUN;
+	}
+	pthread_mutex_unlock(&manager.mutex);
+	return granted;
+}
+
+/* Releases the task's resources and starts its idle period */
+void ReleaseAwaiter::await_resume() {
+	manager.lockMutex();
+	manager.releaseResources(task);
+	task.status = STATUS_IDLE;
+	pthread_mutex_unlock(&manager.mutex);
+}
+
+/* Awaitable that resumes once ms milliseconds have passed */
+SleepAwaiter sleepFor(int ms) {
+	return SleepAwaiter{ms};
+}
+
+void SleepAwaiter::await_suspend(coroutine_handle<> handle) {
+	CoExecutor::current->resumeAfter(handle, ms);
+}
+
+CoExecutor::CoExecutor(TaskManager &manager, int numWorkers)
+	: manager(manager), numWorkers(numWorkers) {}
+
+/* Queue a task body to start once run is called */
+void CoExecutor::spawn(CoTask task) {
+	pthread_mutex_lock(&queueMutex);
+	ready.push_back(task.handle);
+	bodiesRemaining++;
+	pthread_mutex_unlock(&queueMutex);
+}
+
+/*
+	Runs every spawned body and returns once all of them have returned.
+	The manager's TimerWheel must be running.
+*/
+void CoExecutor::run() {
+	auto resume = [this](Task &task) {
+		schedule(coroutine_handle<>::from_address(task.coroutine));
+	};
+	manager.onGrant = resume;
+	manager.onTimeout = resume;
+
+	vector<pthread_t> tids(numWorkers);
+	for (int i = 0; i < numWorkers; i++) {
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		if (!workerCpus.empty()) {
+			Placement::pin(attr, workerCpus[i % workerCpus.size()]);
+		}
+		int err = pthread_create(&tids[i], &attr, doWorker, this);
+		pthread_attr_destroy(&attr);
+		if (err != 0) {
+			cerr << "Error creating worker thread" << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// Wait for the last body to return, then let the workers exit
+	pthread_mutex_lock(&queueMutex);
+	while (bodiesRemaining > 0) {
+		pthread_cond_wait(&doneCond, &queueMutex);
+	}
+	stopping = true;
+	pthread_cond_broadcast(&queueCond);
+	pthread_mutex_unlock(&queueMutex);
+
+	for (int i = 0; i < numWorkers; i++) {
+		pthread_join(tids[i], nullptr);
+	}
+	manager.onGrant = nullptr;
+	manager.onTimeout = nullptr;
+}
+
+/* Pin the workers to cpus, spreading them round robin, before run */
+void CoExecutor::pinWorkers(const vector<int> &cpus) {
+	workerCpus = cpus;
+}
+
+/* Queue a suspended coroutine to be resumed on a worker */
+void CoExecutor::schedule(coroutine_handle<> handle) {
+	pthread_mutex_lock(&queueMutex);
+	ready.push_back(handle);
+	pthread_cond_signal(&queueCond);
+	pthread_mutex_unlock(&queueMutex);
+}
+
+/* Queue a suspended coroutine once ms milliseconds have passed */
+void CoExecutor::resumeAfter(coroutine_handle<> handle, int ms) {
+	manager.timers.schedule(ms, [this, handle]() {
+		schedule(handle);
+	});
+}
+
+/* Count a body that returned; wakes run after the last one */
+void CoExecutor::finished() {
+	pthread_mutex_lock(&queueMutex);
+	if (--bodiesRemaining == 0) {
+		pthread_cond_signal(&doneCond);
+	}
+	pthread_mutex_unlock(&queueMutex);
+}
+
+/* Worker thread: resumes ready coroutines until the executor stops */
+void *CoExecutor::doWorker(void *arg) {
+	CoExecutor *executor = (CoExecutor *) arg;
+	current = executor;
+	while (true) {
+		pthread_mutex_lock(&executor->queueMutex);
+		while (executor->ready.empty() && !executor->stopping) {
+			pthread_cond_wait(&executor->queueCond, &executor->queueMutex);
+		}
+		if (executor->ready.empty()) {
+			pthread_mutex_unlock(&executor->queueMutex);
+			return nullptr;
+		}
+		coroutine_handle<> handle = executor->ready.front();
+		executor->ready.pop_front();
+		pthread_mutex_unlock(&executor->queueMutex);
+
+		handle.resume();
+	}
+}
+
+#endif
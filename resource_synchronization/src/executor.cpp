@@ -0,0 +1,182 @@
+#include "../include/executor.h"
+
+Executor::Executor(TaskManager &manager, int numWorkers, int nIter, struct timespec &start) 
+	: manager(manager), numWorkers(numWorkers), nIter(nIter), start(start) {}
+
+/*
+	Runs every task for nIter iterations and returns once all are done.
+	The manager's TimerWheel must be running.
+*/
+void Executor::run() {
+	manager.onGrant = [this](Task &task) {
+		task.step = STEP_GRANTED;
+		makeReady(task);
+	};
+	manager.onTimeout = [this](Task &task) {
+		// Back off for idleTime, then ask again
+		task.step = STEP_ACQUIRE;
+		makeReadyAfter(task, task.idleTime);
+	};
+
+	pthread_mutex_lock(&queueMutex);
+	for (Task &task : manager.tasks) {
+		if (nIter > 0) {
+			task.step = STEP_ACQUIRE;
+			readyTasks.push_back(&task);
+			tasksRemaining++;
+		}
+	}
+	pthread_mutex_unlock(&queueMutex);
+
+	vector<pthread_t> tids(numWorkers);
+	for (int i = 0; i < numWorkers; i++) {
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		if (!workerCpus.empty()) {
+			Placement::pin(attr, workerCpus[i % workerCpus.size()]);
+		}
+		int err = pthread_create(&tids[i], &attr, doWorker, this);
+		pthread_attr_destroy(&attr);
+		if (err != 0) {
+			cerr << "Error creating worker thread" << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// Wait for the last task to finish, then let the workers exit
+	pthread_mutex_lock(&queueMutex);
+	while (tasksRemaining > 0) {
+		pthread_cond_wait(&doneCond, &queueMutex);
+	}
+	stopping = true;
+	pthread_cond_broadcast(&queueCond);
+	pthread_mutex_unlock(&queueMutex);
+
+	for (int i = 0; i < numWorkers; i++) {
+		pthread_join(tids[i], nullptr);
+	}
+	manager.onGrant = nullptr;
+	manager.onTimeout = nullptr;
+}
+
+/* Pin the workers to cpus, spreading them round robin, before run */
+void Executor::pinWorkers(const vector<int> &cpus) {
+	workerCpus = cpus;
+}
+
+/* Queue the task to run its next step on a worker */
+void Executor::makeReady(Task &task) {
+	pthread_mutex_lock(&queueMutex);
+	readyTasks.push_back(&task);
+	pthread_cond_signal(&queueCond);
+	pthread_mutex_unlock(&queueMutex);
+}
+
+/* Queue the task once ms milliseconds have passed */
+void Executor::makeReadyAfter(Task &task, int ms) {
+	if (ms <= 0) {
+		makeReady(task);
+		return;
+	}
+	manager.timers.schedule(ms, [this, &task]() {
+		makeReady(task);
+	});
+}
+
+/* Worker thread: runs steps of ready tasks until the executor stops */
+void *Executor::doWorker(void *arg) {
+	Executor *executor = (Executor *) arg;
+	while (true) {
+		pthread_mutex_lock(&executor->queueMutex);
+		while (executor->readyTasks.empty() && !executor->stopping) {
+			pthread_cond_wait(&executor->queueCond, &executor->queueMutex);
+		}
+		if (executor->readyTasks.empty()) {
+			pthread_mutex_unlock(&executor->queueMutex);
+			return nullptr;
+		}
+		Task *task = executor->readyTasks.front();
+		executor->readyTasks.pop_front();
+		pthread_mutex_unlock(&executor->queueMutex);
+
+		executor->runStep(*task);
+	}
+}
+
+/*
+	Advances a task by one step of the same cycle doTask runs: acquire each
+	phase, hold it for its share of busyTime, release, stay idle for
+	idleTime, and complete the iteration. A step that has to wait returns
+	and is resumed later by a grant or a timer.
+*/
+void Executor::runStep(Task &task) {
+	task.tid = pthread_self();
+	pthread_mutex_t &mutex = manager.mutex;
+	switch (task.step) {
+		case STEP_ACQUIRE:
+		case STEP_GRANTED:
+			manager.lockMutex();
+			if (task.step == STEP_ACQUIRE && !manager.requestResources(task)) {
+				// Parked; onGrant or onTimeout makes the task ready again
+				pthread_mutex_unlock(&mutex);
+				return;
+			}
+			manager.endWait(task);
+			task.status = STATUS_RUN;
+			pthread_mutex_unlock(&mutex);
+
+			// Hold this phase for its share of busyTime
+			task.step = task.phase < task.phases.size() ? STEP_ACQUIRE : STEP_RELEASE;
+			makeReadyAfter(task, task.phaseTime);
+			return;
+
+		case STEP_RELEASE:
+			// A leasing task stays idle still holding its resources
+			if (!manager.canLease(task)) {
+				manager.lockMutex();
+				manager.releaseResources(task);
+				task.status = STATUS_IDLE;
+				pthread_mutex_unlock(&mutex);
+			}
+			task.step = STEP_FINISH;
+			makeReadyAfter(task, task.idleTime);
+			return;
+
+		case STEP_FINISH: {
+			struct timespec end;
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			task.iter++;
+			bool leased = manager.canLease(task) && task.iter < nIter && manager.renewLeaseUnlocked(task);
+			if (!leased) {
+				manager.lockMutex();
+				if (manager.canLease(task)) {
+					leased = task.iter < nIter && manager.renewLease(task);
+					if (!leased) {
+						manager.releaseResources(task);
+						task.status = STATUS_IDLE;
+					}
+				}
+				pthread_mutex_unlock(&mutex);
+			}
+			manager.logger.writeCompletion(task.index, task.name, task.iter, manager.getDuration(start, end));
+
+			if (leased) {
+				// Still holding everything; go straight to the busy period
+				task.step = STEP_RELEASE;
+				makeReadyAfter(task, task.phaseTime);
+				return;
+			}
+			if (task.iter < nIter) {
+				task.step = STEP_ACQUIRE;
+				makeReady(task);
+				return;
+			}
+			pthread_mutex_lock(&queueMutex);
+			if (--tasksRemaining == 0) {
+				pthread_cond_signal(&doneCond);
+			}
+			pthread_mutex_unlock(&queueMutex);
+			return;
+		}
+	}
+}
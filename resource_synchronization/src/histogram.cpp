@@ -0,0 +1,67 @@
+#include "../include/histogram.h"
+#include <cmath>
+
+Histogram::Histogram() : counts(NUM_BUCKETS, 0) {}
+
+/* Get the bucket counting value: its top SUB_BITS + 1 bits, plus its magnitude */
+int Histogram::bucketOf(int64_t value) {
+	uint64_t v = value > 0 ? value : 0;
+	int magnitude = v < 2 * SUB_BUCKETS ? 0 : 63 - __builtin_clzll(v) - SUB_BITS;
+	return magnitude * SUB_BUCKETS + (int) (v >> magnitude);
+}
+
+/* Get the largest value that falls in bucket */
+int64_t Histogram::highestIn(int bucket) {
+	if (bucket < 2 * SUB_BUCKETS) {
+		return bucket;
+	}
+	int magnitude = bucket / SUB_BUCKETS - 1;
+	int64_t sub = bucket - magnitude * SUB_BUCKETS;
+	return ((sub + 1) << magnitude) - 1;
+}
+
+/* Count one value */
+void Histogram::record(int64_t value) {
+	counts[bucketOf(value)]++;
+	count++;
+	maxValue = value > maxValue ? value : maxValue;
+	total += value;
+}
+
+/* Add every value counted by other, e.g. to combine per-thread histograms */
+void Histogram::merge(const Histogram &other) {
+	for (int i = 0; i < NUM_BUCKETS; i++) {
+		counts[i] += other.counts[i];
+	}
+	count += other.count;
+	maxValue = other.maxValue > maxValue ? other.maxValue : maxValue;
+	total += other.total;
+}
+
+long Histogram::getCount() const {
+	return count;
+}
+
+int64_t Histogram::getMax() const {
+	return maxValue;
+}
+
+double Histogram::getMean() const {
+	return count > 0 ? total / count : 0;
+}
+
+/* Get the value at or below which p percent (0-100) of values fall */
+int64_t Histogram::percentile(double p) const {
+	if (count == 0) {
+		return 0;
+	}
+	long rank = max(1L, (long) ceil(p / 100 * count));
+	long seen = 0;
+	for (int i = 0; i < NUM_BUCKETS; i++) {
+		seen += counts[i];
+		if (seen >= rank) {
+			return min(highestIn(i), maxValue);
+		}
+	}
+	return maxValue;
+}
@@ -0,0 +1,157 @@
+#include "../include/lock_profiler.h"
+
+#ifdef PROFILE_LOCKS
+
+#include "../include/task.h"
+
+// Counters of the calling thread and the profiler they belong to
+struct LocalCounters {
+	const void *owner = nullptr;
+	shared_ptr<void> counters;
+};
+static thread_local LocalCounters localCountersOf;
+
+void ResourceProfile::add(const ResourceProfile &other) {
+	checks += other.checks;
+	shortChecks += other.shortChecks;
+	grants += other.grants;
+	grantNs += other.grantNs;
+	waitCausedNs += other.waitCausedNs;
+	holds += other.holds;
+	holdNs += other.holdNs;
+}
+
+/* Number of resources to count; set once the input file is parsed */
+void LockProfiler::setNumResources(int numResources) {
+	this->numResources = numResources;
+}
+
+int64_t LockProfiler::nowNs() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (int64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/* Time for grants and holds, which is virtual under a Simulator */
+int64_t LockProfiler::taskTimeNs() {
+	return virtualClock != nullptr ? *virtualClock * 1000000 : nowNs();
+}
+
+/* Get the calling thread's counters, registering them on first use */
+LockProfiler::Counters &LockProfiler::local() {
+	LocalCounters &local = localCountersOf;
+	if (local.owner != this) {
+		shared_ptr<Counters> counters = make_shared<Counters>();
+		counters->resources.resize(numResources);
+		pthread_mutex_lock(&threadsMutex);
+		threads.push_back(counters);
+		pthread_mutex_unlock(&threadsMutex);
+		local.owner = this;
+		local.counters = counters;
+	}
+	Counters &counters = *(Counters *) local.counters.get();
+	if ((int) counters.resources.size() < numResources) {
+		counters.resources.resize(numResources);
+	}
+	return counters;
+}
+
+/* Count a check of whether resource has enough units for the task */
+void LockProfiler::checked(Task &task, int resource, bool available) {
+	ResourceProfile &profile = local().resources[resource];
+	profile.checks++;
+	if (!available) {
+		profile.shortChecks++;
+		task.blockedBy = resource;
+	}
+}
+
+/*
+	Count the grant of the task's next phase, called before it is taken.
+	A task that waited charges the wait to the resource last found short.
+*/
+void LockProfiler::granted(Task &task) {
+	Counters &counters = local();
+	int64_t now = taskTimeNs();
+	int64_t waited = 0;
+	if (task.status == STATUS_WAIT) {
+		waited = max((int64_t) 0, now - ((int64_t) task.waitStart.tv_sec * 1000000000 + task.waitStart.tv_nsec));
+		if (task.blockedBy != -1) {
+			counters.resources[task.blockedBy].waitCausedNs += waited;
+		}
+	}
+	task.blockedBy = -1;
+	task.heldSince.resize(task.needs.size());
+	for (const auto &request : task.phases[task.phase]) {
+		ResourceProfile &profile = counters.resources[task.needs[request.first].first];
+		profile.grants++;
+		profile.grantNs += waited;
+		task.heldSince[request.first] = now;
+	}
+}
+
+/* Count how long the task held each resource it is about to release */
+void LockProfiler::released(Task &task) {
+	Counters &counters = local();
+	int64_t now = taskTimeNs();
+	for (uint i = 0; i < task.needs.size() && i < task.heldSince.size(); i++) {
+		if (task.holding[i] > 0) {
+			ResourceProfile &profile = counters.resources[task.needs[i].first];
+			profile.holds++;
+			profile.holdNs += now - task.heldSince[i];
+		}
+	}
+}
+
+/* Lock mutex, counting how often and how long it was already taken */
+void LockProfiler::lockMutex(pthread_mutex_t &mutex) {
+	Counters &counters = local();
+	counters.mutexLocks++;
+	if (pthread_mutex_trylock(&mutex) == 0) {
+		return;
+	}
+	int64_t start = nowNs();
+	pthread_mutex_lock(&mutex);
+	counters.mutexContended++;
+	counters.mutexWaitNs += nowNs() - start;
+}
+
+/*
+	Merge every thread's counters and print resources ranked by the total
+	wait time they caused. Call once the tasks have stopped.
+*/
+void LockProfiler::printReport(const vector<string> &resourceNames) {
+	vector<ResourceProfile> total(numResources);
+	Counters mutexTotal;
+	pthread_mutex_lock(&threadsMutex);
+	for (const auto &counters : threads) {
+		for (int r = 0; r < numResources; r++) {
+			total[r].add(counters->resources[r]);
+		}
+		mutexTotal.mutexLocks += counters->mutexLocks;
+		mutexTotal.mutexContended += counters->mutexContended;
+		mutexTotal.mutexWaitNs += counters->mutexWaitNs;
+	}
+	pthread_mutex_unlock(&threadsMutex);
+
+	vector<int> ranked(numResources);
+	for (int r = 0; r < numResources; r++) {
+		ranked[r] = r;
+	}
+	stable_sort(ranked.begin(), ranked.end(), [&total](int a, int b) {
+		return total[a].waitCausedNs > total[b].waitCausedNs;
+	});
+
+	cout << "Contention (ranked by wait caused):\n";
+	for (int r : ranked) {
+		const ResourceProfile &p = total[r];
+		cout << "\t" << resourceNames[r] << ":\t(wait caused= " << p.waitCausedNs / 1E6 << " ms, checks= " << p.checks
+			<< ", short= " << p.shortChecks << ", grants= " << p.grants
+			<< ", avg time-to-grant= " << (p.grants > 0 ? p.grantNs / 1E6 / p.grants : 0) << " ms"
+			<< ", avg hold= " << (p.holds > 0 ? p.holdNs / 1E6 / p.holds : 0) << " ms)\n";
+	}
+	cout << "Mutex= locks " << mutexTotal.mutexLocks << ", contended " << mutexTotal.mutexContended
+		<< ", waited " << mutexTotal.mutexWaitNs / 1E6 << " ms\n";
+}
+
+#endif
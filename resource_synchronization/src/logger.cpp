@@ -0,0 +1,284 @@
+#include "../include/logger.h"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Ring of the calling thread, given back for reuse when the thread exits
+struct LocalRing {
+	const void *owner = nullptr;
+	shared_ptr<void> ring;
+	atomic<bool> *owned = nullptr;
+
+	~LocalRing() {
+		if (owned != nullptr) {
+			*owned = false;
+		}
+	}
+};
+static thread_local LocalRing localRingOf;
+
+Logger::Logger() {}
+
+Logger::~Logger() {
+	stop();
+}
+
+/* Start the writer thread; output goes straight to stdout until then */
+void Logger::start() {
+	cout << flush;
+	running = true;
+	int err = pthread_create(&tid, nullptr, run, this);
+	if (err != 0) {
+		cerr << "Error creating logger thread" << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Write out everything logged so far and stop the writer thread */
+void Logger::stop() {
+	if (!running.exchange(false)) {
+		return;
+	}
+	pthread_join(tid, nullptr);
+	if (binaryFd != -1) {
+		close(binaryFd);
+		binaryFd = -1;
+	}
+}
+
+/*
+	Send task completions to a binary log at path instead of stdout. The
+	header lists the task names that completion records refer to by index.
+*/
+bool Logger::openBinary(const char *path, const vector<string> &names) {
+	binaryFd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (binaryFd == -1) {
+		cerr << "Failed to open log file: " << path << endl;
+		return false;
+	}
+	string header = LOG_MAGIC;
+	uint32_t count = names.size();
+	header.append((const char *) &count, sizeof(count));
+	for (const string &name : names) {
+		uint16_t length = name.size();
+		header.append((const char *) &length, sizeof(length));
+		header.append(name);
+	}
+	writeOut(binaryFd, header);
+	return true;
+}
+
+/* Log text exactly as it should appear on stdout */
+void Logger::write(const string &text) {
+	if (text.size() <= RING_SIZE / 4) {
+		append(RECORD_TEXT, text.data(), text.size());
+	}
+	else {
+		// Too big to share the ring with other records; pass it by pointer
+		string *copy = new string(text);
+		append(RECORD_LONG_TEXT, &copy, sizeof(copy));
+	}
+}
+
+/*
+	Log that a task completed an iteration. The name must outlive the
+	logger; the writer formats the line or writes a binary record.
+*/
+void Logger::writeCompletion(int task, const string &name, int iter, double timeMs) {
+	Completion completion = {&name, {(uint32_t) task, iter, timeMs}};
+	append(RECORD_COMPLETION, &completion, sizeof(completion));
+}
+
+/* Print a completion the way stdout shows it */
+void Logger::formatCompletion(ostream &out, const string &name, const LogCompletion &event) {
+	out << "task complete: " << name << " (iter= " << event.iter << ", time= " << event.timeMs << " ms)\n";
+}
+
+/* Get the calling thread's ring, reusing one of an exited thread if drained */
+Logger::Ring *Logger::localRing() {
+	LocalRing &local = localRingOf;
+	if (local.owner == this) {
+		return (Ring *) local.ring.get();
+	}
+	if (local.owned != nullptr) {
+		*local.owned = false;
+	}
+
+	pthread_mutex_lock(&ringsMutex);
+	shared_ptr<Ring> ring;
+	for (auto &candidate : rings) {
+		if (!candidate->owned && candidate->head == candidate->tail) {
+			ring = candidate;
+			ring->owned = true;
+			break;
+		}
+	}
+	if (!ring) {
+		ring = make_shared<Ring>();
+		rings.push_back(ring);
+	}
+	pthread_mutex_unlock(&ringsMutex);
+
+	local.owner = this;
+	local.ring = ring;
+	local.owned = &ring->owned;
+	return ring.get();
+}
+
+/*
+	Copy a record into the calling thread's ring. If the writer has fallen a
+	whole ring behind this thread, the thread writes out the backlog itself
+	rather than wait for the writer's next round.
+*/
+void Logger::append(RecordKind kind, const void *payload, uint32_t size) {
+	RecordHeader header = {(uint32_t) sizeof(RecordHeader) + size, kind, nextSeq++};
+	if (!running) {
+		// No writer yet: handle the record on this thread
+		pthread_mutex_lock(&ringsMutex);
+		string text(sizeof(header), '\0');
+		memcpy(&text[0], &header, sizeof(header));
+		text.append((const char *) payload, size);
+		pending.push(decode(text.data()));
+		flushPending();
+		pthread_mutex_unlock(&ringsMutex);
+		return;
+	}
+
+	Ring *ring = localRing();
+	uint64_t tail = ring->tail.load(memory_order_relaxed);
+	while (tail + header.size - ring->head.load(memory_order_acquire) > RING_SIZE) {
+		if (pthread_mutex_trylock(&ringsMutex) == 0) {
+			drain();
+			flushPending();
+			pthread_mutex_unlock(&ringsMutex);
+		}
+		else {
+			sched_yield();
+		}
+	}
+	const char *parts[] = {(const char *) &header, (const char *) payload};
+	uint32_t sizes[] = {(uint32_t) sizeof(header), size};
+	for (int p = 0; p < 2; p++) {
+		for (uint32_t i = 0; i < sizes[p]; ) {
+			uint32_t offset = tail % RING_SIZE;
+			uint32_t chunk = min(sizes[p] - i, (uint32_t) RING_SIZE - offset);
+			memcpy(ring->data + offset, parts[p] + i, chunk);
+			i += chunk;
+			tail += chunk;
+		}
+	}
+	ring->tail.store(tail, memory_order_release);
+}
+
+/* Turn a contiguous header and payload into a Pending record */
+Logger::Pending Logger::decode(const char *record) {
+	RecordHeader header;
+	memcpy(&header, record, sizeof(header));
+	const char *payload = record + sizeof(header);
+	Pending p;
+	p.seq = header.seq;
+	p.kind = header.kind;
+	if (header.kind == RECORD_TEXT) {
+		p.text.assign(payload, header.size - sizeof(header));
+	}
+	else if (header.kind == RECORD_LONG_TEXT) {
+		string *text;
+		memcpy(&text, payload, sizeof(text));
+		p.text = move(*text);
+		delete text;
+	}
+	else {
+		memcpy(&p.completion, payload, sizeof(p.completion));
+	}
+	return p;
+}
+
+/*
+	Move every record in the rings into pending. Returns false if there were
+	none. Caller holds ringsMutex.
+*/
+bool Logger::drain() {
+	bool found = false;
+	string record;
+	for (auto &ring : rings) {
+		uint64_t head = ring->head.load(memory_order_relaxed);
+		uint64_t tail = ring->tail.load(memory_order_acquire);
+		while (head < tail) {
+			RecordHeader header;
+			for (uint32_t i = 0; i < sizeof(header); i++) {
+				((char *) &header)[i] = ring->data[(head + i) % RING_SIZE];
+			}
+			record.resize(header.size);
+			for (uint32_t i = 0; i < header.size; i++) {
+				record[i] = ring->data[(head + i) % RING_SIZE];
+			}
+			pending.push(decode(record.data()));
+			head += header.size;
+			found = true;
+		}
+		ring->head.store(head, memory_order_release);
+	}
+	return found;
+}
+
+/*
+	Write out pending records that are next in log order, text to stdout and
+	completions to the binary log if there is one, in one write each.
+	Caller holds ringsMutex.
+*/
+void Logger::flushPending() {
+	string text, binary;
+	while (!pending.empty() && pending.top().seq == written) {
+		const Pending &p = pending.top();
+		if (p.kind != RECORD_COMPLETION) {
+			text += p.text;
+		}
+		else if (binaryFd != -1) {
+			binary.append((const char *) &p.completion.event, sizeof(LogCompletion));
+		}
+		else {
+			ostringstream line;
+			formatCompletion(line, *p.completion.name, p.completion.event);
+			text += line.str();
+		}
+		pending.pop();
+		written++;
+	}
+	writeOut(STDOUT_FILENO, text);
+	writeOut(binaryFd, binary);
+}
+
+/* Write the whole buffer to fd */
+void Logger::writeOut(int fd, const string &buffer) {
+	for (size_t done = 0; done < buffer.size(); ) {
+		ssize_t n = ::write(fd, buffer.data() + done, buffer.size() - done);
+		if (n <= 0) {
+			return;
+		}
+		done += n;
+	}
+}
+
+/*
+	Writer thread: drains the rings and writes out what it found, sleeping
+	between rounds so records from busy periods go out in large batches.
+	Exits once stopped and everything logged has been written.
+*/
+void *Logger::run(void *arg) {
+	Logger *logger = (Logger *) arg;
+	struct timespec delay = {0, 1000000};
+	while (true) {
+		bool stopping = !logger->running;
+		pthread_mutex_lock(&logger->ringsMutex);
+		bool found = logger->drain();
+		logger->flushPending();
+		pthread_mutex_unlock(&logger->ringsMutex);
+		if (stopping && logger->written == logger->nextSeq) {
+			break;
+		}
+		if (!found) {
+			nanosleep(&delay, nullptr);
+		}
+	}
+	return nullptr;
+}
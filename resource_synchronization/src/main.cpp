@@ -1,72 +1,269 @@
 #include "../include/task_manager.h"
+#include "../include/executor.h"
+#include "../include/coroutine.h"
+#include "../include/simulator.h"
+#include "../include/placement.h"
+#include <sys/resource.h>
+#include <unistd.h>
 
 
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 TaskManager manager;
 struct timespec start;
 int monitorTime;
 int nIter;
+// How tasks are run
+enum ExecMode {
+	EXEC_THREADS,	// a thread per task running doTask
+	EXEC_POOL,	// Executor steps tasks on a worker pool
+	EXEC_CORO,	// coTask bodies on a CoExecutor (C++20 build only)
+	EXEC_SIM	// discrete-event simulation on a virtual clock
+};
+ExecMode execMode = EXEC_THREADS;
+int numWorkers = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+unsigned seed = 0;
+int pinCores = 0;	// cores to pin threads to; 0 leaves them free
+unique_ptr<Placement> placement;
 
 // Function prototypes for task threads and monitor thread
 void *doTask(void *taskNum);
 void *doMonitor(void *_);
+void runTaskThreads();
+void finishLeasedIteration(Task &task, bool &leased);
+#ifdef __cpp_impl_coroutine
+CoTask coTask(Task &task);
+#endif
 
 
 /*
 	Parses the inputFile into a TaskManager. Creates monitor thread and
-	task threads. Prints out the TaskManager details at end.
+	task threads, or runs the tasks on a worker pool. Prints out the
+	TaskManager details at end.
+	Options:
+		-w poll|cond	how tasks wait for resources (default: cond)
+		-l global|fine|atomic
+				one mutex for all resources, a lock per resource, or
+				lock-free atomic counters (default: global; fine and
+				atomic ignore -w)
+		-s greedy|fifo|priority|aging
+				order waiting tasks are granted resources in (default:
+				greedy; others need -l global -w cond)
+		-b		check every grant with the Banker's algorithm so tasks
+				that acquire in phases can't deadlock (needs -l global
+				-w cond, as do phased tasks)
+		-x threads|pool|coro|sim
+				one thread per task, tasks driven as state machines
+				by a fixed pool of workers, tasks written as
+				coroutines on a pool, or a single-threaded
+				simulation on a virtual clock that takes no real time
+				to sleep (default: threads; the others need -l global
+				and ignore -w; coro needs main_coro)
+		-n numWorkers	pool size (default: hardware concurrency)
+		-r seed		with -x sim, draw busy and idle periods at random
+				around the task's times; a seed always replays the
+				same run (default: 0, exact times)
+		-t waitTimeout	give up waiting for resources after waitTimeout ms and
+				retry after idleTime (needs -l global and -w cond, or
+				a pool)
+		-L leaseIterations
+				let a task keep its resources for up to
+				leaseIterations consecutive iterations before handing
+				them to waiting tasks (needs -l global and -w cond,
+				or a pool)
+		-Y		end a lease as soon as another task waits for the
+				resources it holds
+		-P numCores	pin task threads, or pool workers, to the first
+				numCores cores, keeping tasks that share resources
+				on the same NUMA node
+		-S poolName	draw resources from the shared memory pool poolName,
+				creating it from inputFile's resources if no other
+				process has; tasks of every attached process share
+				it, and the units of a process that dies are
+				returned (replaces -l, ignores -w)
+		-B logFile	write task completions to logFile in the binary log
+				format instead of stdout (read back with
+				resource_bench decode logFile)
+	Every sleep and timeout is a timer on the manager's TimerWheel, and all
+	output while tasks run goes through the manager's asynchronous Logger.
 */
 int main (int argc, char *argv[]) {
-	if(argc != 4) {
-		cerr << "Incorrect Usage: main inputFile monitorTime NITER" << endl;
+	const char *usage = "Incorrect Usage: main inputFile monitorTime NITER [-w poll|cond] [-l global|fine|atomic] [-s greedy|fifo|priority|aging] [-b] [-x threads|pool|coro|sim] [-n numWorkers] [-r seed] [-t waitTimeout] [-L leaseIterations] [-Y] [-P numCores] [-S poolName] [-B logFile]";
+	int opt;
+	Scheduler *policy;
+	const char *binaryLog = nullptr;
+	string poolName;
+	while ((opt = getopt(argc, argv, "w:l:s:bx:n:r:t:L:YP:S:B:")) != -1) {
+		if (opt == 'w' && string(optarg) == "poll") {
+			manager.waitMode = WAIT_POLL;
+		}
+		else if (opt == 'w' && string(optarg) == "cond") {
+			manager.waitMode = WAIT_COND;
+		}
+		else if (opt == 'l' && string(optarg) == "global") {
+			manager.lockMode = LOCK_GLOBAL;
+		}
+		else if (opt == 'l' && string(optarg) == "fine") {
+			manager.lockMode = LOCK_FINE;
+		}
+		else if (opt == 'l' && string(optarg) == "atomic") {
+			manager.lockMode = LOCK_ATOMIC;
+		}
+		else if (opt == 's' && (policy = createScheduler(optarg)) != nullptr) {
+			manager.scheduler.reset(policy);
+		}
+		else if (opt == 'b') {
+			manager.bankers = true;
+		}
+		else if (opt == 'x' && string(optarg) == "threads") {
+			execMode = EXEC_THREADS;
+		}
+		else if (opt == 'x' && string(optarg) == "pool") {
+			execMode = EXEC_POOL;
+		}
+		else if (opt == 'x' && string(optarg) == "sim") {
+			execMode = EXEC_SIM;
+		}
+#ifdef __cpp_impl_coroutine
+		else if (opt == 'x' && string(optarg) == "coro") {
+			execMode = EXEC_CORO;
+		}
+#endif
+		else if (opt == 'n' && atoi(optarg) > 0) {
+			numWorkers = atoi(optarg);
+		}
+		else if (opt == 'r') {
+			seed = strtoul(optarg, nullptr, 10);
+		}
+		else if (opt == 't' && atoi(optarg) > 0) {
+			manager.waitTimeout = atoi(optarg);
+		}
+		else if (opt == 'L' && atoi(optarg) > 0) {
+			manager.leaseIterations = atoi(optarg);
+		}
+		else if (opt == 'Y') {
+			manager.leaseYields = true;
+		}
+		else if (opt == 'P' && atoi(optarg) > 0) {
+			pinCores = atoi(optarg);
+		}
+		else if (opt == 'S' && optarg[0] != '\0') {
+			// POSIX shared memory names start with a slash
+			poolName = optarg[0] == '/' ? optarg : "/" + string(optarg);
+			manager.lockMode = LOCK_SHARED;
+		}
+		else if (opt == 'B') {
+			binaryLog = optarg;
+		}
+		else {
+			cerr << usage << endl;
+			return EXIT_FAILURE;
+		}
+	}
+	if(argc - optind != 3) {
+		cerr << usage << endl;
+		return EXIT_FAILURE;
+	}
+	// Schedulers, phases and Banker's all work on TaskManager's wait queue
+	bool queuesWaiters = manager.lockMode == LOCK_GLOBAL && (execMode != EXEC_THREADS || manager.waitMode == WAIT_COND);
+	if (string(manager.scheduler->getName()) != "greedy" && !queuesWaiters) {
+		cerr << "Scheduling policy " << manager.scheduler->getName() << " needs -l global -w cond" << endl;
+		return EXIT_FAILURE;
+	}
+	if (manager.waitTimeout > 0 && !queuesWaiters) {
+		cerr << "Wait timeouts need -l global and -w cond, or a pool" << endl;
+		return EXIT_FAILURE;
+	}
+	if (manager.leaseIterations > 1 && !queuesWaiters) {
+		cerr << "Leases need -l global and -w cond, or a pool" << endl;
+		return EXIT_FAILURE;
+	}
+	if (execMode != EXEC_THREADS && manager.lockMode != LOCK_GLOBAL) {
+		cerr << "Pool executors and simulation need -l global" << endl;
 		return EXIT_FAILURE;
 	}
 
-	const char *inputFile = argv[1];
-	monitorTime = atoi(argv[2]);
-	nIter = atoi(argv[3]);
+	const char *inputFile = argv[optind];
+	monitorTime = atoi(argv[optind + 1]);
+	nIter = atoi(argv[optind + 2]);
 	cout << "main: inputFile=" << inputFile << ", monitorTime=" << monitorTime << ", nIter=" << nIter << endl;
 
 	// Read resources and tasks from input file
 	manager.parseInput(inputFile);
+	if (manager.lockMode == LOCK_SHARED && !manager.attachShared(poolName)) {
+		return EXIT_FAILURE;
+	}
+	if ((manager.bankers || manager.hasPhasedTasks()) && !queuesWaiters) {
+		cerr << "Phased tasks and -b need -l global -w cond" << endl;
+		return EXIT_FAILURE;
+	}
+	if (pinCores > 0) {
+		placement.reset(new Placement(manager, pinCores));
+		placement->print(manager);
+	}
 	clock_gettime(CLOCK_MONOTONIC, &start);	
-	pthread_t tidMonitor;
-	pthread_t tids[manager.getNumTasks()];
-	int taskNums[manager.getNumTasks()];
-
-	for (int i = 0; i < manager.getNumTasks(); i++) {
-		taskNums[i] = i;
+	if (binaryLog != nullptr) {
+		vector<string> names;
+		for (const Task &task : manager.tasks) {
+			names.push_back(task.name);
+		}
+		if (!manager.logger.openBinary(binaryLog, names)) {
+			return EXIT_FAILURE;
+		}
 	}
+	manager.logger.start();
+	if (execMode == EXEC_SIM) {
+		// Monitor reports are events on the virtual clock; nothing else runs
+		Simulator simulator(manager, nIter, monitorTime, seed);
+		bool finished = simulator.run();
+		manager.logger.stop();
+		if (!finished) {
+			simulator.printDeadlock();
+		}
+		manager.printResources();
+		manager.printTasks();
 
-	// Lock until monitor thread and task threads are created
-	pthread_mutex_lock(&mutex); 
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		cout << "Simulated time= " << simulator.getTime() << " ms" << endl;
+		cout << "Running time= " << manager.getDuration(start, end) << " ms" << endl;
+		manager.printThroughput(simulator.getTime());
+		return finished ? 0 : EXIT_FAILURE;
+	}
+	manager.timers.start();
+	pthread_t tidMonitor;
 	int err = pthread_create(&tidMonitor, nullptr, doMonitor, nullptr);
 	if (err != 0) {
 		cerr << "Error creating monitor thread" << endl;
 		exit(EXIT_FAILURE);
 	}
-	for (int i = 0; i < manager.getNumTasks(); i++) {
-		int err = pthread_create(&tids[i], nullptr, doTask, (void *)&taskNums[i]);
-		if (err != 0) {
-			cerr << "Error creating task thread" << endl;
-			exit(EXIT_FAILURE);
+
+	if (execMode == EXEC_POOL) {
+		Executor executor(manager, numWorkers, nIter, start);
+		if (placement) {
+			executor.pinWorkers(placement->getCpus());
 		}
+		executor.run();
 	}
-	pthread_mutex_unlock(&mutex);
-
-	// Join task threads
-	for (int i = 0; i < manager.getNumTasks(); i++) {
-		int err = pthread_join(tids[i], nullptr);
-		if (err != 0) {
-			cerr << "Error joiining task thread" << endl;
-			exit(EXIT_FAILURE);
+#ifdef __cpp_impl_coroutine
+	else if (execMode == EXEC_CORO) {
+		CoExecutor executor(manager, numWorkers);
+		if (placement) {
+			executor.pinWorkers(placement->getCpus());
 		}
-	} 
+		for (Task &task : manager.tasks) {
+			executor.spawn(coTask(task));
+		}
+		executor.run();
+	}
+#endif
+	else {
+		runTaskThreads();
+	}
 
 	// Cancel monitor when it's done printing and when tasks threads are complete
-	pthread_mutex_lock(&mutex);
 	pthread_cancel(tidMonitor);
-	pthread_mutex_unlock(&mutex);
+	pthread_join(tidMonitor, nullptr);
+	manager.timers.stop();
+	manager.logger.stop();
 
 	// Print TaskManager details
 	manager.printResources();
@@ -76,80 +273,269 @@ int main (int argc, char *argv[]) {
 	struct timespec end;
 	clock_gettime(CLOCK_MONOTONIC, &end);
 	cout << "Running time= " << manager.getDuration(start, end) << " ms" << endl;    
+	manager.printThroughput(manager.getDuration(start, end));
+
+	// Print how quickly waiting tasks ran and the CPU time it cost
+	struct rusage rusage;
+	getrusage(RUSAGE_SELF, &rusage);
+	manager.printWakeups();
+	manager.timers.printStats();
+	cout << "CPU time= user " << rusage.ru_utime.tv_sec * 1000 + rusage.ru_utime.tv_usec / 1000.0 
+		<< " ms, sys " << rusage.ru_stime.tv_sec * 1000 + rusage.ru_stime.tv_usec / 1000.0 << " ms" << endl;
 
 	return 0;
 }
 
+/*
+	Creates a thread for every task and joins them once all are done.
+*/
+void runTaskThreads() {
+	vector<pthread_t> tids(manager.getNumTasks());
+	vector<int> taskNums(manager.getNumTasks());
+
+	for (int i = 0; i < manager.getNumTasks(); i++) {
+		taskNums[i] = i;
+	}
+
+	// Lock until task threads are created
+	manager.lockMutex(); 
+	for (int i = 0; i < manager.getNumTasks(); i++) {
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		if (placement) {
+			Placement::pin(attr, placement->cpuForTask(i));
+		}
+		int err = pthread_create(&tids[i], &attr, doTask, (void *)&taskNums[i]);
+		pthread_attr_destroy(&attr);
+		if (err != 0) {
+			cerr << "Error creating task thread" << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+	pthread_mutex_unlock(&manager.mutex);
+
+	// Join task threads
+	for (int i = 0; i < manager.getNumTasks(); i++) {
+		int err = pthread_join(tids[i], nullptr);
+		if (err != 0) {
+			cerr << "Error joiining task thread" << endl;
+			exit(EXIT_FAILURE);
+		}
+	} 
+}
+
 /*
 	A task thread repeatedly attempts to acquire all resource units needed 
 	by the task, holds the resources for busyTime millisec, releases all held 
 	resources, and then enters an idle period of idleTime millisec. Done nIter times.
-	Changes to the TaskManager are protected by locking a mutex.
+	Changes to the TaskManager are protected by locking a mutex. Depending on
+	the wait mode, a task either blocks in acquireResources or polls until
+	its resources are available. With per-resource locks, atomic counters
+	or a shared pool, mutex only guards task state and output, so tasks with
+	disjoint resources run in parallel. A task on a lease keeps its resources through
+	its idle period and into the next iteration without asking again.
 */
 void *doTask(void *taskNum) {
 	Task &task = manager.tasks[*((int*) taskNum)];
 	task.tid = pthread_self();
-	struct timespec end, waitStart, waitEnd, delay;
-	manager.setTimespec(10, delay); // 10ms delay before trying again
-	clock_gettime(CLOCK_MONOTONIC, &waitStart);
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &task.waitStart);
+	bool leased = false;
 
     while (task.iter < nIter) {
-        pthread_mutex_lock(&mutex);
-        if (manager.resourcesAreAvailable(task)) {
-			if (task.status == "WAIT") {
-				// Wait period done; add time spent waiting
-				clock_gettime(CLOCK_MONOTONIC, &waitEnd);
-				task.timeSpentWaiting += manager.getDuration(waitStart, waitEnd);
-			}
+        if (leased) {
+        	// Still holding everything from the last iteration
+        	manager.timers.sleep(task.phaseTime);
+        	manager.timers.sleep(task.idleTime);
+        	finishLeasedIteration(task, leased);
+        	continue;
+        }
+
+        bool acquired = false;
+        bool timedOut = false;
+        if (manager.lockMode == LOCK_FINE) {
+        	manager.acquireResourcesFine(task);
+        	manager.lockMutex();
+        	acquired = true;
+        }
+        else if (manager.lockMode == LOCK_ATOMIC) {
+        	manager.acquireResourcesAtomic(task);
+        	manager.lockMutex();
+        	acquired = true;
+        }
+        else if (manager.lockMode == LOCK_SHARED) {
+        	manager.acquireResourcesShared(task);
+        	manager.lockMutex();
+        	acquired = true;
+        }
+        else {
+        	manager.lockMutex();
+        	if (manager.waitMode == WAIT_COND) {
+        		acquired = manager.acquireResources(task);
+        		timedOut = !acquired;
+        	}
+        	else if (manager.canGrant(task)) {
+        		manager.grabResources(task);
+        		acquired = true;
+        	}
+        }
+
+        if (acquired) {
+			manager.endWait(task);
 			
 			// Simulate running task; hold necessary resources for busyTime  
-			manager.grabResources(task);
-			task.status = "RUN";
-			pthread_mutex_unlock(&mutex);
-			nanosleep(&(task.busyTimespec), NULL);
+			task.status = STATUS_RUN;
+			pthread_mutex_unlock(&manager.mutex);
+
+			// A phased task holds each phase for its share of busyTime, then
+			// blocks for the resources of the next phase
+			for (uint phase = 1; phase < task.phases.size(); phase++) {
+				manager.timers.sleep(task.phaseTime);
+				manager.lockMutex();
+				manager.acquireResources(task);
+				manager.endWait(task);
+				task.status = STATUS_RUN;
+				pthread_mutex_unlock(&manager.mutex);
+			}
+			manager.timers.sleep(task.phaseTime);
+
+			if (manager.canLease(task)) {
+				manager.timers.sleep(task.idleTime);
+				finishLeasedIteration(task, leased);
+				continue;
+			}
 
 			// Simulate idle task; release resources for idleTime
-			pthread_mutex_lock(&mutex);
-			manager.releaseResources(task);
-			task.status = "IDLE";
-			pthread_mutex_unlock(&mutex);
-			nanosleep(&(task.idleTimespec), NULL);
+			if (manager.lockMode == LOCK_FINE) {
+				manager.releaseResourcesFine(task);
+				manager.lockMutex();
+			}
+			else if (manager.lockMode == LOCK_ATOMIC) {
+				manager.releaseResourcesAtomic(task);
+				manager.lockMutex();
+			}
+			else if (manager.lockMode == LOCK_SHARED) {
+				manager.releaseResourcesShared(task);
+				manager.lockMutex();
+			}
+			else {
+				manager.lockMutex();
+				manager.releaseResources(task);
+			}
+			task.status = STATUS_IDLE;
+			pthread_mutex_unlock(&manager.mutex);
+			manager.timers.sleep(task.idleTime);
 
 			// Iteration complete
 			clock_gettime(CLOCK_MONOTONIC, &end);
-			pthread_mutex_lock(&mutex);
+			manager.lockMutex();
 			task.iter++;
-			cout << "task complete: " << task.name << " (iter= " << task.iter << ", time= " << manager.getDuration(start, end) << " ms)" << endl;
-			pthread_mutex_unlock(&mutex);
+			pthread_mutex_unlock(&manager.mutex);
+			// Logged without the mutex; the logger's writer thread does the output
+			manager.logger.writeCompletion(task.index, task.name, task.iter, manager.getDuration(start, end));
+        }
+        else if (timedOut) {
+        	// Gave up waiting; back off for idleTime before asking again
+        	pthread_mutex_unlock(&manager.mutex);
+        	manager.timers.sleep(task.idleTime);
         }
         else {
-        	if (task.status != "WAIT") {
+        	if (task.status != STATUS_WAIT) {
         		// Start wait period
-				task.status = "WAIT";
-				clock_gettime(CLOCK_MONOTONIC, &waitStart);
-				nanosleep(&delay, NULL);
+				task.status = STATUS_WAIT;
+				clock_gettime(CLOCK_MONOTONIC, &task.waitStart);
+				manager.timers.sleep(10); // 10ms delay before trying again
         	}
-        	pthread_mutex_unlock(&mutex);
+        	pthread_mutex_unlock(&manager.mutex);
         } 
     }
 	pthread_exit((void *) 0);
 }
 
+/*
+	Ends an iteration of a leasing task once its idle period, spent still
+	holding its resources, is over: counts the iteration and renews the
+	lease or releases the resources, all in one critical section, or with
+	none at all while the lease has renewals left.
+*/
+void finishLeasedIteration(Task &task, bool &leased) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	task.iter++;
+	leased = task.iter < nIter && manager.renewLeaseUnlocked(task);
+	if (!leased) {
+		manager.lockMutex();
+		leased = task.iter < nIter && manager.renewLease(task);
+		if (!leased) {
+			manager.releaseResources(task);
+			task.status = STATUS_IDLE;
+		}
+		pthread_mutex_unlock(&manager.mutex);
+	}
+	manager.logger.writeCompletion(task.index, task.name, task.iter, manager.getDuration(start, end));
+}
+
+#ifdef __cpp_impl_coroutine
+/*
+	The task cycle of doTask written as a coroutine: every wait for
+	resources or time suspends the body instead of blocking a thread.
+*/
+CoTask coTask(Task &task) {
+	bool leased = false;
+	while (task.iter < nIter) {
+		if (leased) {
+			// Still holding everything from the last iteration
+			co_await sleepFor(task.phaseTime);
+			co_await sleepFor(task.idleTime);
+			finishLeasedIteration(task, leased);
+			continue;
+		}
+		if (!co_await manager.acquire(task)) {
+			// Gave up waiting; back off for idleTime before asking again
+			co_await sleepFor(task.idleTime);
+			continue;
+		}
+
+		// Hold each phase for its share of busyTime, then take the next
+		for (uint phase = 1; phase < task.phases.size(); phase++) {
+			co_await sleepFor(task.phaseTime);
+			co_await manager.acquire(task);
+		}
+		co_await sleepFor(task.phaseTime);
+		if (manager.canLease(task)) {
+			co_await sleepFor(task.idleTime);
+			finishLeasedIteration(task, leased);
+			continue;
+		}
+
+		// Release resources for idleTime
+		co_await manager.release(task);
+		co_await sleepFor(task.idleTime);
+
+		// Iteration complete
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		manager.lockMutex();
+		task.iter++;
+		pthread_mutex_unlock(&manager.mutex);
+		manager.logger.writeCompletion(task.index, task.name, task.iter, manager.getDuration(start, end));
+	}
+}
+#endif
+
 /*
 	Prints TaskManager details every monitorTime milliseconds so that 
 	the tasks can be monitored from standard output.
 */
 void *doMonitor(void *_) {
-	struct timespec delay;
-	manager.setTimespec(monitorTime, delay);
-
 	// Continuously print until thread is cancelled
 	while (true) {
-		// Lock so task threads can't change states while the monitor is printing
-		pthread_mutex_lock(&mutex);
+		// Task states are read without the mutex so printing never stalls tasks;
+		// only the sleep below may be cancelled, never a half-written report
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
 		manager.printMonitor();
-		pthread_mutex_unlock(&mutex);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, nullptr);
 		// Print every monitorTime interval
-		nanosleep(&delay, NULL);
+		manager.timers.sleep(monitorTime);
 	}
 }
@@ -0,0 +1,184 @@
+#include "../include/placement.h"
+#include <dirent.h>
+#include <sched.h>
+
+/*
+	Picks the cores to use and assigns every task a core. Tasks are grouped
+	by the resources they share, and the largest groups go first to the
+	node with the fewest tasks per core.
+*/
+Placement::Placement(TaskManager &manager, int numCores) {
+	for (const vector<int> &node : readNodes()) {
+		vector<int> used;
+		for (int cpu : node) {
+			if ((int) cpus.size() < numCores) {
+				used.push_back(cpu);
+				cpus.push_back(cpu);
+			}
+		}
+		if (!used.empty()) {
+			nodes.push_back(used);
+		}
+	}
+
+	// Union tasks that need a common resource
+	int numTasks = manager.getNumTasks();
+	vector<int> parent(numTasks);
+	for (int t = 0; t < numTasks; t++) {
+		parent[t] = t;
+	}
+	function<int(int)> find = [&parent, &find](int t) {
+		return parent[t] == t ? t : parent[t] = find(parent[t]);
+	};
+	vector<int> firstUser(manager.getNumResources(), -1);
+	for (int t = 0; t < numTasks; t++) {
+		for (const auto& need : manager.tasks[t].needs) {
+			if (need.second == 0) {
+				continue;
+			}
+			if (firstUser[need.first] == -1) {
+				firstUser[need.first] = t;
+			}
+			else {
+				parent[find(t)] = find(firstUser[need.first]);
+			}
+		}
+	}
+	unordered_map<int, vector<int>> groupsByRoot;
+	for (int t = 0; t < numTasks; t++) {
+		groupsByRoot[find(t)].push_back(t);
+	}
+	vector<vector<int>> groups;
+	for (auto &group : groupsByRoot) {
+		groups.push_back(move(group.second));
+	}
+	// Largest first, ties in task order so placement is repeatable
+	sort(groups.begin(), groups.end(), [](const vector<int> &a, const vector<int> &b) {
+		return a.size() != b.size() ? a.size() > b.size() : a[0] < b[0];
+	});
+
+	taskCpus.assign(numTasks, -1);
+	taskNodes.assign(numTasks, -1);
+	if (nodes.empty()) {
+		return;
+	}
+	vector<int> load(nodes.size(), 0);
+	for (const vector<int> &group : groups) {
+		uint best = 0;
+		for (uint n = 1; n < nodes.size(); n++) {
+			if ((double) load[n] / nodes[n].size() < (double) load[best] / nodes[best].size()) {
+				best = n;
+			}
+		}
+		for (int t : group) {
+			taskNodes[t] = best;
+			taskCpus[t] = nodes[best][load[best] % nodes[best].size()];
+			load[best]++;
+		}
+	}
+}
+
+/* Core the task's thread runs on, or -1 if none could be found */
+int Placement::cpuForTask(int task) {
+	return taskCpus[task];
+}
+
+const vector<int> &Placement::getCpus() {
+	return cpus;
+}
+
+/* Print the cores used on each node and the tasks placed there */
+void Placement::print(TaskManager &manager) {
+	for (uint n = 0; n < nodes.size(); n++) {
+		cout << "Placement: node " << n << " cores";
+		for (int cpu : nodes[n]) {
+			cout << " " << cpu;
+		}
+		cout << ", tasks";
+		for (int t = 0; t < manager.getNumTasks(); t++) {
+			if (taskNodes[t] == (int) n) {
+				cout << " " << manager.tasks[t].name;
+			}
+		}
+		cout << "\n";
+	}
+	cout << flush;
+}
+
+/* Make threads created with attr run only on cpu; -1 leaves them free */
+void Placement::pin(pthread_attr_t &attr, int cpu) {
+	if (cpu < 0) {
+		return;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+}
+
+/*
+	Cores this process may run on, grouped by NUMA node as listed under
+	/sys/devices/system/node. Without that, all of them form one node.
+*/
+vector<vector<int>> Placement::readNodes() {
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+
+	vector<pair<int, vector<int>>> numbered;
+	DIR *dir = opendir("/sys/devices/system/node");
+	if (dir != nullptr) {
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != nullptr) {
+			string name = entry->d_name;
+			if (name.compare(0, 4, "node") != 0 || name.size() == 4 || !isdigit(name[4])) {
+				continue;
+			}
+			ifstream cpuList("/sys/devices/system/node/" + name + "/cpulist");
+			string list;
+			getline(cpuList, list);
+			numbered.push_back({atoi(name.c_str() + 4), parseCpuList(list)});
+		}
+		closedir(dir);
+	}
+	sort(numbered.begin(), numbered.end());
+	if (numbered.empty()) {
+		numbered.push_back({0, {}});
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			numbered[0].second.push_back(cpu);
+		}
+	}
+
+	vector<vector<int>> nodes;
+	for (const auto &node : numbered) {
+		vector<int> usable;
+		for (int cpu : node.second) {
+			if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+				usable.push_back(cpu);
+			}
+		}
+		if (!usable.empty()) {
+			nodes.push_back(usable);
+		}
+	}
+	return nodes;
+}
+
+/* Parse a kernel cpu list such as "0-3,8-11" */
+vector<int> Placement::parseCpuList(const string &list) {
+	vector<int> cpus;
+	stringstream ranges(list);
+	string range;
+	while (getline(ranges, range, ',')) {
+		if (range.empty()) {
+			continue;
+		}
+		size_t dash = range.find('-');
+		int first = atoi(range.c_str());
+		int last = dash == string::npos ? first : atoi(range.c_str() + dash + 1);
+		for (int cpu = first; cpu <= last; cpu++) {
+			cpus.push_back(cpu);
+		}
+	}
+	return cpus;
+}
@@ -0,0 +1,84 @@
+#include "../include/scheduler.h"
+
+/* Create the scheduler with the given name, or nullptr if there is none */
+Scheduler *createScheduler(const string &name) {
+	if (name == "greedy") {
+		return new GreedyScheduler();
+	}
+	if (name == "fifo") {
+		return new FifoScheduler();
+	}
+	if (name == "priority") {
+		return new PriorityScheduler();
+	}
+	if (name == "aging") {
+		return new AgingScheduler(100);
+	}
+	return nullptr;
+}
+
+const char *GreedyScheduler::getName() {
+	return "greedy";
+}
+
+bool GreedyScheduler::ranksAhead(const Task &a, const Task &b, struct timespec &now) {
+	return a.ticket < b.ticket;
+}
+
+bool GreedyScheduler::isStrict() {
+	return false;
+}
+
+const char *FifoScheduler::getName() {
+	return "fifo";
+}
+
+bool FifoScheduler::ranksAhead(const Task &a, const Task &b, struct timespec &now) {
+	return a.ticket < b.ticket;
+}
+
+bool FifoScheduler::isStrict() {
+	return true;
+}
+
+const char *PriorityScheduler::getName() {
+	return "priority";
+}
+
+/* Higher priority first; equal priorities in ticket order */
+bool PriorityScheduler::ranksAhead(const Task &a, const Task &b, struct timespec &now) {
+	if (a.priority != b.priority) {
+		return a.priority > b.priority;
+	}
+	return a.ticket < b.ticket;
+}
+
+bool PriorityScheduler::isStrict() {
+	return true;
+}
+
+AgingScheduler::AgingScheduler(int agingTime) : agingTime(agingTime) {}
+
+const char *AgingScheduler::getName() {
+	return "aging";
+}
+
+/* Static priority plus one level per agingTime ms spent waiting */
+double AgingScheduler::getEffectivePriority(const Task &task, struct timespec &now) {
+	double waited = (now.tv_sec - task.waitStart.tv_sec) * 1000 + (now.tv_nsec - task.waitStart.tv_nsec) / 1E6;
+	return task.priority + waited / agingTime;
+}
+
+/* Higher effective priority first; equal priorities in ticket order */
+bool AgingScheduler::ranksAhead(const Task &a, const Task &b, struct timespec &now) {
+	double priorityA = getEffectivePriority(a, now);
+	double priorityB = getEffectivePriority(b, now);
+	if (priorityA != priorityB) {
+		return priorityA > priorityB;
+	}
+	return a.ticket < b.ticket;
+}
+
+bool AgingScheduler::isStrict() {
+	return true;
+}
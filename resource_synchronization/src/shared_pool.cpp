@@ -0,0 +1,327 @@
+#include "../include/shared_pool.h"
+#include <cerrno>
+#include <cstring>
+#include <climits>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <unistd.h>
+
+// Written to the segment once it is initialized; "RSPOOL" and a version
+static const uint64_t SHARED_MAGIC = 0x52535f504f4f4c01ULL;
+
+// Units of each resource held by the tasks of one process
+struct SharedHolder {
+	pid_t pid;		// 0 when the slot is free
+	int held[SHARED_MAX_RESOURCES];
+};
+
+// Layout of the shared memory segment. It starts zeroed, as ftruncate
+// leaves it, and only plain data and lock-free atomics live in it.
+struct SharedSegment {
+	atomic<uint64_t> ready;	// SHARED_MAGIC once the creator set it up
+	int numResources;
+	char names[SHARED_MAX_RESOURCES][SHARED_NAME_SIZE];
+	int maxResources[SHARED_MAX_RESOURCES];
+	int available[SHARED_MAX_RESOURCES];
+	int attached;		// processes with a slot
+
+	alignas(CACHE_LINE) pthread_mutex_t mutex;
+	// The wait queue: waiters sleep on the futex word, which every release
+	// bumps. A futex keeps no record of its waiters, so unlike a shared
+	// condition variable it can't be left broken by one that was killed.
+	alignas(CACHE_LINE) atomic<uint32_t> releases;
+	atomic<int> waiters;	// may overcount after a crash, which only costs a wakeup
+
+	SharedHolder holders[SHARED_MAX_PROCESSES];
+};
+
+// A lock-free atomic is address-free, so it works across processes; the
+// futex also needs releases to be laid out as a plain 32-bit word
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LONG_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+	"shared pool atomics must be lock-free");
+static_assert(sizeof(atomic<uint32_t>) == sizeof(uint32_t) && sizeof(atomic<uint64_t>) == sizeof(uint64_t),
+	"shared pool atomics must have the size of the integers they hold");
+
+/* Sleep while *word == expected, for at most ms; returns false on timeout */
+static bool futexWait(atomic<uint32_t> &word, uint32_t expected, int ms) {
+	struct timespec timeout = {ms / 1000, (ms % 1000) * 1000000L};
+	return syscall(SYS_futex, (uint32_t *) &word, FUTEX_WAIT, expected, &timeout, nullptr, 0) == 0 || errno != ETIMEDOUT;
+}
+
+SharedPool::~SharedPool() {
+	detach();
+}
+
+/*
+	Maps the pool called name (e.g. "/pool"), creating it with the given
+	resources if it doesn't exist yet, and takes a holder slot for this
+	process. A joining process uses the counts the creator set; its own
+	resources are looked up by name with find. Returns false if the pool
+	can't be mapped or has no slot left.
+*/
+bool SharedPool::attach(const string &name, const vector<string> &names, const vector<int> &amounts) {
+	if (names.size() > SHARED_MAX_RESOURCES) {
+		cerr << "A shared pool holds at most " << SHARED_MAX_RESOURCES << " resources" << endl;
+		return false;
+	}
+	this->name = name;
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	creator = fd != -1;
+	if (!creator && errno == EEXIST) {
+		fd = shm_open(name.c_str(), O_RDWR, 0);
+	}
+	if (fd == -1 || (creator && ftruncate(fd, sizeof(SharedSegment)) == -1)) {
+		cerr << "Failed to open shared pool " << name << ": " << strerror(errno) << endl;
+		if (creator) {
+			shm_unlink(name.c_str());
+		}
+		if (fd != -1) {
+			close(fd);
+		}
+		return false;
+	}
+
+	// A joiner may get in between the creator's shm_open and its ftruncate
+	struct stat info;
+	for (int tries = 0; !creator && fstat(fd, &info) == 0 && info.st_size == 0 && tries < 1000; tries++) {
+		usleep(1000);
+	}
+	if (!creator && (fstat(fd, &info) == -1 || info.st_size != sizeof(SharedSegment))) {
+		cerr << "Not a shared resource pool: " << name << endl;
+		close(fd);
+		return false;
+	}
+	void *mapped = mmap(nullptr, sizeof(SharedSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		cerr << "Failed to map shared pool " << name << endl;
+		return false;
+	}
+	segment = (SharedSegment *) mapped;
+
+	if (creator) {
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+		pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+		pthread_mutex_init(&segment->mutex, &attr);
+		pthread_mutexattr_destroy(&attr);
+		segment->numResources = names.size();
+		for (uint i = 0; i < names.size(); i++) {
+			strncpy(segment->names[i], names[i].c_str(), SHARED_NAME_SIZE - 1);
+			segment->maxResources[i] = amounts[i];
+			segment->available[i] = amounts[i];
+		}
+		segment->ready.store(SHARED_MAGIC, memory_order_release);
+	}
+	else {
+		for (int tries = 0; segment->ready.load(memory_order_acquire) != SHARED_MAGIC && tries < 1000; tries++) {
+			usleep(1000);
+		}
+		if (segment->ready.load(memory_order_acquire) != SHARED_MAGIC) {
+			cerr << "Shared pool " << name << " was never initialized" << endl;
+			munmap(segment, sizeof(SharedSegment));
+			segment = nullptr;
+			return false;
+		}
+	}
+
+	lock();
+	reclaimDead();
+	for (int s = 0; s < SHARED_MAX_PROCESSES && slot == -1; s++) {
+		if (segment->holders[s].pid == 0) {
+			slot = s;
+		}
+	}
+	if (slot != -1) {
+		SharedHolder &holder = segment->holders[slot];
+		holder.pid = getpid();
+		memset(holder.held, 0, sizeof(holder.held));
+		segment->attached++;
+	}
+	unlock();
+	if (slot == -1) {
+		cerr << "Shared pool " << name << " has no free process slot" << endl;
+		munmap(segment, sizeof(SharedSegment));
+		segment = nullptr;
+		return false;
+	}
+	return true;
+}
+
+/*
+	Returns whatever this process still holds, frees its slot and unmaps
+	the pool. The last process to detach removes the segment.
+*/
+void SharedPool::detach() {
+	if (segment == nullptr) {
+		return;
+	}
+	lock();
+	SharedHolder &holder = segment->holders[slot];
+	for (int r = 0; r < segment->numResources; r++) {
+		segment->available[r] += holder.held[r];
+		holder.held[r] = 0;
+	}
+	holder.pid = 0;
+	bool last = --segment->attached <= 0;
+	if (last) {
+		segment->ready.store(0, memory_order_release);
+	}
+	segment->releases++;
+	unlock();
+	wakeWaiters();
+	munmap(segment, sizeof(SharedSegment));
+	segment = nullptr;
+	slot = -1;
+	if (last) {
+		shm_unlink(name.c_str());
+	}
+}
+
+/* Get the pool's index of a resource, or -1 if it has none by that name */
+int SharedPool::find(const string &resource) {
+	for (int r = 0; r < segment->numResources; r++) {
+		if (strncmp(segment->names[r], resource.c_str(), SHARED_NAME_SIZE - 1) == 0) {
+			return r;
+		}
+	}
+	return -1;
+}
+
+int SharedPool::getMax(int index) {
+	return segment->maxResources[index];
+}
+
+/* Units of a resource no process holds; read without the lock, for reports */
+int SharedPool::getAvailable(int index) {
+	return ((volatile int *) segment->available)[index];
+}
+
+/* Number of processes attached, counting any that died unnoticed */
+int SharedPool::getAttached() {
+	return ((volatile int *) &segment->attached)[0];
+}
+
+/*
+	Takes every (index, amount) in needs for this process. If a resource is
+	short and waitMs > 0, sleeps until units are released or waitMs passes
+	and tries once more; a wait that times out first looks for holders that
+	died. Returns false if the needs still couldn't be met.
+*/
+bool SharedPool::acquire(const vector<pair<int, int>> &needs, int waitMs) {
+	lock();
+	bool taken = take(needs);
+	if (!taken && waitMs > 0) {
+		uint32_t seen = segment->releases.load(memory_order_relaxed);
+		segment->waiters++;
+		unlock();
+		bool woken = futexWait(segment->releases, seen, waitMs);
+		segment->waiters--;
+		lock();
+		if (!woken) {
+			reclaimDead();
+		}
+		taken = take(needs);
+	}
+	unlock();
+	return taken;
+}
+
+/* Returns every (index, amount) in needs to the pool and wakes waiters */
+void SharedPool::release(const vector<pair<int, int>> &needs) {
+	lock();
+	SharedHolder &holder = segment->holders[slot];
+	for (const auto& need : needs) {
+		segment->available[need.first] += need.second;
+		holder.held[need.first] -= need.second;
+	}
+	segment->releases++;
+	unlock();
+	wakeWaiters();
+}
+
+/*
+	Frees the slots of processes that no longer exist and returns their
+	units to the pool. A process counts as alive until it has been reaped,
+	and a recycled pid keeps its slot until that process exits too.
+	Returns the number of slots freed. Caller holds the lock.
+*/
+int SharedPool::reclaimDead() {
+	int reclaimed = 0;
+	for (int s = 0; s < SHARED_MAX_PROCESSES; s++) {
+		pid_t pid = segment->holders[s].pid;
+		if (pid != 0 && s != slot && kill(pid, 0) == -1 && errno == ESRCH) {
+			segment->holders[s].pid = 0;
+			segment->attached--;
+			reclaimed++;
+		}
+	}
+	if (reclaimed > 0) {
+		repair();
+	}
+	return reclaimed;
+}
+
+/*
+	Lock the pool. If the previous owner died holding the lock, its update
+	may be half done, so the counts are rebuilt before going on.
+*/
+void SharedPool::lock() {
+	if (pthread_mutex_lock(&segment->mutex) == EOWNERDEAD) {
+		pthread_mutex_consistent(&segment->mutex);
+		if (reclaimDead() == 0) {
+			repair();
+		}
+	}
+}
+
+void SharedPool::unlock() {
+	pthread_mutex_unlock(&segment->mutex);
+}
+
+/* Take needs if all are available; caller holds the lock */
+bool SharedPool::take(const vector<pair<int, int>> &needs) {
+	for (const auto& need : needs) {
+		if (segment->available[need.first] < need.second) {
+			return false;
+		}
+	}
+	SharedHolder &holder = segment->holders[slot];
+	for (const auto& need : needs) {
+		segment->available[need.first] -= need.second;
+		holder.held[need.first] += need.second;
+	}
+	return true;
+}
+
+/*
+	Rebuilds available from what live processes hold. Each slot is only
+	written by its own process under the lock, so the slots of the living
+	are exact even when a dead process left a count half updated.
+	Caller holds the lock.
+*/
+void SharedPool::repair() {
+	for (int r = 0; r < segment->numResources; r++) {
+		int held = 0;
+		for (int s = 0; s < SHARED_MAX_PROCESSES; s++) {
+			if (segment->holders[s].pid != 0) {
+				held += segment->holders[s].held[r];
+			}
+		}
+		segment->available[r] = segment->maxResources[r] - held;
+	}
+	segment->releases++;
+	wakeWaiters();
+}
+
+/* Wake every process sleeping in acquire so it checks the counts again */
+void SharedPool::wakeWaiters() {
+	if (segment->waiters.load() > 0) {
+		syscall(SYS_futex, (uint32_t *) &segment->releases, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+	}
+}
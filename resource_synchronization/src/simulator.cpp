@@ -0,0 +1,178 @@
+#include "../include/simulator.h"
+#include <cmath>
+
+Simulator::Simulator(TaskManager &manager, int nIter, int monitorTime, unsigned seed)
+	: manager(manager), nIter(nIter), monitorTime(monitorTime), randomize(seed != 0), random(seed) {}
+
+/* Virtual time in ms since the simulation started */
+long Simulator::getTime() {
+	return now;
+}
+
+/*
+	Runs every task for nIter iterations of simulated time and returns true
+	once all are done, or false as soon as the remaining ones are deadlocked:
+	only monitor reports are left to run. Needs LOCK_GLOBAL; the manager's
+	TimerWheel is not used.
+*/
+bool Simulator::run() {
+	manager.virtualClock = &now;
+	PROFILE(manager.profiler.virtualClock = &now);
+	// Wait deadlines become events here rather than timers on the wheel
+	waitTimeout = manager.waitTimeout;
+	manager.waitTimeout = 0;
+	manager.onGrant = [this](Task &task) {
+		task.step = STEP_GRANTED;
+		schedule(now, EVENT_STEP, &task);
+	};
+	manager.onTimeout = [this](Task &task) {
+		// Back off for idleTime, then ask again
+		task.step = STEP_ACQUIRE;
+		schedule(now + period(task.idleTime), EVENT_STEP, &task);
+	};
+
+	for (Task &task : manager.tasks) {
+		if (nIter > 0) {
+			task.step = STEP_ACQUIRE;
+			schedule(0, EVENT_STEP, &task);
+			tasksRemaining++;
+		}
+	}
+	if (monitorTime > 0) {
+		schedule(monitorTime, EVENT_MONITOR, nullptr);
+	}
+
+	while (taskEvents > 0 && tasksRemaining > 0) {
+		Event event = events.top();
+		events.pop();
+		now = event.time;
+		if (event.kind != EVENT_MONITOR) {
+			taskEvents--;
+		}
+		if (event.kind == EVENT_STEP) {
+			runStep(*event.task);
+		}
+		else if (event.kind == EVENT_TIMEOUT) {
+			manager.expireWait(*event.task, event.ticket);
+		}
+		else {
+			manager.printMonitor();
+			schedule(now + monitorTime, EVENT_MONITOR, nullptr);
+		}
+	}
+
+	manager.onGrant = nullptr;
+	manager.onTimeout = nullptr;
+	manager.waitTimeout = waitTimeout;
+	manager.virtualClock = nullptr;
+	PROFILE(manager.profiler.virtualClock = nullptr);
+	return tasksRemaining == 0;
+}
+
+/* Lists the tasks still waiting after run returned false, with what they wait for and hold */
+void Simulator::printDeadlock() {
+	cout << "Deadlock at " << now << " ms: " << tasksRemaining << " tasks can't finish\n";
+	for (const Task &task : manager.tasks) {
+		if (task.status != STATUS_WAIT) {
+			continue;
+		}
+		cout << "\t" << task.name << " waits for";
+		for (const auto &request : task.phases[task.phase]) {
+			cout << " " << manager.getResourceName(task.needs[request.first].first) << ":" << request.second;
+		}
+		cout << ", holds";
+		bool holds = false;
+		for (uint j = 0; j < task.needs.size(); j++) {
+			if (task.holding[j] > 0) {
+				cout << " " << manager.getResourceName(task.needs[j].first) << ":" << task.holding[j];
+				holds = true;
+			}
+		}
+		cout << (holds ? "\n" : " nothing\n");
+	}
+}
+
+void Simulator::schedule(long time, EventKind kind, Task *task, long ticket) {
+	if (kind != EVENT_MONITOR) {
+		taskEvents++;
+	}
+	events.push(Event{time, nextSeq++, kind, task, ticket});
+}
+
+/* Length of a busy or idle period that averages ms */
+int Simulator::period(int ms) {
+	if (!randomize || ms <= 0) {
+		return ms;
+	}
+	exponential_distribution<double> distribution(1.0 / ms);
+	return (int) lround(distribution(random));
+}
+
+/*
+	Advances a task by one step of the same cycle Executor::runStep runs,
+	with periods as events on the virtual clock. Nothing else runs
+	meanwhile, but the mutex is still taken so TaskManager sees its usual
+	locking.
+*/
+void Simulator::runStep(Task &task) {
+	switch (task.step) {
+		case STEP_ACQUIRE:
+		case STEP_GRANTED:
+			manager.lockMutex();
+			if (task.step == STEP_ACQUIRE && !manager.requestResources(task)) {
+				// Parked; onGrant or the timeout event makes the task ready again
+				if (waitTimeout > 0 && task.phase == 0) {
+					schedule(now + waitTimeout, EVENT_TIMEOUT, &task, task.ticket);
+				}
+				pthread_mutex_unlock(&manager.mutex);
+				return;
+			}
+			manager.endWait(task);
+			task.status = STATUS_RUN;
+			pthread_mutex_unlock(&manager.mutex);
+
+			// Hold this phase for its share of busyTime
+			task.step = task.phase < task.phases.size() ? STEP_ACQUIRE : STEP_RELEASE;
+			schedule(now + period(task.phaseTime), EVENT_STEP, &task);
+			return;
+
+		case STEP_RELEASE:
+			// A leasing task stays idle still holding its resources
+			if (!manager.canLease(task)) {
+				manager.lockMutex();
+				manager.releaseResources(task);
+				task.status = STATUS_IDLE;
+				pthread_mutex_unlock(&manager.mutex);
+			}
+			task.step = STEP_FINISH;
+			schedule(now + period(task.idleTime), EVENT_STEP, &task);
+			return;
+
+		case STEP_FINISH: {
+			bool leased = false;
+			task.iter++;
+			if (manager.canLease(task)) {
+				manager.lockMutex();
+				leased = task.iter < nIter && manager.renewLease(task);
+				if (!leased) {
+					manager.releaseResources(task);
+					task.status = STATUS_IDLE;
+				}
+				pthread_mutex_unlock(&manager.mutex);
+			}
+			manager.logger.writeCompletion(task.index, task.name, task.iter, now);
+			if (leased) {
+				task.step = STEP_RELEASE;
+				schedule(now + period(task.phaseTime), EVENT_STEP, &task);
+			}
+			else if (task.iter < nIter) {
+				task.step = STEP_ACQUIRE;
+				schedule(now, EVENT_STEP, &task);
+			}
+			else {
+				tasksRemaining--;
+			}
+			return;
+		}
+	}
+}
@@ -1,4 +1,20 @@
 #include "../include/task_manager.h"
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Get the name printed for a task status */
+const char *statusName(TaskStatus status) {
+	switch (status) {
+		case STATUS_WAIT: return "WAIT";
+		case STATUS_RUN: return "RUN";
+		case STATUS_IDLE: return "IDLE";
+		default: return "";
+	}
+}
 
 /* Get number of tasks */
 int TaskManager::getNumTasks() {
@@ -11,6 +27,23 @@ double TaskManager::getDuration(struct timespec &start, struct timespec &end) {
 	return time; // in milliseconds
 }
 
+/* Current time on CLOCK_MONOTONIC, or on the simulation's virtual clock */
+void TaskManager::getTime(struct timespec &time) {
+	if (virtualClock != nullptr) {
+		time.tv_sec = *virtualClock / 1000;
+		time.tv_nsec = (*virtualClock % 1000) * 1000000;
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &time);
+}
+
+// ns on CLOCK_MONOTONIC, for timing resource lock holds
+static int64_t monotonicNs() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (int64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
 /* Get the elapsed time in milliseconds */
 void TaskManager::setTimespec(int ms, struct timespec &delayTimespec) {
 	// put times into timespec structs: convert ms into {s, ns}
@@ -21,155 +54,1067 @@ void TaskManager::setTimespec(int ms, struct timespec &delayTimespec) {
 	return;
 }
 
-/* Check if all resources needed by the task are available */
+/* Check if all resources the task requests next are available */
 bool TaskManager::resourcesAreAvailable(Task &task) {
-	for (const auto& pair : task.resourcesNeededDict) {
-		string resource = pair.first;
-		int amountNeeded = pair.second;
-		if (resourcesAvailableDict[resource] < amountNeeded) {
+	for (const auto& request : task.phases[task.phase]) {
+		int resource = task.needs[request.first].first;
+		PROFILE(profiler.checked(task, resource, available[resource] >= request.second));
+		if (available[resource] < request.second) {
 			return false;
 		}
 	}
 	return true;
 }
 
-/* Take and hold every resource needed by the task */
+/* Check if the task's next request can be granted right now */
+bool TaskManager::canGrant(Task &task) {
+	return resourcesAreAvailable(task) && (!bankers || isSafeToGrant(task));
+}
+
+/* True if need[r] <= work[r] for every resource; no early exit so it vectorizes */
+static bool fitsWithin(const int *need, const int *work, int numResources) {
+	int fits = 1;
+	for (int r = 0; r < numResources; r++) {
+		fits &= need[r] <= work[r];
+	}
+	return fits;
+}
+
+/*
+	Banker's algorithm: true if granting the task's next request leaves a
+	state in which every task holding resources can still finish. The check
+	is incremental. The current state is already safe, so the grant is safe
+	as soon as the requester alone could finish with what would be left.
+	Only otherwise are the tasks holding resources run to completion on
+	paper. Tasks holding nothing are skipped since they can't block anyone.
+*/
+bool TaskManager::isSafeToGrant(Task &task) {
+	const int numResources = getNumResources();
+	int *work = bankersWork.data();
+	int *need = &bankersNeed[task.index * numResources];
+	int *allocated = &bankersAllocated[task.index * numResources];
+	copy(available.begin(), available.end(), bankersWork.begin());
+
+	// Pretend to grant the request
+	for (const auto& request : task.phases[task.phase]) {
+		int resource = task.needs[request.first].first;
+		work[resource] -= request.second;
+		need[resource] -= request.second;
+		allocated[resource] += request.second;
+	}
+
+	bool safe = bankersFastPath && fitsWithin(need, work, numResources);
+	if (!safe) {
+		int remaining = 0;
+		for (const Task &t : tasks) {
+			bool holds = &t == &task;
+			for (int held : t.holding) {
+				holds |= held > 0;
+			}
+			bankersFinished[t.index] = !holds;
+			remaining += holds;
+		}
+		bool progress = true;
+		while (progress && remaining > 0) {
+			progress = false;
+			for (uint t = 0; t < tasks.size(); t++) {
+				if (!bankersFinished[t] && fitsWithin(&bankersNeed[t * numResources], work, numResources)) {
+					// Task t can finish and return everything it holds
+					const int *returned = &bankersAllocated[t * numResources];
+					for (int r = 0; r < numResources; r++) {
+						work[r] += returned[r];
+					}
+					bankersFinished[t] = true;
+					remaining--;
+					progress = true;
+				}
+			}
+		}
+		safe = remaining == 0;
+	}
+
+	// Undo the pretend grant
+	for (const auto& request : task.phases[task.phase]) {
+		int resource = task.needs[request.first].first;
+		need[resource] += request.second;
+		allocated[resource] -= request.second;
+	}
+	return safe;
+}
+
+/* Record that a task was granted (or, if negative, returned) units of a resource */
+void TaskManager::updateBankers(Task &task, int resource, int amount) {
+	int i = task.index * getNumResources() + resource;
+	bankersNeed[i] -= amount;
+	bankersAllocated[i] += amount;
+}
+
+/* Builds the Banker's tables; every task starts needing its full claim */
+void TaskManager::initBankers() {
+	int numResources = getNumResources();
+	bankersNeed.assign(tasks.size() * numResources, 0);
+	bankersAllocated.assign(tasks.size() * numResources, 0);
+	bankersWork.assign(numResources, 0);
+	bankersFinished.assign(tasks.size(), 0);
+	for (const Task &task : tasks) {
+		for (const auto& need : task.needs) {
+			bankersNeed[task.index * numResources + need.first] = need.second;
+		}
+	}
+}
+
+/* True if any task acquires its resources in more than one phase */
+bool TaskManager::hasPhasedTasks() {
+	for (const Task &task : tasks) {
+		if (task.phases.size() > 1) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+	Blocks until every resource needed by the task has been taken. The caller
+	must hold mutex. A task that has to wait is queued and sleeps on its own
+	condition variable; releaseResources grabs on its behalf before waking it,
+	so only tasks whose needs can actually be met are woken. Under a strict
+	scheduling policy a task may not overtake tasks that are already waiting,
+	except for a later phase: the task already holds resources that waiters
+	ahead of it may need, so making it queue behind them could deadlock.
+	Returns false if the wait timed out instead.
+*/
+bool TaskManager::acquireResources(Task &task) {
+	if (requestResources(task)) {
+		return true;
+	}
+	int timeouts = task.timeouts;
+	while (!task.granted && task.timeouts == timeouts) {
+		pthread_cond_wait(&task.grantCond, &mutex);
+	}
+	return task.granted;
+}
+
+/*
+	Takes the task's next request if it can be granted right away and
+	returns true. Otherwise queues the task, starts its wait period and
+	returns false; the task is granted later by releaseResources, which then
+	calls onGrant or, if that is unset, signals the task's grantCond.
+	With a waitTimeout, a first phase that is still waiting when it runs out
+	is given up on instead; only then does the task hold nothing to return.
+	Caller holds mutex.
+*/
+bool TaskManager::requestResources(Task &task) {
+	if ((waiters.empty() || !scheduler->isStrict() || task.phase > 0) && canGrant(task)) {
+		grabResources(task);
+		return true;
+	}
+
+	// Start wait period
+	task.status = STATUS_WAIT;
+	getTime(task.waitStart);
+	task.granted = false;
+	task.ticket = nextTicket++;
+	waiters.push_back(&task);
+	if (waitTimeout > 0 && task.phase == 0) {
+		long ticket = task.ticket;
+		task.waitTimer = timers.schedule(waitTimeout, [this, &task, ticket]() {
+			expireWait(task, ticket);
+		});
+	}
+	grantWaiters(); // the policy may rank this task ahead of the others
+	return false;
+}
+
+/*
+	Ends the task's wait period, if it had one, and records how long the
+	acquisition waited. Caller holds mutex.
+*/
+void TaskManager::endWait(Task &task) {
+	double waited = 0;
+	if (task.waitTimer != 0) {
+		timers.cancel(task.waitTimer);
+		task.waitTimer = 0;
+	}
+	if (task.status == STATUS_WAIT) {
+		// Wait period done; add time spent waiting
+		struct timespec waitEnd;
+		getTime(waitEnd);
+		waited = getDuration(task.waitStart, waitEnd);
+		task.timeSpentWaiting += waited;
+		recordWakeup(task);
+	}
+	task.waitTimes.push_back(waited);
+}
+
+/*
+	True if the task may keep its resources from one iteration to the next
+	instead of releasing and acquiring them again. Only single-phase tasks
+	lease, and only with the global mutex, whose wait queue shows when
+	another task wants what they hold.
+*/
+bool TaskManager::canLease(Task &task) {
+	return leaseIterations > 1 && lockMode == LOCK_GLOBAL && task.phases.size() == 1;
+}
+
+/*
+	Called when a leasing task finishes an iteration, still holding its
+	resources. Returns true if it may keep them for the next iteration too,
+	which saves the release, the acquire, their wait bookkeeping and, when
+	tasks contend, a hand-off to another thread. A lease ends after
+	leaseIterations iterations, which bounds how long a contender waits;
+	with leaseYields it ends as soon as another task is waiting for
+	something the task holds. The caller releases the resources when this
+	returns false, granting them to waiting tasks first. Caller holds mutex.
+*/
+bool TaskManager::renewLease(Task &task) {
+	if (++task.leaseRenewals >= leaseIterations || (leaseYields && hasContender(task))) {
+		task.leaseRenewals = 0;
+		return false;
+	}
+	task.status = STATUS_RUN;
+	return true;
+}
+
+/*
+	Renews the task's lease without mutex when nothing but the task's own
+	count decides it: no leaseYields to look at the wait queue, and not the
+	last renewal, which releases. Returns false if the caller has to take
+	mutex and call renewLease instead. Only the task's own thread calls it.
+*/
+bool TaskManager::renewLeaseUnlocked(Task &task) {
+	if (leaseYields || task.leaseRenewals + 1 >= leaseIterations) {
+		return false;
+	}
+	task.leaseRenewals++;
+	task.status = STATUS_RUN;
+	return true;
+}
+
+/* True if a waiting task's next request needs something the task holds */
+bool TaskManager::hasContender(Task &task) {
+	for (Task *waiter : waiters) {
+		for (const auto& request : waiter->phases[waiter->phase]) {
+			int resource = waiter->needs[request.first].first;
+			auto held = lower_bound(task.needs.begin(), task.needs.end(), make_pair(resource, 0));
+			if (held != task.needs.end() && held->first == resource && task.holding[held - task.needs.begin()] > 0) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/*
+	Gives up a wait that timed out: the task leaves the queue and goes idle,
+	then onTimeout is called or, if that is unset, the task is signalled.
+	Does nothing if the wait with this ticket was granted in the meantime.
+*/
+void TaskManager::expireWait(Task &task, long ticket) {
+	lockMutex();
+	if (task.status == STATUS_WAIT && !task.granted && task.ticket == ticket) {
+		struct timespec waitEnd;
+		getTime(waitEnd);
+		task.timeSpentWaiting += getDuration(task.waitStart, waitEnd);
+		task.waitTimer = 0;
+		task.timeouts++;
+		task.status = STATUS_IDLE;
+		waiters.remove(&task);
+		grantWaiters(); // a strict policy may have been holding others back for it
+		if (onTimeout) {
+			onTimeout(task);
+		}
+		else {
+			pthread_cond_signal(&task.grantCond);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/* Take and hold every resource the task requests next */
 void TaskManager::grabResources(Task &task) {
-	for (const auto& pair : task.resourcesNeededDict) {
-		string resource = pair.first;
-		int amount = pair.second;
-		resourcesAvailableDict[resource] -= amount;
-		task.holdingDict[resource] += amount;
+	PROFILE(profiler.granted(task));
+	for (const auto& request : task.phases[task.phase]) {
+		int resource = task.needs[request.first].first;
+		available[resource] -= request.second;
+		unitsAvailable -= request.second;
+		task.holding[request.first] += request.second;
+		if (bankers) {
+			updateBankers(task, resource, request.second);
+		}
 	}
+	task.phase++;
 }
 
-/* Release every resource needed by the task */
+/* Release every resource held by the task */
 void TaskManager::releaseResources(Task &task) {
-	for (const auto& pair : task.resourcesNeededDict) {
-		string resource = pair.first;
-		int amount = pair.second;
-		resourcesAvailableDict[resource] += amount;
-		task.holdingDict[resource] -= amount;
+	PROFILE(profiler.released(task));
+	for (uint i = 0; i < task.needs.size(); i++) {
+		int resource = task.needs[i].first;
+		available[resource] += task.holding[i];
+		unitsAvailable += task.holding[i];
+		if (bankers) {
+			updateBankers(task, resource, -task.holding[i]);
+		}
+		task.holding[i] = 0;
+	}
+	task.phase = 0;
+
+	if (waitMode == WAIT_COND) {
+		grantWaiters();
+	}
+	else {
+		// Note when a polling task first could have been granted its resources
+		struct timespec now;
+		getTime(now);
+		for (Task &t : tasks) {
+			if (t.status == STATUS_WAIT && !t.grantable && canGrant(t)) {
+				t.grantable = true;
+				t.grantableTime = now;
+			}
+		}
 	}
 }
 
-/* Prints all tasks and their status */
-void TaskManager::printMonitor() {
-	cout << "\nmonitor: [WAIT] ";
-	for (Task t : tasks) {
-		if (t.status == "WAIT") {
-			cout << t.name << " ";
+/*
+	Hands available resources to blocked tasks in the order the scheduler
+	ranks them. Waiters that can be granted are woken; under a strict policy
+	the first waiter that can't holds back every first phase ranked behind
+	it, while later phases, whose tasks hold resources already, still pass.
+*/
+void TaskManager::grantWaiters() {
+	if (waiters.empty()) {
+		return;
+	}
+	struct timespec now;
+	getTime(now);
+	Scheduler *policy = scheduler.get();
+	if (!policy->ranksByArrival()) {
+		// list::sort is stable, so equal ranks stay in arrival order
+		waiters.sort([policy, &now](const Task *a, const Task *b) {
+			return policy->ranksAhead(*a, *b, now);
+		});
+	}
+
+	bool strict = policy->isStrict();
+	bool blocked = false;
+	for (auto it = waiters.begin(); it != waiters.end() && unitsAvailable > 0; ) {
+		Task *waiter = *it;
+		if ((!blocked || waiter->phase > 0) && canGrant(*waiter)) {
+			grabResources(*waiter);
+			waiter->granted = true;
+			waiter->grantable = true;
+			waiter->grantableTime = now;
+			if (onGrant) {
+				onGrant(*waiter);
+			}
+			else {
+				pthread_cond_signal(&waiter->grantCond);
+			}
+			it = waiters.erase(it);
+		}
+		else {
+			blocked = blocked || (strict && waiter->phase == 0);
+			it++;
+		}
+	}
+}
+
+/*
+	Blocks until every resource needed by the task has been taken, using a
+	lock per resource instead of mutex. Locks are always taken in id order
+	so tasks that need several resources can never deadlock each other. If a
+	resource is short, the task keeps only that resource locked and waits for
+	it to be released before trying again.
+*/
+void TaskManager::acquireResourcesFine(Task &task) {
+	bool waiting = false;
+	while (true) {
+		for (const auto& need : task.needs) {
+			pthread_mutex_lock(&resourceLocks[need.first].mutex);
+		}
+		int64_t locked = timeLockHolds ? monotonicNs() : 0;
+
+		// Find the first resource that is short, if any
+		int shortResource = -1;
+		for (const auto& need : task.needs) {
+			int amount = resourceLocks[need.first].available;
+			PROFILE(profiler.checked(task, need.first, amount >= need.second));
+			if (amount < need.second) {
+				shortResource = need.first;
+				break;
+			}
+		}
+
+		if (shortResource == -1) {
+			PROFILE(profiler.granted(task));
+			for (uint i = 0; i < task.needs.size(); i++) {
+				resourceLocks[task.needs[i].first].available -= task.needs[i].second;
+				task.holding[i] += task.needs[i].second;
+			}
+			for (const auto& need : task.needs) {
+				unlockResource(need.first, locked);
+			}
+			return;
+		}
+
+		for (const auto& need : task.needs) {
+			if (need.first != shortResource) {
+				unlockResource(need.first, locked);
+			}
+		}
+		if (!waiting) {
+			// Start wait period
+			waiting = true;
+			task.status = STATUS_WAIT;
+			getTime(task.waitStart);
+		}
+		ResourceLock &lock = resourceLocks[shortResource];
+		countHold(lock, locked);
+		pthread_cond_wait(&lock.released, &lock.mutex);
+		pthread_mutex_unlock(&lock.mutex);
+	}
+}
+
+/* Release every resource needed by the task and wake tasks waiting on them */
+void TaskManager::releaseResourcesFine(Task &task) {
+	for (const auto& need : task.needs) {
+		pthread_mutex_lock(&resourceLocks[need.first].mutex);
+	}
+	int64_t locked = timeLockHolds ? monotonicNs() : 0;
+	PROFILE(profiler.released(task));
+	for (uint i = 0; i < task.needs.size(); i++) {
+		resourceLocks[task.needs[i].first].available += task.needs[i].second;
+		task.holding[i] -= task.needs[i].second;
+	}
+	task.phase = 0;
+	for (const auto& need : task.needs) {
+		pthread_cond_broadcast(&resourceLocks[need.first].released);
+		unlockResource(need.first, locked);
+	}
+}
+
+/* Counts a hold of a LOCK_FINE resource lock taken at lockedNs, if holds are timed. Caller holds the lock. */
+void TaskManager::countHold(ResourceLock &lock, int64_t lockedNs) {
+	if (timeLockHolds) {
+		lock.holds++;
+		lock.holdNs += monotonicNs() - lockedNs;
+	}
+}
+
+/* Unlocks a LOCK_FINE resource lock taken at lockedNs, counting the hold */
+void TaskManager::unlockResource(int resource, int64_t lockedNs) {
+	countHold(resourceLocks[resource], lockedNs);
+	pthread_mutex_unlock(&resourceLocks[resource].mutex);
+}
+
+/*
+	Total ns the LOCK_FINE resource locks were held for, and how many holds,
+	as counted with timeLockHolds. Call once no task is running.
+*/
+int64_t TaskManager::getLockHoldNs(long &holds) {
+	int64_t holdNs = 0;
+	holds = 0;
+	for (int resource = 0; resource < getNumResources(); resource++) {
+		holds += resourceLocks[resource].holds;
+		holdNs += resourceLocks[resource].holdNs;
+	}
+	return holdNs;
+}
+
+/*
+	Tries to take every resource needed by the task without locking. Packed
+	counters are all reserved by a single compare-and-swap. Otherwise each
+	counter is reserved in id order and earlier reservations are rolled
+	back if a later resource turns out to be short.
+*/
+bool TaskManager::tryAcquireAtomic(Task &task) {
+	if (packed) {
+		uint64_t word = packedAvailable.load(memory_order_relaxed);
+		do {
+			// A field borrowed from its guard bit if the resource is short
+			if ((((word | packedGuard) - task.packedNeed) & packedGuard) != packedGuard) {
+				return false;
+			}
+		} while (!packedAvailable.compare_exchange_weak(word, word - task.packedNeed, memory_order_acquire, memory_order_relaxed));
+	}
+	else {
+		// Optimistic check so a short resource fails before anything is reserved
+		for (const auto& need : task.needs) {
+			if (atomicAvailable[need.first].value.load(memory_order_relaxed) < need.second) {
+				return false;
+			}
+		}
+		for (uint i = 0; i < task.needs.size(); i++) {
+			atomic<int> &counter = atomicAvailable[task.needs[i].first].value;
+			int amount = task.needs[i].second;
+			int available = counter.load(memory_order_relaxed);
+			do {
+				if (available < amount) {
+					// Roll back what was already reserved
+					for (uint j = 0; j < i; j++) {
+						atomicAvailable[task.needs[j].first].value.fetch_add(task.needs[j].second, memory_order_relaxed);
+					}
+					return false;
+				}
+			} while (!counter.compare_exchange_weak(available, available - amount, memory_order_acquire, memory_order_relaxed));
+		}
+	}
+
+	for (uint i = 0; i < task.needs.size(); i++) {
+		task.holding[i] += task.needs[i].second;
+	}
+	return true;
+}
+
+/* Spins, backing off, until every resource needed by the task has been taken */
+void TaskManager::acquireResourcesAtomic(Task &task) {
+	int attempts = 0;
+	while (!tryAcquireAtomic(task)) {
+		if (attempts == 0) {
+			// Start wait period
+			task.status = STATUS_WAIT;
+			getTime(task.waitStart);
+		}
+		// Yield at first, then sleep for up to 1ms between attempts
+		if (attempts < 16) {
+			sched_yield();
+		}
+		else {
+			struct timespec backoff = {0, min(1000L << min(attempts - 16, 10), 1000000L)};
+			nanosleep(&backoff, NULL);
 		}
+		attempts++;
 	}
-	cout << "\n\t [RUN]  ";
-	for (Task t : tasks) {
-		if (t.status == "RUN") {
-			cout << t.name << " ";
+}
+
+/* Release every resource needed by the task back to the atomic counters */
+void TaskManager::releaseResourcesAtomic(Task &task) {
+	if (packed) {
+		packedAvailable.fetch_add(task.packedNeed, memory_order_release);
+	}
+	else {
+		for (const auto& need : task.needs) {
+			atomicAvailable[need.first].value.fetch_add(need.second, memory_order_release);
 		}
 	}
-	cout << "\n\t [IDLE] ";
-	for (Task t : tasks) {
-		if (t.status == "IDLE") {
-			cout << t.name << " ";
+	for (uint i = 0; i < task.needs.size(); i++) {
+		task.holding[i] -= task.needs[i].second;
+	}
+}
+
+/*
+	Switches to LOCK_SHARED, drawing resources from the shared pool called
+	poolName. The pool is created from this manager's resources if no other
+	process has it yet; otherwise every resource must already be in it and
+	the pool's counts replace those read from the input file.
+*/
+bool TaskManager::attachShared(const string &poolName) {
+	sharedPool.reset(new SharedPool());
+	if (!sharedPool->attach(poolName, resourceNames, maxResources)) {
+		sharedPool.reset();
+		return false;
+	}
+	sharedIndex.assign(getNumResources(), -1);
+	for (int resource = 0; resource < getNumResources(); resource++) {
+		sharedIndex[resource] = sharedPool->find(resourceNames[resource]);
+		if (sharedIndex[resource] == -1) {
+			cerr << "Resource " << resourceNames[resource] << " is not in shared pool " << poolName << endl;
+			sharedPool.reset();
+			return false;
+		}
+		maxResources[resource] = sharedPool->getMax(sharedIndex[resource]);
+	}
+	for (Task &task : tasks) {
+		task.sharedNeeds.clear();
+		for (const auto& need : task.needs) {
+			task.sharedNeeds.push_back(make_pair(sharedIndex[need.first], need.second));
+		}
+	}
+	lockMode = LOCK_SHARED;
+	return true;
+}
+
+/*
+	Blocks until every resource needed by the task has been taken from the
+	shared pool. Each wait is bounded so a holder that died is noticed even
+	if nothing is ever released again.
+*/
+void TaskManager::acquireResourcesShared(Task &task) {
+	const int waitMs = 50;
+	if (!sharedPool->acquire(task.sharedNeeds, 0)) {
+		// Start wait period
+		task.status = STATUS_WAIT;
+		getTime(task.waitStart);
+		while (!sharedPool->acquire(task.sharedNeeds, waitMs)) {
+			// Woken by a release, or the wait timed out; try again
+		}
+	}
+	PROFILE(profiler.granted(task));
+	for (uint i = 0; i < task.needs.size(); i++) {
+		task.holding[i] += task.needs[i].second;
+	}
+}
+
+/* Release every resource needed by the task back to the shared pool */
+void TaskManager::releaseResourcesShared(Task &task) {
+	PROFILE(profiler.released(task));
+	sharedPool->release(task.sharedNeeds);
+	for (uint i = 0; i < task.needs.size(); i++) {
+		task.holding[i] -= task.needs[i].second;
+	}
+	task.phase = 0;
+}
+
+/* Get the number of units of a resource that are not held */
+int TaskManager::getAvailable(int resource) {
+	if (lockMode == LOCK_GLOBAL) {
+		return available[resource];
+	}
+	if (lockMode == LOCK_FINE) {
+		return resourceLocks[resource].available;
+	}
+	if (lockMode == LOCK_SHARED) {
+		return sharedPool->getAvailable(sharedIndex[resource]);
+	}
+	if (packed) {
+		uint64_t word = packedAvailable.load(memory_order_acquire);
+		return (word >> (resource * packedWidth)) & ((1ULL << (packedWidth - 1)) - 1);
+	}
+	return atomicAvailable[resource].value.load(memory_order_acquire);
+}
+
+/* Check that no resource is overcommitted: 0 <= available <= max */
+bool TaskManager::resourcesAreConsistent() {
+	bool consistent = true;
+	if (lockMode == LOCK_GLOBAL) {
+		lockMutex();
+	}
+	if (lockMode == LOCK_ATOMIC && packed && (packedAvailable.load() & packedGuard) != 0) {
+		consistent = false;
+	}
+	for (int resource = 0; resource < getNumResources(); resource++) {
+		if (lockMode == LOCK_FINE) {
+			pthread_mutex_lock(&resourceLocks[resource].mutex);
+		}
+		int amount = getAvailable(resource);
+		if (amount < 0 || amount > maxResources[resource]) {
+			consistent = false;
+		}
+		if (lockMode == LOCK_FINE) {
+			pthread_mutex_unlock(&resourceLocks[resource].mutex);
+		}
+	}
+	if (lockMode == LOCK_GLOBAL) {
+		pthread_mutex_unlock(&mutex);
+	}
+	return consistent;
+}
+
+/*
+	Builds the atomic counters. Counters are packed into one 64-bit word
+	when each count, plus its guard bit, fits.
+*/
+void TaskManager::initAtomicCounters() {
+	int numResources = getNumResources();
+	int largest = 0;
+	atomicAvailable.reset(new PaddedCounter[numResources]);
+	for (int i = 0; i < numResources; i++) {
+		atomicAvailable[i].value.store(available[i]);
+		largest = max(largest, maxResources[i]);
+	}
+	for (Task &task : tasks) {
+		for (const auto& need : task.needs) {
+			largest = max(largest, need.second);
+		}
+	}
+
+	int valueBits = 0;
+	while ((1LL << valueBits) <= largest) {
+		valueBits++;
+	}
+	packedWidth = valueBits + 1;
+	packed = packCounters && numResources * packedWidth <= 64;
+
+	uint64_t word = 0;
+	for (int i = 0; packed && i < numResources; i++) {
+		word |= (uint64_t) available[i] << (i * packedWidth);
+		packedGuard |= 1ULL << (i * packedWidth + packedWidth - 1);
+	}
+	packedAvailable.store(word);
+
+	for (Task &task : tasks) {
+		task.packedNeed = 0;
+		for (const auto& need : task.needs) {
+			if (packed) {
+				task.packedNeed += (uint64_t) need.second << (need.first * packedWidth);
+			}
+		}
+	}
+}
+
+/* Get the id of a resource, adding it with no units if it is new */
+int TaskManager::internResource(const string &resource) {
+	auto it = resourceIds.find(resource);
+	if (it != resourceIds.end()) {
+		return it->second;
+	}
+	int id = resourceNames.size();
+	resourceIds[resource] = id;
+	resourceNames.push_back(resource);
+	available.push_back(0);
+	maxResources.push_back(0);
+	return id;
+}
+
+/* Get number of resources */
+int TaskManager::getNumResources() {
+	return resourceNames.size();
+}
+
+/* Get the name of a resource from its id */
+const string &TaskManager::getResourceName(int resource) {
+	return resourceNames[resource];
+}
+
+/* Record the time between a task becoming grantable and it running */
+void TaskManager::recordWakeup(Task &task) {
+	if (!task.grantable) {
+		return;
+	}
+	struct timespec now;
+	getTime(now);
+	double latency = getDuration(task.grantableTime, now);
+	totalWakeupLatency += latency;
+	if (latency > maxWakeupLatency) {
+		maxWakeupLatency = latency;
+	}
+	numWakeups++;
+	task.grantable = false;
+}
+
+/*
+	Prints all tasks and their status. Needs no lock: each status is read
+	once into a snapshot, so every task appears in exactly one list, and the
+	whole report is logged as one record.
+*/
+void TaskManager::printMonitor() {
+	vector<TaskStatus> snapshot(tasks.size());
+	for (uint i = 0; i < tasks.size(); i++) {
+		snapshot[i] = tasks[i].status;
+	}
+
+	string report = "\nmonitor: [WAIT] ";
+	const TaskStatus order[] = {STATUS_WAIT, STATUS_RUN, STATUS_IDLE};
+	const char *headers[] = {"\n\t [RUN]  ", "\n\t [IDLE] ", "\n\n"};
+	for (int k = 0; k < 3; k++) {
+		for (uint i = 0; i < tasks.size(); i++) {
+			if (snapshot[i] == order[k]) {
+				report += tasks[i].name;
+				report += " ";
+			}
 		}
+		report += headers[k];
 	}
-	cout << endl << endl;
+	logger.write(report);
+}
 
+/* Get the p-th percentile (0-100) of the sorted values, by nearest rank */
+static double percentile(const vector<double> &values, double p) {
+	if (values.empty()) {
+		return 0;
+	}
+	uint rank = (uint) (p / 100 * values.size());
+	return values[min(rank, (uint) values.size() - 1)];
 }
 
 /* Prints details of every task */
 void TaskManager::printTasks() {
-    cout << "All Tasks:" << endl;
+    cout << "All Tasks:\n";
 	int i = 0;
-    for (Task t : tasks) {
-        cout << "[" << i << "] " << t.name << " (" << t.status << ", runTime= " << t.busyTime << " ms, idleTime= " << t.idleTime << " ms):" << endl;
-        cout << "\t(tid= 0x" << hex << t.tid << dec << ")" << endl;
-		for (const auto& pair : t.resourcesNeededDict) {
-			string resource = pair.first;
-			int amount = pair.second;
-			cout << "\t" << resource << ":\t(need= " << amount << ", holding= " << t.holdingDict[resource] << ")" << endl;
-		}
-        cout << "\t(Ran: " << t.iter << " times, Waited: " << t.timeSpentWaiting << " ms)" << endl << endl;
+    for (const Task &t : tasks) {
+        cout << "[" << i << "] " << t.name << " (" << statusName(t.status) << ", runTime= " << t.busyTime << " ms, idleTime= " << t.idleTime << " ms):\n";
+        cout << "\t(tid= 0x" << hex << t.tid << dec << ")\n";
+		for (uint j = 0; j < t.needs.size(); j++) {
+			cout << "\t" << resourceNames[t.needs[j].first] << ":\t(need= " << t.needs[j].second << ", holding= " << t.holding[j] << ")\n";
+		}
+        cout << "\t(Ran: " << t.iter << " times, Waited: " << t.timeSpentWaiting << " ms";
+        if (t.timeouts > 0) {
+        	cout << ", Timed out: " << t.timeouts << " times";
+        }
+        cout << ")\n";
+        vector<double> waits(t.waitTimes);
+        sort(waits.begin(), waits.end());
+        cout << "\t(Wait p50= " << percentile(waits, 50) << " ms, p90= " << percentile(waits, 90) 
+        	<< " ms, p99= " << percentile(waits, 99) << " ms, max= " << percentile(waits, 100) << " ms)\n\n";
 		i++;
 	}
-    cout << endl;
+    cout << "\n" << flush;
 }
 
 /* Prints details of every resource */
 void TaskManager::printResources() {
-    cout << "\nAll Resources:" << endl;
-	for (const auto& pair : resourcesAvailableDict) {
-		string resource = pair.first;
-		int amount = pair.second;
-		cout << "\t" << resource << ":\t(maxAvail= " << maxResourcesDict[resource] << ", held= " << (maxResourcesDict[resource] - amount) << ")" << endl;
+    cout << "\nAll Resources:\n";
+	for (int resource = 0; resource < getNumResources(); resource++) {
+		int amount = getAvailable(resource);
+		cout << "\t" << resourceNames[resource] << ":\t(maxAvail= " << maxResources[resource] << ", held= " << (maxResources[resource] - amount) << ")\n";
     }
-    cout << endl;
+	if (lockMode == LOCK_SHARED) {
+		// held counts every process attached to the pool
+		cout << "\t(shared pool, " << sharedPool->getAttached() << " processes attached)\n";
+	}
+	PROFILE(profiler.printReport(resourceNames));
+    cout << "\n" << flush;
+}
+
+/* Prints the wakeup latency of waiting tasks */
+void TaskManager::printWakeups() {
+	double avg = numWakeups > 0 ? totalWakeupLatency / numWakeups : 0;
+	cout << "Wakeup latency= avg " << avg << " ms, max " << maxWakeupLatency << " ms (wakeups= " << numWakeups << ")" << endl;
+}
+
+/* Prints how many task iterations completed per second */
+void TaskManager::printThroughput(double durationMs) {
+	int totalIter = 0;
+	for (const Task &t : tasks) {
+		totalIter += t.iter;
+	}
+	cout << "Throughput= " << (durationMs > 0 ? totalIter / (durationMs / 1000) : 0) << " iter/s" << endl;
 }
 
-/* Read and parse the inputFile into a TaskManager instance */
+// A token of the mapped input file, pointing into it rather than copied
+struct Token {
+	const char *start;
+	const char *end;
+
+	bool is(const char *text) const {
+		size_t length = strlen(text);
+		return (size_t) (end - start) == length && memcmp(start, text, length) == 0;
+	}
+	const char *find(char c) const {
+		return (const char *) memchr(start, c, end - start);
+	}
+};
+
+/* Parse all of [start, end) as a decimal int; throws like stoi on bad input */
+static int parseInt(const char *start, const char *end) {
+	bool negative = start < end && *start == '-';
+	if (negative) {
+		start++;
+	}
+	if (start == end) {
+		throw invalid_argument("expected a number");
+	}
+	long value = 0;
+	for (; start < end; start++) {
+		if (*start < '0' || *start > '9') {
+			throw invalid_argument("expected a number");
+		}
+		value = value * 10 + (*start - '0');
+		if (value > INT_MAX) {
+			throw out_of_range("number too large");
+		}
+	}
+	return negative ? -value : value;
+}
+
+/*
+	Read and parse the inputFile into a TaskManager instance. Resource names
+	are interned to dense ids here so the rest of TaskManager works on flat
+	arrays instead of string-keyed maps. The file is memory-mapped and
+	tokenized in place, and tasks are counted first so they are built
+	directly in their final slot of tasks.
+*/
 int TaskManager::parseInput(const char *inputFile) {
-	ifstream file(inputFile);
-	if (!file.is_open()) {
+	int fd = open(inputFile, O_RDONLY);
+	struct stat info;
+	if (fd == -1 || fstat(fd, &info) == -1) {
 		cerr << "Failed to open file: " << inputFile << endl;
+		if (fd != -1) {
+			close(fd);
+		}
 		return EXIT_FAILURE;
 	}
+	size_t size = info.st_size;
+	void *mapped = MAP_FAILED;
+	if (size > 0) {
+		mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped == MAP_FAILED) {
+			cerr << "Failed to map file: " << inputFile << endl;
+			close(fd);
+			return EXIT_FAILURE;
+		}
+		madvise(mapped, size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+	const char *data = mapped != MAP_FAILED ? (const char *) mapped : "";
+	const char *end = data + size;
+
+	// Reserve a slot for every task line up front
+	size_t taskLines = 0;
+	for (const char *line = data; line < end; ) {
+		const char *eol = (const char *) memchr(line, '\n', end - line);
+		eol = eol != nullptr ? eol : end;
+		taskLines += eol - line > 4 && memcmp(line, "task", 4) == 0;
+		line = eol + 1;
+	}
+	tasks.reserve(tasks.size() + taskLines);
 
-	string line;
+	vector<Token> tokens;
+	// (phase, resource id, amount) of every request on a task line
+	struct Request {
+		int phase, resource, amount;
+	};
+	vector<Request> requests;
+	string name;
+	const char *line = data, *eol = data;
 	try {
-		while(getline(file, line)) {
-			// Skip comments and empty lines
-			if (line.empty() || line[0] == '#' || line[0] == '\n' || line[0] == '\r') {
-				continue; 
+		for (; line < end; line = eol + 1) {
+			eol = (const char *) memchr(line, '\n', end - line);
+			eol = eol != nullptr ? eol : end;
+			const char *lineEnd = eol;
+			if (lineEnd > line && lineEnd[-1] == '\r') {
+				lineEnd--;
 			}
-			// Remove trailing newline
-			if (line.back() == '\n' || line.back() == '\r') {
-				line.pop_back();
+			// Skip comments and empty lines
+			if (lineEnd == line || *line == '#') {
+				continue;
 			}
 
-			// Tokenize string
-			istringstream iss(line);
-			vector<string> tokens;
-			string token;
-			while(getline(iss, token, ' ')) {
-				tokens.push_back(token);
+			// Tokenize in place
+			tokens.clear();
+			for (const char *p = line; p < lineEnd; ) {
+				while (p < lineEnd && (*p == ' ' || *p == '\t')) {
+					p++;
+				}
+				const char *start = p;
+				while (p < lineEnd && *p != ' ' && *p != '\t') {
+					p++;
+				}
+				if (p > start) {
+					tokens.push_back({start, p});
+				}
 			}
-			if (tokens[0] == "resources") {
+			if (tokens.empty()) {
+				continue;
+			}
+
+			if (tokens[0].is("resources")) {
 				// Add available resource to TaskManager 
 				for (uint i = 1; i < tokens.size(); i++) {
-					string resource = tokens[i].substr(0, tokens[i].find(':'));
-					string amount = tokens[i].substr(tokens[i].find(':') + 1);
-					this->resourcesAvailableDict[resource] = stoi(amount);
-					this->maxResourcesDict[resource] = stoi(amount);
+					const char *colon = tokens[i].find(':');
+					if (colon == nullptr) {
+						throw invalid_argument("expected name:amount");
+					}
+					name.assign(tokens[i].start, colon);
+					int id = internResource(name);
+					this->available[id] = parseInt(colon + 1, tokens[i].end);
+					this->maxResources[id] = this->available[id];
 				}
 			} 
-			else if (tokens[0] == "task") {
-				Task task;
-				task.name = tokens[1];
-				task.busyTime = stoi(tokens[2]); 
-				task.idleTime = stoi(tokens[3]); 
-				setTimespec(task.busyTime, task.busyTimespec);
-				setTimespec(task.idleTime, task.idleTimespec);
-
-				// Add needed resource to task
-				for (uint i = 4; i < tokens.size(); i++) {
-					string resource = tokens[i].substr(0, tokens[i].find(':'));
-					string amount = tokens[i].substr(tokens[i].find(':') + 1);
-					task.resourcesNeededDict[resource] = stoi(amount);
-					task.holdingDict[resource] = 0;
+			else if (tokens[0].is("task")) {
+				if (tokens.size() < 4) {
+					throw invalid_argument("expected name, busyTime and idleTime");
+				}
+				tasks.emplace_back();
+				Task &task = tasks.back();
+				task.name.assign(tokens[1].start, tokens[1].end);
+				task.busyTime = parseInt(tokens[2].start, tokens[2].end); 
+				task.idleTime = parseInt(tokens[3].start, tokens[3].end); 
+
+				// Optional priority comes before the resources
+				uint first = 4;
+				if (tokens.size() > 4 && tokens[4].find(':') == nullptr) {
+					task.priority = parseInt(tokens[4].start, tokens[4].end);
+					first = 5;
+				}
+
+				// Add needed resource to task; "|" starts a new acquisition phase.
+				// Within a phase a repeated resource keeps its last amount.
+				requests.clear();
+				int phase = 0;
+				for (uint i = first; i < tokens.size(); i++) {
+					if (tokens[i].is("|")) {
+						phase++;
+						continue;
+					}
+					const char *colon = tokens[i].find(':');
+					if (colon == nullptr) {
+						throw invalid_argument("expected name:amount");
+					}
+					name.assign(tokens[i].start, colon);
+					Request request = {phase, internResource(name), parseInt(colon + 1, tokens[i].end)};
+					int k = requests.size() - 1;
+					while (k >= 0 && requests[k].phase == phase && requests[k].resource != request.resource) {
+						k--;
+					}
+					if (k >= 0 && requests[k].phase == phase) {
+						requests[k].amount = request.amount;
+					}
+					else {
+						requests.push_back(request);
+					}
+				}
+
+				// The task needs the total over all phases. Needs are sorted by
+				// id, which is also the order per-resource locks are taken in.
+				task.needs.reserve(requests.size());
+				for (const Request &request : requests) {
+					task.needs.push_back(make_pair(request.resource, request.amount));
+				}
+				sort(task.needs.begin(), task.needs.end());
+				uint merged = 0;
+				for (uint i = 0; i < task.needs.size(); i++) {
+					if (merged > 0 && task.needs[merged - 1].first == task.needs[i].first) {
+						task.needs[merged - 1].second += task.needs[i].second;
+					}
+					else {
+						task.needs[merged++] = task.needs[i];
+					}
+				}
+				task.needs.resize(merged);
+				task.holding.assign(task.needs.size(), 0);
+				task.phases.resize(phase + 1);
+				if (phase == 0) {
+					task.phases[0].reserve(requests.size());
+				}
+				for (const Request &request : requests) {
+					uint i = lower_bound(task.needs.begin(), task.needs.end(), make_pair(request.resource, INT_MIN)) - task.needs.begin();
+					task.phases[request.phase].push_back(make_pair(i, request.amount));
 				}
-				this->tasks.push_back(task);
+				for (auto &phaseRequests : task.phases) {
+					sort(phaseRequests.begin(), phaseRequests.end());
+				}
+				task.phaseTime = task.busyTime / task.phases.size();
+				task.index = tasks.size() - 1;
 				this->numTasks++;
 			} 
 			else {
-				cerr << "Skipping unexpected line in " << inputFile << ": " << line << endl;
+				cerr << "Skipping unexpected line in " << inputFile << ": " << string(line, lineEnd) << endl;
 			}
 		}
 	}
 	catch(...) {
-		cerr << "Unexpected line format in " << inputFile << ": " << line << endl;
+		cerr << "Unexpected line format in " << inputFile << ": " << string(line, eol) << endl;
+		if (mapped != MAP_FAILED) {
+			munmap(mapped, size);
+		}
 		return EXIT_FAILURE;
 	}
-	
-	file.close();
+	if (mapped != MAP_FAILED) {
+		munmap(mapped, size);
+	}
+
+	resourceLocks.reset(new ResourceLock[getNumResources()]);
+	for (int resource = 0; resource < getNumResources(); resource++) {
+		resourceLocks[resource].available = available[resource];
+	}
+	for (int amount : available) {
+		unitsAvailable += amount;
+	}
+	initAtomicCounters();
+	PROFILE(profiler.setNumResources(getNumResources()));
+	if (bankers) {
+		initBankers();
+	}
 	return 0;
 }
@@ -0,0 +1,289 @@
+#include "../include/timer_wheel.h"
+#include <semaphore.h>
+
+TimerWheel::TimerWheel() : slots(OVERFLOW_SLOT + 1, -1), slipBuckets(NUM_SLIP_BUCKETS + 1) {
+	base = now();
+}
+
+TimerWheel::~TimerWheel() {
+	stop();
+}
+
+/* Get the monotonic clock in nanoseconds */
+int64_t TimerWheel::now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (int64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/* Start the timer thread */
+void TimerWheel::start() {
+	running = true;
+	int err = pthread_create(&tid, nullptr, run, this);
+	if (err != 0) {
+		cerr << "Error creating timer thread" << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Stop the timer thread; pending timers are dropped */
+void TimerWheel::stop() {
+	pthread_mutex_lock(&mutex);
+	bool wasRunning = running;
+	running = false;
+	pthread_cond_signal(&scheduled);
+	pthread_mutex_unlock(&mutex);
+	if (!wasRunning) {
+		return;
+	}
+	pthread_join(tid, nullptr);
+
+	pthread_mutex_lock(&mutex);
+	for (uint i = 0; i < timers.size(); i++) {
+		if (timers[i].slot != -1) {
+			unlink(i);
+			release(i);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/*
+	Run callback on the timer thread once ms milliseconds have passed.
+	Returns an id that cancel takes.
+*/
+TimerId TimerWheel::schedule(int ms, function<void()> callback) {
+	int64_t scheduledAt = now();
+	int64_t deadline = scheduledAt + (int64_t) max(ms, 0) * 1000000;
+	pthread_mutex_lock(&mutex);
+	if (pending == 0) {
+		// Nothing to cascade, so catch up with ticks the idle thread skipped
+		currentTick = max(currentTick, (uint64_t) ((scheduledAt - base) / 1000000));
+	}
+
+	int timer;
+	if (!freeTimers.empty()) {
+		timer = freeTimers.back();
+		freeTimers.pop_back();
+	}
+	else {
+		timer = timers.size();
+		timers.push_back(Timer());
+		timers[timer].generation = 0;
+	}
+	Timer &t = timers[timer];
+	// First tick at or after the deadline, so no timer fires early
+	t.expiry = max(currentTick + 1, (uint64_t) ((deadline - base + 999999) / 1000000));
+	t.deadline = deadline;
+	t.callback = move(callback);
+	place(timer);
+
+	pending++;
+	maxPending = max(maxPending, pending);
+	if (pending == 1) {
+		pthread_cond_signal(&scheduled);
+	}
+	TimerId id = ((TimerId) t.generation << 32) | (uint32_t) (timer + 1);
+	pthread_mutex_unlock(&mutex);
+	return id;
+}
+
+/*
+	Cancel a timer that has not fired yet. Returns false if it already
+	fired, is firing right now, or was cancelled before.
+*/
+bool TimerWheel::cancel(TimerId id) {
+	int timer = (int) (id & 0xffffffff) - 1;
+	pthread_mutex_lock(&mutex);
+	bool cancelled = timer >= 0 && timer < (int) timers.size()
+		&& timers[timer].generation == (uint32_t) (id >> 32) && timers[timer].slot != -1;
+	if (cancelled) {
+		unlink(timer);
+		release(timer);
+		numCancelled++;
+	}
+	pthread_mutex_unlock(&mutex);
+	return cancelled;
+}
+
+/*
+	Block the calling thread for ms milliseconds. The wait is a cancellation
+	point; the semaphore outlives a cancelled sleeper until its timer fires.
+*/
+void TimerWheel::sleep(int ms) {
+	if (ms <= 0) {
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	bool isRunning = running;
+	pthread_mutex_unlock(&mutex);
+	if (!isRunning) {
+		struct timespec delay = {ms / 1000, (ms % 1000) * 1000000L};
+		nanosleep(&delay, nullptr);
+		return;
+	}
+
+	shared_ptr<sem_t> done(new sem_t, [](sem_t *sem) {
+		sem_destroy(sem);
+		delete sem;
+	});
+	sem_init(done.get(), 0, 0);
+	schedule(ms, [done]() {
+		sem_post(done.get());
+	});
+	while (sem_wait(done.get()) != 0) {}
+}
+
+/* Link the timer into the lowest level slot that holds its expiry */
+void TimerWheel::place(int timer) {
+	Timer &t = timers[timer];
+	uint64_t differs = t.expiry ^ currentTick;
+	int slot = OVERFLOW_SLOT;
+	for (int level = 0; level < NUM_LEVELS; level++) {
+		if ((differs >> (LEVEL_BITS * (level + 1))) == 0) {
+			slot = level * NUM_SLOTS + ((t.expiry >> (LEVEL_BITS * level)) & (NUM_SLOTS - 1));
+			break;
+		}
+	}
+	t.slot = slot;
+	t.prev = -1;
+	t.next = slots[slot];
+	if (t.next != -1) {
+		timers[t.next].prev = timer;
+	}
+	slots[slot] = timer;
+}
+
+/* Remove the timer from its slot's list */
+void TimerWheel::unlink(int timer) {
+	Timer &t = timers[timer];
+	if (t.prev != -1) {
+		timers[t.prev].next = t.next;
+	}
+	else {
+		slots[t.slot] = t.next;
+	}
+	if (t.next != -1) {
+		timers[t.next].prev = t.prev;
+	}
+}
+
+/* Return an unlinked timer to the pool; its id no longer cancels anything */
+void TimerWheel::release(int timer) {
+	Timer &t = timers[timer];
+	t.slot = -1;
+	t.callback = nullptr;
+	t.generation++;
+	freeTimers.push_back(timer);
+	pending--;
+}
+
+/* Move every timer in a higher level slot down to where it now belongs */
+void TimerWheel::cascade(int slot) {
+	int timer = slots[slot];
+	slots[slot] = -1;
+	while (timer != -1) {
+		int next = timers[timer].next;
+		place(timer);
+		timer = next;
+	}
+}
+
+/*
+	Advance the wheel by one tick and fire every timer due on it. Caller
+	holds mutex, which is released while the callbacks run so they may
+	schedule new timers.
+*/
+void TimerWheel::tick() {
+	currentTick++;
+	// Cascade from the highest level whose slot just came round, so timers
+	// it moves into a lower level's current slot are moved again
+	int wrapped = 0;
+	while (wrapped < NUM_LEVELS && (currentTick & ((1ULL << (LEVEL_BITS * (wrapped + 1))) - 1)) == 0) {
+		wrapped++;
+	}
+	if (wrapped == NUM_LEVELS) {
+		cascade(OVERFLOW_SLOT);
+		wrapped--;
+	}
+	for (int level = wrapped; level > 0; level--) {
+		cascade(level * NUM_SLOTS + ((currentTick >> (LEVEL_BITS * level)) & (NUM_SLOTS - 1)));
+	}
+
+	int slot = currentTick & (NUM_SLOTS - 1);
+	if (slots[slot] == -1) {
+		return;
+	}
+	vector<function<void()>> due;
+	int64_t firedAt = now();
+	for (int timer = slots[slot]; timer != -1; ) {
+		Timer &t = timers[timer];
+		int next = t.next;
+		double slip = (firedAt - t.deadline) / 1E6;
+		totalSlip += slip;
+		maxSlip = max(maxSlip, slip);
+		slipBuckets[min(max((int) (slip * 10), 0), (int) NUM_SLIP_BUCKETS)]++;
+		numFired++;
+		due.push_back(move(t.callback));
+		release(timer);
+		timer = next;
+	}
+	slots[slot] = -1;
+
+	pthread_mutex_unlock(&mutex);
+	for (auto &callback : due) {
+		callback();
+	}
+	pthread_mutex_lock(&mutex);
+}
+
+/*
+	Timer thread: ticks the wheel along with real time. Sleeps until the
+	next tick while timers are pending, and until one is scheduled otherwise.
+*/
+void *TimerWheel::run(void *arg) {
+	TimerWheel *wheel = (TimerWheel *) arg;
+	pthread_mutex_lock(&wheel->mutex);
+	while (wheel->running) {
+		if (wheel->pending == 0) {
+			pthread_cond_wait(&wheel->scheduled, &wheel->mutex);
+			continue;
+		}
+		uint64_t dueTick = (wheel->now() - wheel->base) / 1000000;
+		if (wheel->currentTick < dueTick) {
+			// Catch up tick by tick if the thread fell behind
+			wheel->tick();
+			continue;
+		}
+
+		int64_t next = wheel->base + (int64_t) (wheel->currentTick + 1) * 1000000;
+		struct timespec nextTime = {(time_t) (next / 1000000000), (long) (next % 1000000000)};
+		pthread_mutex_unlock(&wheel->mutex);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &nextTime, nullptr);
+		pthread_mutex_lock(&wheel->mutex);
+	}
+	pthread_mutex_unlock(&wheel->mutex);
+	return nullptr;
+}
+
+/* Get the slip below which p percent of fired timers ran, in milliseconds */
+double TimerWheel::slipPercentile(double p) {
+	long target = (long) (numFired * p / 100);
+	long seen = 0;
+	for (int bucket = 0; bucket <= NUM_SLIP_BUCKETS; bucket++) {
+		seen += slipBuckets[bucket];
+		if (seen > target || (seen == numFired && seen > 0)) {
+			return (bucket + 1) / 10.0;
+		}
+	}
+	return 0;
+}
+
+/* Prints how late timers fired after their deadlines */
+void TimerWheel::printStats() {
+	pthread_mutex_lock(&mutex);
+	double avg = numFired > 0 ? totalSlip / numFired : 0;
+	cout << "Timer slip= avg " << avg << " ms, p99 < " << slipPercentile(99) << " ms, max " << maxSlip
+		<< " ms (fired= " << numFired << ", cancelled= " << numCancelled << ", peak pending= " << maxPending << ")" << endl;
+	pthread_mutex_unlock(&mutex);
+}